@@ -31,10 +31,15 @@ configure_tgrub()
 build_tgrub()
 {
     echo "- Compiling TrustedGRUB"
-    gcc util/create_sha1.c -o util/create_sha1
+    gcc -pthread util/create_sha1.c -o util/create_sha1
     if [ $? != 0 ]; then exit 601; fi
-    gcc util/verify_pcr.c -o util/verify_pcr
+    gcc -pthread util/verify_pcr.c -o util/verify_pcr
     if [ $? != 0 ]; then exit 602; fi
+    gcc -O2 util/sha1_bench.c -o util/sha1_bench
+    if [ $? != 0 ]; then exit 606; fi
+    # 32 bits, as stage2 and the grub shell, so that the shipped code is tested
+    gcc -m32 -O2 -DGRUB_UTIL=1 -I. -Istage1 -Istage2 -Ilib util/inflate_bench.c -o util/inflate_bench
+    if [ $? != 0 ]; then exit 607; fi
     make >& $VERBOSE 
     if [ $? != 0 ]; then exit 603; fi
     chmod g+w * -R
@@ -42,6 +42,8 @@ int grub_stage2 (void);
 #include <sys/time.h>
 #include <termios.h>
 #include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 #ifdef __linux__
 # include <sys/ioctl.h>		/* ioctl */
@@ -62,6 +64,7 @@ int grub_stage2 (void);
 #include <device.h>
 #include <serial.h>
 #include <term.h>
+#include <tpm_tis.h>
 
 /* Simulated memory sizes. */
 #define EXTENDED_MEMSIZE (3 * 1024 * 1024)	/* 3MB */
@@ -77,6 +80,9 @@ char *linux_data_tmp_addr = 0;
 char *linux_data_real_addr = 0;
 unsigned short io_map[IO_MAP_SIZE];
 struct apm_info apm_bios_info;
+int forced_entryno = -1;
+int boot_reached = 0;
+unsigned long extended_memsize = EXTENDED_MEMSIZE;
 
 /* Emulation requirements. */
 char *grub_scratch_mem = 0;
@@ -142,7 +148,7 @@ grub_stage2 (void)
     }
 
   assert (grub_scratch_mem == 0);
-  scratch = malloc (0x100000 + EXTENDED_MEMSIZE + 15);
+  scratch = malloc (0x100000 + extended_memsize + 15);
   assert (scratch);
   grub_scratch_mem = (char *) ((((int) scratch) >> 4) << 4);
 
@@ -265,26 +271,426 @@ stop (void)
 /* Begin TCG extension */
 
 /* Corresponds with additional TCG functions for hashing data and writing the results into PCRs as defined in file asm.S. 
-   For details see README file. */
+   For details see README file.
+   Unless EMULATE_TPM is set there is no TPM. If it is, the TPM commands
+   are carried out on EMULATED_PCR, which predicts the PCRs of a boot, or
+   are forwarded to swtpm if emulated_tpm_connect has been called. Every
+   command takes EMULATED_TPM_LATENCY microseconds, and those through the
+   emulated TCG BIOS EMULATED_BIOS_LATENCY more, so that the time spent
+   in the TPM while booting can be measured off the hardware.  */
+
+int emulate_tpm = 0;
+unsigned char emulated_pcr[24][20];
+unsigned long emulated_tpm_latency = 0;
+unsigned long emulated_bios_latency = 0;
+unsigned long emulated_tpm_commands = 0;
+unsigned long emulated_tpm_usecs = 0;
+
+/* The socket connected to swtpm, or -1.  */
+static int swtpm_fd = -1;
+/* The return code of the last call of the emulated TCG BIOS.  */
+static long tpm_answer = 0;
+
+#define TPM_TAG_RQU_COMMAND	0x00C1
+#define TPM_TAG_RSP_COMMAND	0x00C4
+#define TPM_ORD_EXTEND		0x14
+#define TPM_ORD_PCRREAD		0x15
+#define TPM_ORD_STARTUP		0x99
+#define TPM_ST_CLEAR		1
+#define TPM_BAD_PARAMETER	3
+#define TPM_FAIL		9
+#define TPM_BAD_ORDINAL		10
+
+/* TCG_PC_OK and TCG_PC_TPMERROR of the TCG BIOS.  */
+#define TCG_PC_OK		0
+#define TCG_PC_TPMERROR		1
 
 long give_tpm_answer (void)
 {
+  return tpm_answer;
 }
 
 long tcg_check_tpm (void)
 {
+  return tpm_present ();
 }
 
 long check_for_tpm (void)
 {
+  return 0;
 }
 
 long tpm_present (void)
 {
+  return emulate_tpm ? 0 : 0xbb00;
+}
+
+static unsigned long
+tpm_get32 (unsigned char *p)
+{
+  return ((unsigned long) p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static void
+tpm_put32 (unsigned char *p, unsigned long value)
+{
+  p[0] = value >> 24;
+  p[1] = value >> 16;
+  p[2] = value >> 8;
+  p[3] = value;
+}
+
+static unsigned long
+tpm_usecs (void)
+{
+  struct timeval tv;
+
+  gettimeofday (&tv, 0);
+  return tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/* Extend the PCR bank of the process with the 20 bytes in DIGEST.  */
+static void
+emulated_pcr_extend (int pcr, unsigned char *digest)
+{
+  sha1_context ctx;
+  unsigned long hash_result[5];
+  int i;
+
+  sha1_init (&ctx);
+  sha1_update (&ctx, emulated_pcr[pcr], 20);
+  sha1_update (&ctx, digest, 20);
+  sha1_finish (&ctx, hash_result);
+
+  for (i = 0; i < 5; i++)
+    tpm_put32 (emulated_pcr[pcr] + 4 * i, hash_result[i]);
+}
+
+/* Write or read exactly LEN bytes of BUF on the swtpm socket.  */
+static int
+swtpm_io (int write_it, unsigned char *buf, int len)
+{
+  while (len > 0)
+    {
+      int ret = write_it ? write (swtpm_fd, buf, len)
+	: read (swtpm_fd, buf, len);
+
+      if (ret < 0 && errno == EINTR)
+	continue;
+      if (ret <= 0)
+	return 0;
+      buf += ret;
+      len -= ret;
+    }
+
+  return 1;
+}
+
+/* Send the command of LEN bytes in BUF to swtpm and read the response
+   back into BUF of SIZE bytes. Return its length, or -1.  */
+static int
+swtpm_transmit (unsigned char *buf, int len, int size)
+{
+  if (! swtpm_io (1, buf, len) || ! swtpm_io (0, buf, TPM_HEADER_SIZE))
+    return -1;
+
+  len = tpm_get32 (buf + 2);
+  if (len < TPM_HEADER_SIZE || len > size
+      || ! swtpm_io (0, buf + TPM_HEADER_SIZE, len - TPM_HEADER_SIZE))
+    return -1;
+
+  return len;
 }
 
+/* Carry out the TPM command of LEN bytes in BUF, and put the response,
+   whose length is returned, in its place. BUF holds SIZE bytes, at
+   least TPM_MAX_COMMAND.  */
+static int
+emulated_tpm_execute (unsigned char *buf, int len, int size)
+{
+  unsigned long start = tpm_usecs ();
+  unsigned long ordinal = tpm_get32 (buf + 6);
+  unsigned long pcr = tpm_get32 (buf + 10);
+  unsigned long result = 0;
+
+  emulated_tpm_commands++;
+
+  if (swtpm_fd >= 0)
+    {
+      len = swtpm_transmit (buf, len, size);
+      if (len < 0)
+	{
+	  fprintf (stderr, "Lost the connection to swtpm\n");
+	  close (swtpm_fd);
+	  swtpm_fd = -1;
+	  result = TPM_FAIL;
+	}
+      /* Keep the PCRs of the process those of swtpm.  */
+      else if (ordinal == TPM_ORD_EXTEND && pcr < 24
+	       && len == TPM_HEADER_SIZE + 20 && ! tpm_get32 (buf + 6))
+	memmove (emulated_pcr[pcr], buf + TPM_HEADER_SIZE, 20);
+    }
+  else if (ordinal == TPM_ORD_STARTUP)
+    ;
+  else if (ordinal != TPM_ORD_EXTEND && ordinal != TPM_ORD_PCRREAD)
+    result = TPM_BAD_ORDINAL;
+  else if (len != TPM_HEADER_SIZE + (ordinal == TPM_ORD_EXTEND ? 24 : 4)
+	   || pcr >= 24)
+    result = TPM_BAD_PARAMETER;
+  else
+    {
+      if (ordinal == TPM_ORD_EXTEND)
+	emulated_pcr_extend (pcr, buf + 14);
+      memmove (buf + TPM_HEADER_SIZE, emulated_pcr[pcr], 20);
+    }
+
+  if (swtpm_fd < 0)
+    {
+      len = TPM_HEADER_SIZE;
+      if (! result
+	  && (ordinal == TPM_ORD_EXTEND || ordinal == TPM_ORD_PCRREAD))
+	len += 20;
+
+      buf[0] = TPM_TAG_RSP_COMMAND >> 8;
+      buf[1] = TPM_TAG_RSP_COMMAND & 0xFF;
+      tpm_put32 (buf + 2, len);
+      tpm_put32 (buf + 6, result);
+    }
+
+  /* The TPM itself takes its time.  */
+  while (tpm_usecs () - start < emulated_tpm_latency)
+    ;
+
+  emulated_tpm_usecs += tpm_usecs () - start;
+  return len;
+}
+
+/* Forward the TPM commands to the swtpm listening on the Unix socket
+   PATH, which is started first. Return zero on failure.  */
+int
+emulated_tpm_connect (const char *path)
+{
+  struct sockaddr_un addr;
+  unsigned char buf[TPM_MAX_COMMAND];
+
+  if (strlen (path) >= sizeof (addr.sun_path))
+    return 0;
+
+  swtpm_fd = socket (AF_UNIX, SOCK_STREAM, 0);
+  if (swtpm_fd < 0)
+    return 0;
+
+  memset (&addr, 0, sizeof (addr));
+  addr.sun_family = AF_UNIX;
+  strcpy (addr.sun_path, path);
+  if (connect (swtpm_fd, (struct sockaddr *) &addr, sizeof (addr)) < 0)
+    {
+      close (swtpm_fd);
+      swtpm_fd = -1;
+      return 0;
+    }
+
+  /* TPM_Startup(ST_CLEAR), which fails harmlessly if it has been done. */
+  buf[0] = TPM_TAG_RQU_COMMAND >> 8;
+  buf[1] = TPM_TAG_RQU_COMMAND & 0xFF;
+  tpm_put32 (buf + 2, TPM_HEADER_SIZE + 2);
+  tpm_put32 (buf + 6, TPM_ORD_STARTUP);
+  buf[10] = TPM_ST_CLEAR >> 8;
+  buf[11] = TPM_ST_CLEAR & 0xFF;
+  return swtpm_transmit (buf, TPM_HEADER_SIZE + 2, sizeof (buf)) > 0;
+}
+
+/* Extend the emulated PCR with the 20 bytes in DIGEST by TPM_Extend.  */
+void
+emulated_tpm_extend (int pcr, unsigned char *digest)
+{
+  unsigned char buf[TPM_MAX_COMMAND];
+
+  buf[0] = TPM_TAG_RQU_COMMAND >> 8;
+  buf[1] = TPM_TAG_RQU_COMMAND & 0xFF;
+  tpm_put32 (buf + 2, TPM_HEADER_SIZE + 24);
+  tpm_put32 (buf + 6, TPM_ORD_EXTEND);
+  tpm_put32 (buf + 10, pcr);
+  memmove (buf + 14, digest, 20);
+  emulated_tpm_execute (buf, TPM_HEADER_SIZE + 24, sizeof (buf));
+}
+
+/* Carry out the command of the input parameter block that update_pcr
+   has built, and leave the output parameter block in its place, as
+   TCG_PassThroughToTPM does.  */
 void tcg_hash_extend_pcr (void)
 {
+  unsigned char *block = (unsigned char *) TCG_BUFFER_ADDR + 0xF012;
+  unsigned char buf[TPM_MAX_COMMAND];
+  unsigned long start;
+  int len = (block[0] | (block[1] << 8)) - 8;
+
+  tpm_answer = TCG_PC_TPMERROR;
+  if (! emulate_tpm || len < TPM_HEADER_SIZE || len > TPM_MAX_COMMAND)
+    return;
+
+  memmove (buf, block + 8, len);
+  len = emulated_tpm_execute (buf, len, sizeof (buf));
+  if (len < 0)
+    return;
+
+  block[0] = (len + 4) & 0xFF;
+  block[1] = (len + 4) >> 8;
+  block[2] = block[3] = 0;
+  memmove (block + 4, buf, len);
+  tpm_answer = TCG_PC_OK;
+
+  /* The switches to real mode and the copies of the BIOS.  */
+  start = tpm_usecs ();
+  while (tpm_usecs () - start < emulated_bios_latency)
+    ;
+  emulated_tpm_usecs += tpm_usecs () - start;
+}
+
+/* The TIS register model. It is a TPM 1.2 at locality 0 which knows
+   the commands of the emulated TPM above, and moves at most
+   TIS_MODEL_BURST bytes per burst, so that the TIS driver of stage2 can
+   be run in the grub shell. Unless EMULATE_TPM and EMULATE_TIS are set,
+   all of its registers read as 0xFF, as without a TPM.  */
+
+#define TIS_MODEL_BURST		8
+#define TIS_MODEL_DID_VID	0x000B15D1
+
+int emulate_tis = 1;
+
+static enum
+  {
+    TIS_MODEL_IDLE,
+    TIS_MODEL_READY,
+    TIS_MODEL_RECEPTION,
+    TIS_MODEL_COMPLETION
+  }
+tis_model_state;
+static int tis_model_locality;
+static unsigned char tis_model_buf[TPM_MAX_COMMAND];
+/* The bytes received, or those of the response.  */
+static int tis_model_len;
+/* The bytes of the response read so far.  */
+static int tis_model_pos;
+
+/* Non-zero while the command received is not complete yet.  */
+static int
+tis_model_expect (void)
+{
+  return (tis_model_len < TPM_HEADER_SIZE
+	  || tis_model_len < tpm_get32 (tis_model_buf + 2));
+}
+
+/* Carry out the command received, and put the response in its place.  */
+static void
+tis_model_execute (void)
+{
+  tis_model_len = emulated_tpm_execute (tis_model_buf, tis_model_len,
+					sizeof (tis_model_buf));
+  tis_model_pos = 0;
+}
+
+unsigned char
+tis_model_read (int reg)
+{
+  int count;
+
+  if (! emulate_tpm || ! emulate_tis)
+    return 0xFF;
+
+  switch (reg)
+    {
+    case TIS_ACCESS:
+      return TIS_ACCESS_VALID
+	| (tis_model_locality ? TIS_ACCESS_ACTIVE_LOCALITY : 0);
+
+    case TIS_STS:
+      if (! tis_model_locality)
+	return 0xFF;
+      switch (tis_model_state)
+	{
+	case TIS_MODEL_READY:
+	  return TIS_STS_VALID | TIS_STS_COMMAND_READY;
+	case TIS_MODEL_RECEPTION:
+	  return TIS_STS_VALID | (tis_model_expect () ? TIS_STS_EXPECT : 0);
+	case TIS_MODEL_COMPLETION:
+	  return TIS_STS_VALID
+	    | (tis_model_pos < tis_model_len ? TIS_STS_DATA_AVAIL : 0);
+	default:
+	  return TIS_STS_VALID;
+	}
+
+    case TIS_BURST_COUNT:
+      if (! tis_model_locality)
+	return 0xFF;
+      if (tis_model_state == TIS_MODEL_COMPLETION)
+	count = tis_model_len - tis_model_pos;
+      else if (tis_model_state == TIS_MODEL_IDLE)
+	count = 0;
+      else
+	count = sizeof (tis_model_buf) - tis_model_len;
+      return count < TIS_MODEL_BURST ? count : TIS_MODEL_BURST;
+
+    case TIS_BURST_COUNT + 1:
+      return tis_model_locality ? 0 : 0xFF;
+
+    case TIS_DATA_FIFO:
+      if (tis_model_locality && tis_model_state == TIS_MODEL_COMPLETION
+	  && tis_model_pos < tis_model_len)
+	return tis_model_buf[tis_model_pos++];
+      return 0xFF;
+
+    case TIS_DID_VID:
+    case TIS_DID_VID + 1:
+    case TIS_DID_VID + 2:
+    case TIS_DID_VID + 3:
+      return TIS_MODEL_DID_VID >> (8 * (reg - TIS_DID_VID));
+
+    default:
+      return 0xFF;
+    }
+}
+
+void
+tis_model_write (int reg, unsigned char value)
+{
+  if (! emulate_tpm || ! emulate_tis)
+    return;
+
+  if (reg == TIS_ACCESS)
+    {
+      if (value & TIS_ACCESS_REQUEST_USE)
+	tis_model_locality = 1;
+      else if (value & TIS_ACCESS_ACTIVE_LOCALITY)
+	tis_model_locality = 0;
+      return;
+    }
+
+  /* The other registers belong to the active locality.  */
+  if (! tis_model_locality)
+    return;
+
+  if (reg == TIS_STS && (value & TIS_STS_COMMAND_READY))
+    {
+      tis_model_state = TIS_MODEL_READY;
+      tis_model_len = tis_model_pos = 0;
+    }
+  else if (reg == TIS_STS && (value & TIS_STS_GO))
+    {
+      if (tis_model_state == TIS_MODEL_RECEPTION && ! tis_model_expect ())
+	{
+	  tis_model_execute ();
+	  tis_model_state = TIS_MODEL_COMPLETION;
+	}
+    }
+  else if (reg == TIS_DATA_FIFO
+	   && (tis_model_state == TIS_MODEL_READY
+	       || tis_model_state == TIS_MODEL_RECEPTION))
+    {
+      tis_model_state = TIS_MODEL_RECEPTION;
+      if (tis_model_len < sizeof (tis_model_buf))
+	tis_model_buf[tis_model_len++] = value;
+    }
 }
 
 /* End TCG extension */
@@ -306,6 +712,7 @@ void
 chain_stage1 (unsigned long segment, unsigned long offset,
 	      unsigned long part_table_addr)
 {
+  boot_reached = 1;
   stop ();
 }
 
@@ -313,6 +720,7 @@ chain_stage1 (unsigned long segment, unsigned long offset,
 void
 chain_stage2 (unsigned long segment, unsigned long offset, int second_sector)
 {
+  boot_reached = 1;
   stop ();
 }
 
@@ -321,6 +729,7 @@ chain_stage2 (unsigned long segment, unsigned long offset, int second_sector)
 void
 linux_boot (void)
 {
+  boot_reached = 1;
   stop ();
 }
 
@@ -329,6 +738,7 @@ linux_boot (void)
 void
 big_linux_boot (void)
 {
+  boot_reached = 1;
   stop ();
 }
 
@@ -337,6 +747,7 @@ big_linux_boot (void)
 void
 multi_boot (int start, int mb_info)
 {
+  boot_reached = 1;
   stop ();
 }
 
@@ -387,7 +798,7 @@ get_memsize (int type)
   if (! type)
     return CONVENTIONAL_MEMSIZE >> 10;
   else
-    return EXTENDED_MEMSIZE >> 10;
+    return extended_memsize >> 10;
 }
 
 
@@ -398,7 +809,7 @@ get_memsize (int type)
 int
 get_eisamemsize (void)
 {
-  return (EXTENDED_MEMSIZE >> 10);
+  return (extended_memsize >> 10);
 }
 
 
@@ -444,6 +855,8 @@ get_mmap_entry (struct mmar_desc *desc, int cont)
   
   int num = sizeof (desc_table) / sizeof (*desc_table);
 
+  desc_table[2].length = extended_memsize;
+
   if (cont < 0 || cont >= num)
     {
       /* Should not happen.  */
@@ -951,11 +1364,11 @@ hex_dump (void *buf, size_t size)
   grub_printf ("\n");
 }
 
-int
-biosdisk (int subfunc, int drive, struct geometry *geometry,
-	  int sector, int nsec, int segment)
+/* Read/write NSEC sectors starting from SECTOR in DRIVE from/into BUF.  */
+static int
+biosdisk_rw (int subfunc, int drive, struct geometry *geometry,
+	     int sector, int nsec, char *buf)
 {
-  char *buf;
   int fd = geometry->flags;
 
   /* Get the file pointer from the geometry, and make sure it matches. */
@@ -986,8 +1399,6 @@ biosdisk (int subfunc, int drive, struct geometry *geometry,
   }
 #endif
 
-  buf = (char *) (segment << 4);
-
   switch (subfunc)
     {
     case BIOSDISK_READ:
@@ -1029,6 +1440,28 @@ biosdisk (int subfunc, int drive, struct geometry *geometry,
   return 0;
 }
 
+int
+biosdisk (int subfunc, int drive, struct geometry *geometry,
+	  int sector, int nsec, int segment)
+{
+  return biosdisk_rw (subfunc, drive, geometry, sector, nsec,
+		      (char *) (segment << 4));
+}
+
+/* Like an EDD 3.0 BIOS, transfer straight to/from ADDRESS, unless
+   the user asked for a BIOS without it.  */
+int
+biosdisk_flat (int subfunc, int drive, struct geometry *geometry,
+	       int sector, int nsec, unsigned long address)
+{
+  if (! flat_reads)
+    /* Invalid function.  */
+    return 1;
+
+  return biosdisk_rw (subfunc, drive, geometry, sector, nsec,
+		      (char *) address);
+}
+
 
 void
 stop_floppy (void)
@@ -44,6 +44,7 @@ int use_curses = 0;
 int verbose = 0;
 int read_only = 0;
 int floppy_disks = 1;
+int flat_reads = 1;
 char *device_map_file = 0;
 static int default_boot_drive;
 static int default_install_partition;
@@ -65,6 +66,7 @@ static char *default_config_file;
 #define OPT_DEVICE_MAP		-15
 #define OPT_PRESET_MENU		-16
 #define OPT_NO_PAGER		-17
+#define OPT_NO_FLAT_READS	-18
 #define OPTSTRING ""
 
 static struct option longopts[] =
@@ -78,6 +80,7 @@ static struct option longopts[] =
   {"install-partition", required_argument, 0, OPT_INSTALL_PARTITION},
   {"no-config-file", no_argument, 0, OPT_NO_CONFIG_FILE},
   {"no-curses", no_argument, 0, OPT_NO_CURSES},
+  {"no-flat-reads", no_argument, 0, OPT_NO_FLAT_READS},
   {"no-floppy", no_argument, 0, OPT_NO_FLOPPY},
   {"no-pager", no_argument, 0, OPT_NO_PAGER},
   {"preset-menu", no_argument, 0, OPT_PRESET_MENU},
@@ -109,6 +112,7 @@ Enter the GRand Unified Bootloader command shell.\n\
     --install-partition=PAR  specify stage2 install_partition [default=0x%x]\n\
     --no-config-file         do not use the config file\n\
     --no-curses              do not use curses\n\
+    --no-flat-reads          emulate a BIOS without EDD 3.0 flat addresses\n\
     --no-floppy              do not probe any floppy drive\n\
     --no-pager               do not use internal pager\n\
     --preset-menu            use the preset menu\n\
@@ -206,6 +210,10 @@ main (int argc, char **argv)
 	  use_pager = 0;
 	  break;
 
+	case OPT_NO_FLAT_READS:
+	  flat_reads = 0;
+	  break;
+
 	case OPT_BATCH:
 	  /* This is the same as "--no-config-file --no-curses --no-pager".  */
 	  use_config_file = 0;
@@ -0,0 +1,573 @@
+/* predict_pcr.c - predict the PCRs of a Trusted GRUB boot offline */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 1999,2000,2001,2002  Free Software Foundation, Inc.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/* Each disk image is booted by the stage2 simulator with an emulated
+   TPM, in a process of its own, since stage2 cannot be restarted within
+   one process. PCR 8 and 9 are computed from stage1 and stage2 as found
+   in the image, PCR 12 to 14 by running the menu entry. PCR 4 and 5
+   depend on the BIOS and are not predicted.  */
+
+/* Simulator entry point. */
+int grub_stage2 (void);
+
+#include <stdio.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define WITHOUT_LIBC_STUBS 1
+#include <shared.h>
+#include <term.h>
+#include <stage1.h>
+
+char *program_name = 0;
+int use_config_file = 1;
+int use_preset_menu = 0;
+int use_curses = 0;
+int verbose = 0;
+int read_only = 1;
+int floppy_disks = 0;
+int flat_reads = 1;
+char *device_map_file = 0;
+
+static int entry = 0;
+static int jobs = 1;
+static unsigned long memory = 512;
+static unsigned long partition = 0xFFFF;
+static char *swtpm_socket = 0;
+static int tpm_timing = 0;
+
+/* The first PCR and the number of PCRs reported.  */
+#define FIRST_PCR	8
+#define NUM_PCRS	7
+
+/* The start of stage2 part 2, which is hashed into PCR 9.  */
+#define STAGE2_PART2_ADDR	0x8200
+
+/* At most this many blocklists fit into the start sector.  */
+#define MAX_BLOCKLISTS	(SECTOR_SIZE / BOOTSEC_LISTSIZE)
+
+#define OPT_HELP		-2
+#define OPT_VERSION		-3
+#define OPT_CONFIG_FILE		-5
+#define OPT_INSTALL_PARTITION	-6
+#define OPT_VERBOSE		-11
+#define OPT_ENTRY		-18
+#define OPT_JOBS		-19
+#define OPT_MEMORY		-20
+#define OPT_NO_TIS		-21
+#define OPT_TPM_LATENCY		-22
+#define OPT_BIOS_LATENCY	-23
+#define OPT_SWTPM		-24
+#define OPTSTRING ""
+
+static struct option longopts[] =
+{
+  {"bios-latency", required_argument, 0, OPT_BIOS_LATENCY},
+  {"config-file", required_argument, 0, OPT_CONFIG_FILE},
+  {"entry", required_argument, 0, OPT_ENTRY},
+  {"help", no_argument, 0, OPT_HELP},
+  {"install-partition", required_argument, 0, OPT_INSTALL_PARTITION},
+  {"jobs", required_argument, 0, OPT_JOBS},
+  {"memory", required_argument, 0, OPT_MEMORY},
+  {"no-tis", no_argument, 0, OPT_NO_TIS},
+  {"swtpm", required_argument, 0, OPT_SWTPM},
+  {"tpm-latency", required_argument, 0, OPT_TPM_LATENCY},
+  {"verbose", no_argument, 0, OPT_VERBOSE},
+  {"version", no_argument, 0, OPT_VERSION},
+  {0},
+};
+
+
+static void
+usage (int status)
+{
+  if (status)
+    fprintf (stderr, "Try ``predict_pcr --help'' for more information.\n");
+  else
+    printf ("\
+Usage: predict_pcr [OPTION]... IMAGE...\n\
+\n\
+Predict the PCRs and the event log of booting Trusted GRUB from disk IMAGE.\n\
+\n\
+    --bios-latency=USECS     add USECS to each TPM command through the BIOS\n\
+    --config-file=FILE       specify stage2 config_file [default=%s]\n\
+    --entry=NUM              boot the menu entry NUM [default=%d]\n\
+    --help                   display this message and exit\n\
+    --install-partition=PAR  specify stage2 install_partition [default=0x%lx]\n\
+    --jobs=NUM               boot up to NUM images in parallel [default=%d]\n\
+    --memory=MB              simulate MB megabytes of memory [default=%lu]\n\
+    --no-tis                 reach the TPM through the TCG BIOS, not TIS\n\
+    --swtpm=SOCKET           use the swtpm listening on the Unix SOCKET\n\
+    --tpm-latency=USECS      let each TPM command take USECS\n\
+    --verbose                print the output of stage2 to stderr\n\
+    --version                print version information and exit\n\
+\n\
+Report bugs to <bug-grub@gnu.org>.\n\
+",
+	    config_file, entry, partition, jobs, memory);
+
+  exit (status);
+}
+
+
+/* Read LEN sectors from sector SECTOR of the image FD into BUF.  */
+static int
+read_sectors (int fd, unsigned long sector, int len, char *buf)
+{
+  off_t offset = (off_t) sector * SECTOR_SIZE;
+
+  return pread (fd, buf, len * SECTOR_SIZE, offset) == len * SECTOR_SIZE;
+}
+
+/* Extend the SHA1 value of LEN bytes at DATA into the emulated PCR.  */
+static void
+extend_data (int pcr, char *data, unsigned long len)
+{
+  sha1_context ctx;
+  unsigned long hash_result[5];
+  unsigned char digest[20];
+  int i;
+
+  sha1_init (&ctx);
+  sha1_update (&ctx, (unsigned char *) data, len);
+  sha1_finish (&ctx, hash_result);
+
+  for (i = 0; i < 5; i++)
+    {
+      digest[4 * i] = hash_result[i] >> 24;
+      digest[4 * i + 1] = hash_result[i] >> 16;
+      digest[4 * i + 2] = hash_result[i] >> 8;
+      digest[4 * i + 3] = hash_result[i];
+    }
+
+  emulated_tpm_extend (pcr, digest);
+}
+
+/* Replay what stage1 and start.S extend into PCR 8 and 9 when booting
+   from the image FD. Return zero and print a message to REPORT if the
+   image has no Trusted GRUB in its first sector.  */
+static int
+measure_stage2 (int fd, FILE *report)
+{
+  char stage1[SECTOR_SIZE], start[SECTOR_SIZE];
+  char *list, *stage2;
+  unsigned long start_sector, stage2_size, end;
+  int i;
+
+  if (! read_sectors (fd, 0, 1, stage1))
+    {
+      fprintf (report, "  Cannot read stage1\n");
+      return 0;
+    }
+
+  /* PCR 8 is the start sector of stage2, as stage1 loads it.  */
+  start_sector = *((unsigned long *) (stage1 + STAGE1_STAGE2_SECTOR));
+  if (! read_sectors (fd, start_sector, 1, start))
+    {
+      fprintf (report, "  Cannot read the start sector of stage2\n");
+      return 0;
+    }
+
+  extend_data (8, start, SECTOR_SIZE);
+
+  /* PCR 9 is as many bytes of what the blocklists load as the start
+     sector says.  */
+  stage2_size = *((unsigned long *) (start + STAGE2_HASH_LEN_OFFS));
+  if (! stage2_size || stage2_size > 0x80000 - STAGE2_PART2_ADDR)
+    {
+      fprintf (report, "  Invalid size of stage2\n");
+      return 0;
+    }
+
+  stage2 = calloc (1, stage2_size + SECTOR_SIZE);
+  assert (stage2);
+
+  end = 0;
+  list = start + SECTOR_SIZE - BOOTSEC_LISTSIZE;
+  for (i = 0; i < MAX_BLOCKLISTS && *((unsigned short *) (list + 4)); i++)
+    {
+      unsigned long sector = *((unsigned long *) list);
+      int len = *((unsigned short *) (list + 4));
+      unsigned long addr = (*((unsigned short *) (list + 6)) << 4)
+	- STAGE2_PART2_ADDR;
+
+      if (addr >= stage2_size)
+	break;
+
+      /* Never read past the data hashed.  */
+      if (addr + len * SECTOR_SIZE > stage2_size + SECTOR_SIZE)
+	len = (stage2_size - addr + SECTOR_SIZE - 1) / SECTOR_SIZE;
+
+      if (! read_sectors (fd, sector, len, stage2 + addr))
+	{
+	  fprintf (report, "  Cannot read stage2\n");
+	  free (stage2);
+	  return 0;
+	}
+
+      if (addr + len * SECTOR_SIZE > end)
+	end = addr + len * SECTOR_SIZE;
+
+      list -= BOOTSEC_LISTSIZE;
+    }
+
+  if (end < stage2_size)
+    {
+      fprintf (report, "  The blocklists do not cover stage2\n");
+      free (stage2);
+      return 0;
+    }
+
+  extend_data (9, stage2, stage2_size);
+  free (stage2);
+  return 1;
+}
+
+/* Print the event log of stage2 to REPORT.  */
+static void
+print_event_log (FILE *report)
+{
+  char *log;
+  int len, offset, i;
+
+  log = tcg_event_log (&len);
+  if (! log)
+    {
+      fprintf (report, "  The event log has lost events\n");
+      return;
+    }
+
+  for (offset = 0; offset < len;
+       offset += sizeof (struct tcg_pcr_event)
+	 + ((struct tcg_pcr_event *) (log + offset))->event_size)
+    {
+      struct tcg_pcr_event *event = (struct tcg_pcr_event *) (log + offset);
+
+      fprintf (report, "  Event: PCR%02lu 0x%02lx ", event->pcr_index,
+	       event->event_type);
+      for (i = 0; i < 20; i++)
+	fprintf (report, "%02x", event->digest[i]);
+      fprintf (report, " \"");
+      for (i = 0; i < event->event_size; i++)
+	{
+	  unsigned char c = event->event[i];
+
+	  if (c < ' ' || c > '~' || c == '"' || c == '\\')
+	    fprintf (report, "\\x%02x", c);
+	  else
+	    fputc (c, report);
+	}
+      fprintf (report, "\"\n");
+    }
+}
+
+/* Boot the image IMAGE and print the PCRs to REPORT. This must run in a
+   process of its own. Return the exit status.  */
+static int
+predict (char *image, FILE *report)
+{
+  char map_file[] = "/tmp/predict_pcr.XXXXXX";
+  FILE *map;
+  int fd, null, i, j;
+
+  fprintf (report, "%s:\n", image);
+
+  fd = open (image, O_RDONLY);
+  if (fd < 0)
+    {
+      fprintf (report, "  Cannot open the image\n");
+      return 1;
+    }
+
+  emulate_tpm = 1;
+  if (swtpm_socket && ! emulated_tpm_connect (swtpm_socket))
+    {
+      fprintf (report, "  Cannot connect to swtpm at %s\n", swtpm_socket);
+      close (fd);
+      return 1;
+    }
+
+  if (! measure_stage2 (fd, report))
+    {
+      close (fd);
+      return 1;
+    }
+  close (fd);
+
+  /* Let stage2 find the image as the first hard disk.  */
+  fd = mkstemp (map_file);
+  if (fd < 0 || ! (map = fdopen (fd, "w")))
+    {
+      fprintf (report, "  Cannot create a device map\n");
+      return 1;
+    }
+  fprintf (map, "(hd0)\t%s\n", image);
+  fclose (map);
+  device_map_file = map_file;
+
+  /* Stage2 must neither wait for keys nor fill the screen.  */
+  null = open ("/dev/null", O_RDWR);
+  dup2 (null, 0);
+  dup2 (verbose ? 2 : null, 1);
+  close (null);
+
+  current_term->flags = TERM_NO_EDIT | TERM_DUMB;
+  use_pager = 0;
+  boot_drive = 0x80;
+  install_partition = partition;
+  extended_memsize = (memory - 1) << 20;
+  forced_entryno = entry;
+
+  grub_stage2 ();
+  unlink (map_file);
+
+  for (i = FIRST_PCR; i < FIRST_PCR + NUM_PCRS; i++)
+    {
+      fprintf (report, "  PCR%02d: ", i);
+      for (j = 0; j < 20; j++)
+	fprintf (report, "%02x", emulated_pcr[i][j]);
+      fprintf (report, "\n");
+    }
+
+  print_event_log (report);
+
+  if (tpm_timing)
+    fprintf (report, "  TPM: %lu commands in %lu us\n",
+	     emulated_tpm_commands, emulated_tpm_usecs);
+
+  if (! boot_reached)
+    {
+      fprintf (report, "  Entry %d did not boot\n", entry);
+      return 1;
+    }
+
+  return 0;
+}
+
+
+/* Print the report of IMAGE from the temporary file REPORT, which is
+   closed, and say why it failed if CHILD_STATUS is not a success. Return
+   non-zero if it failed.  */
+static int
+print_report (char *image, FILE *report, int child_status)
+{
+  int c;
+
+  rewind (report);
+  while ((c = getc (report)) != EOF)
+    putchar (c);
+  fclose (report);
+
+  if (WIFEXITED (child_status) && ! WEXITSTATUS (child_status))
+    return 0;
+
+  fflush (stdout);
+  if (WIFSIGNALED (child_status))
+    fprintf (stderr, "%s: %s: killed by signal %d\n", program_name, image,
+	     WTERMSIG (child_status));
+  else
+    fprintf (stderr, "%s: %s: failed\n", program_name, image);
+  return 1;
+}
+
+int
+main (int argc, char **argv)
+{
+  FILE **reports;
+  pid_t *pids;
+  int *states;
+  int c, i, next, printed, running, failed = 0;
+
+  program_name = argv[0];
+
+  /* Parse command-line options. */
+  do
+    {
+      c = getopt_long (argc, argv, OPTSTRING, longopts, 0);
+      switch (c)
+	{
+	case EOF:
+	  /* Fall through the bottom of the loop. */
+	  break;
+
+	case OPT_HELP:
+	  usage (0);
+	  break;
+
+	case OPT_VERSION:
+	  printf ("predict_pcr (GNU GRUB " VERSION ")\n");
+	  exit (0);
+	  break;
+
+	case OPT_CONFIG_FILE:
+	  strncpy (config_file, optarg, 127); /* FIXME: arbitrary */
+	  config_file[127] = '\0';
+	  break;
+
+	case OPT_INSTALL_PARTITION:
+	  partition = strtoul (optarg, 0, 0);
+	  if (partition == ULONG_MAX)
+	    {
+	      perror ("strtoul");
+	      exit (1);
+	    }
+	  break;
+
+	case OPT_ENTRY:
+	  entry = atoi (optarg);
+	  if (entry < 0)
+	    usage (1);
+	  break;
+
+	case OPT_JOBS:
+	  jobs = atoi (optarg);
+	  if (jobs < 1)
+	    usage (1);
+	  break;
+
+	case OPT_MEMORY:
+	  memory = strtoul (optarg, 0, 0);
+	  if (memory < 2 || memory > 3072)
+	    {
+	      fprintf (stderr, "%s: memory must be 2 to 3072 MB\n",
+		       program_name);
+	      exit (1);
+	    }
+	  break;
+
+	case OPT_NO_TIS:
+	  emulate_tis = 0;
+	  break;
+
+	case OPT_TPM_LATENCY:
+	  emulated_tpm_latency = strtoul (optarg, 0, 0);
+	  tpm_timing = 1;
+	  break;
+
+	case OPT_BIOS_LATENCY:
+	  emulated_bios_latency = strtoul (optarg, 0, 0);
+	  tpm_timing = 1;
+	  break;
+
+	case OPT_SWTPM:
+	  swtpm_socket = optarg;
+	  tpm_timing = 1;
+	  break;
+
+	case OPT_VERBOSE:
+	  verbose = 1;
+	  break;
+
+	default:
+	  usage (1);
+	}
+    }
+  while (c != EOF);
+
+  if (optind >= argc)
+    usage (1);
+
+  /* swtpm serves one connection at a time.  */
+  if (swtpm_socket)
+    jobs = 1;
+
+  argc -= optind;
+  argv += optind;
+  reports = malloc (argc * sizeof (*reports));
+  pids = malloc (argc * sizeof (*pids));
+  states = malloc (argc * sizeof (*states));
+  assert (reports && pids && states);
+
+  /* Boot up to JOBS images at once. The reports are collected in
+     temporary files, and printed in the order of the images as soon as
+     the images before have been printed. So that no more than about
+     2 * JOBS files are open, however slow a single image is, an image
+     is only started within 2 * JOBS of the first one not printed.  */
+  fflush (stdout);
+  next = printed = running = 0;
+  while (next < argc || running)
+    {
+      if (next < argc && running < jobs && next - printed < 2 * jobs)
+	{
+	  reports[next] = tmpfile ();
+	  if (! reports[next])
+	    {
+	      perror ("tmpfile");
+	      exit (1);
+	    }
+
+	  pids[next] = fork ();
+	  if (pids[next] < 0)
+	    {
+	      perror ("fork");
+	      exit (1);
+	    }
+	  if (pids[next] == 0)
+	    {
+	      int ret = predict (argv[next], reports[next]);
+
+	      fclose (reports[next]);
+	      _exit (ret);
+	    }
+
+	  next++;
+	  running++;
+	}
+      else
+	{
+	  int child_status;
+	  pid_t pid = wait (&child_status);
+
+	  if (pid < 0)
+	    {
+	      perror ("wait");
+	      exit (1);
+	    }
+
+	  running--;
+	  for (i = printed; i < next; i++)
+	    if (pids[i] == pid)
+	      {
+		pids[i] = 0;
+		states[i] = child_status;
+		break;
+	      }
+
+	  while (printed < next && ! pids[printed])
+	    {
+	      failed += print_report (argv[printed], reports[printed],
+				      states[printed]);
+	      printed++;
+	    }
+	}
+    }
+
+  if (failed)
+    fprintf (stderr, "%s: %d of %d images failed\n", program_name, failed,
+	     argc);
+  return failed ? 1 : 0;
+}
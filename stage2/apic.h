@@ -60,6 +60,12 @@
 #define LAPIC_ESR				0x280
 #define LAPIC_ICR				0x300
 #define		LAPIC_DEST_MASK			0xFFFFFF
+#define		LAPIC_ICR_DM_INIT		0x500
+#define		LAPIC_ICR_DM_STARTUP		0x600
+#define		LAPIC_ICR_STATUS_PEND		0x1000
+#define		LAPIC_ICR_LEVEL_ASSERT		0x4000
+#define		LAPIC_ICR_TRIG_LEVEL		0x8000
+#define LAPIC_ICR_HIGH				0x310
 #define LAPIC_LVTT				0x320
 #define LAPIC_LVTPC		       		0x340
 #define LAPIC_LVT0				0x350
@@ -121,6 +121,39 @@ biosdisk (int read, int drive, struct geometry *geometry,
   return err;
 }
 
+/* Read/write NSEC sectors starting from SECTOR in DRIVE disk with GEOMETRY
+   from/into the memory at the flat ADDRESS, which may be above 1MB, with
+   an EDD 3.0 disk address packet. Return the error number of the BIOS, or
+   zero. There is no fallback, so that the caller can use a bounce buffer
+   instead.  */
+int
+biosdisk_flat (int read, int drive, struct geometry *geometry,
+	       int sector, int nsec, unsigned long address)
+{
+  struct disk_address_packet
+  {
+    unsigned char length;
+    unsigned char reserved;
+    unsigned short blocks;
+    unsigned long buffer;
+    unsigned long long block;
+    unsigned long long flat_buffer;
+  } __attribute__ ((packed)) dap;
+
+  if (! (geometry->flags & BIOSDISK_FLAG_FLAT_ADDRESS))
+    return 1;
+
+  dap.length = sizeof (dap);
+  dap.reserved = 0;
+  dap.blocks = nsec;
+  /* FFFF:FFFF tells the BIOS to use FLAT_BUFFER instead.  */
+  dap.buffer = 0xFFFFFFFF;
+  dap.block = sector;
+  dap.flat_buffer = address;
+
+  return biosdisk_int13_extensions ((read + 0x42) << 8, drive, &dap);
+}
+
 /* Check bootable CD-ROM emulation status.  */
 static int
 get_cdinfo (int drive, struct geometry *geometry)
@@ -250,6 +283,10 @@ get_diskinfo (int drive, struct geometry *geometry)
 	      /* Set the LBA flag.  */
 	      geometry->flags = BIOSDISK_FLAG_LBA_EXTENSION;
 
+	      /* EDD 3.0 may take a flat buffer address.  */
+	      if (version >= 0x30)
+		geometry->flags |= BIOSDISK_FLAG_FLAT_ADDRESS;
+
 	      /* I'm not sure if GRUB should check the bit 1 of DRP.FLAGS,
 		 so I omit the check for now. - okuji  */
 	      /* if (drp.flags & (1 << 1)) */
@@ -32,11 +32,17 @@ static int linux_mem_size;
 
     /* update_pcr is an internal function to extend the TPM PCR with
     a given hash-value. The parameters are the PCR-Register (between
-    8 and 15) and the SHA1-hash-value (in 5 unsigned long variables) */
+    8 and 15) and the SHA1-hash-value (in 5 unsigned long variables).
+    It returns 0 if the PCR has been extended, and -1 if the TPM could
+    not be reached or has returned an error code */
 
 int update_pcr(unsigned char pcr, unsigned long *hash_result)
 {
     int i;
+    int failed;
+    // The return code of the TPM, after the length of the output
+    // parameter block, the tag and the length of the response
+    unsigned char *return_code = (unsigned char *) TCG_BUFFER_ADDR + 0xF01C;
     if ((pcr < 8) || (pcr > 15))
     {
 	printf("\ntGRUB: Wrong PCR register, allowed values are 8...15\n");
@@ -93,7 +99,7 @@ int update_pcr(unsigned char pcr, unsigned long *hash_result)
 	printf("%x ",((char*)TCG_BUFFER_ADDR)[0xF012+i]&0xff);
 #endif
 
-    tcg_hash_extend_pcr();
+    failed = tcg_pass_through();
 
 #ifdef DEBUG
     printf("\ntGRUB: Results of BIOS call: %x", give_tpm_answer());
@@ -106,6 +112,9 @@ int update_pcr(unsigned char pcr, unsigned long *hash_result)
     printf("\nPress any key to continue\n");
     getkey();
 #endif
+    if (failed || return_code[0] || return_code[1] || return_code[2]
+	|| return_code[3])
+	return -1;
     return 0;
 }
 
@@ -114,107 +123,56 @@ int update_pcr(unsigned char pcr, unsigned long *hash_result)
     hash value followed by the file which belongs to it. The task of this routine 
     is to verify if the hash value is still as is should be, i.e., the integrity of 
     arbitrary files can be checked. All hash values generated here are written into 
-    PCR 13. This command is also available via the command line*/
-
-int
-load_checkfile (char *checkfile)
+    PCR 13. This command is also available via the command line.
+    The checkfile is read in chunks, so it may have any size. As GRUB can only
+    have one file open at a time, it is closed while the files listed in a chunk
+    are hashed and opened again for the next chunk. Every verified file is added
+    to the checkfile index, against which it is checked again when it is loaded.*/
+
+/* Convert the 40 hex digits at STR into the five words of a SHA1 value.
+   Return zero if STR is not a hash value. */
+static int
+parse_sha1_string (char *str, unsigned long *hash)
 {
+    int i, digit;
 
-    int MY_BUFFER_SIZE = 2 * TCG_BUFFER_SIZE;
+    for (i=0; i<40; i++)
+    {
+	if (str[i] >= '0' && str[i] <= '9')
+	    digit = str[i] - '0';
+	else if (tolower (str[i]) >= 'a' && tolower (str[i]) <= 'f')
+	    digit = tolower (str[i]) - 'a' + 10;
+	else
+	    return 0;
+
+	if (!(i & 7))
+	    hash[i >> 3] = 0;
+	hash[i >> 3] = (hash[i >> 3] << 4) | digit;
+    }
+    return 1;
+}
+
+/* Verify the file of a single checkfile entry. Return the number of
+   integrity errors found (0 or 1), or -1 if the entry is unusable. */
+static int
+check_file_entry (char *entry)
+{
     int i;
-    int result;
-    int general_error;
-    int max_length;
-    int curr_length;
     int file_ok = 0;
+    unsigned long reference[5];
     unsigned long hash_result[5];
-    unsigned char sha1_hash_buf_string[41];
-    unsigned char hash_input_buf[41];
-    unsigned char file_name_buf[1024];
-    unsigned char check_file_data[MY_BUFFER_SIZE];
-#ifdef SHOW_SHA1  
-    printf("\ntGRUB: Opening checkfile %s\n",checkfile);
-#endif
-    /* Disabling loadage SHA1-measurement. This is because we call our internal
-    SHA1-function and do not need to measure via grub_read */
-    if (perform_sha1)
-    {
-	old_perform_sha1_value = perform_sha1;
-	perform_sha1 = 0;
-    }
+    char *file_name_buf = entry + 41;
 
-  /* Try to open checkfile. If it fails, GRUB has to be stopped */
-    result = grub_open (checkfile);
-    if (!result)
+    /* Is the entry in correct format? (i.e., a hash value, followed by a single white space character and a file name) */
+    if (!parse_sha1_string (entry, reference) || entry[40] != ' ' || !*file_name_buf)
     {
-	printf("\ntGRUB error: Could not open checkfile (error code %d)\n",result);
+	printf("\ntGRUB error: File list not in correct format\n"
+	"File format has to be: \n"
+	"<20 Byte hash> <single white space character>"
+	"<filename (in GRUB format)> <new line character>\n"
+	",e.g.:aabbccddeeff0011223344556677889900aabbcc (hd0,0)/boot/grub/file\n"); 
 	return -1;
     }
-  
-  if (filemax > MY_BUFFER_SIZE)
-    {
-      printf("\ntGRUB error: File list too large\n");
-      grub_close ();
-      return -1;
-    }
-
-  /* Extracts all data out of the checkfile and closes it */
-  max_length = filemax;
-  grub_read (check_file_data, max_length);
-  grub_close ();
-
-  curr_length = 0;
-  general_error = 0;
-  file_ok = 0;
-
-  /* All entries within the checkfile are regarded subsequently */
-  while (curr_length < max_length)
-    {
-      /* Extracts the hash value (the reference value). In correct case, its length has to be 40 bytes (2 bytes for every character, thus representing a 160 bit SHA1 value) */
-      for (i=0; i<40; i++)
-		{
-		  hash_input_buf[i] = check_file_data[curr_length];
-		  curr_length++;
-		}
-
-      hash_input_buf[40] = '\0';
-
-      /* Is the entry in correct format? (i.e., a hash value, followed by a single white space character and a file name) */
-      if (check_file_data[curr_length] != ' ')
-		{
-		  printf("\ntGRUB error: File list not in correct format\n"
-		  "File format has to be: \n"
-		  "<20 Byte hash> <single white space character>"
-		  "<filename (in GRUB format)> <new line character>\n"
-		  ",e.g.:aabbccddeeff0011223344556677889900aabbcc (hd0,0)/boot/grub/file\n"); 
-		  return 1;
-		}
-
-      curr_length++;
-      i = 0;
-
-      /* Reads out the name of the file that has to be checked */
-      while (1)
-		{
-		  /* Every entry in the checkfile has to be terminated by a new line character */
-		  if (check_file_data[curr_length] == '\n')
-			{
-			  curr_length++;
-			  file_name_buf[i] = '\0';
-			  break;
-			}
-	  
-		  file_name_buf[i] = check_file_data[curr_length];
-		  i++;
-		  curr_length++;
-
-		  /* The length of the file name is limited to 1024 bytes. There is no general reason for choosing this value but longer file names do not appear in practice and, without limitation, a buffer overflow may be possible */
-		  if (i > 1023)
-			{
-			  printf("\ntGRUB error: File name too long\n");
-			  return -1;
-			}
-		}
 
     // Calculate the SHA1-value and store it into hash_result.
     if (calculate_sha1(file_name_buf, hash_result,0))
@@ -222,26 +180,16 @@ load_checkfile (char *checkfile)
         printf("\ntGRUB error during SHA1-calculation. Is your checkfile-syntax OK?\n");
         return -1;
     }
-    
-    // convert the hash result from our sha1-function into a char-buffer
-    for (i=0; i<5; i++)
-    {
-	sprintf(&sha1_hash_buf_string[8*i],"%x%x%x%x%x%x%x%x",
-	((hash_result[i]>>28)&0x0f),
-	((hash_result[i]>>24)&0x0f),
-	((hash_result[i]>>20)&0x0f),
-	((hash_result[i]>>16)&0x0f),
-	((hash_result[i]>>12)&0x0f),
-	((hash_result[i]>> 8)&0x0f),
-	((hash_result[i]>> 4)&0x0f),
-	((hash_result[i]    )&0x0f));
-    }
-    sha1_hash_buf_string[40] = 0;
 
 #ifdef SHOW_SHA1
     if ((xy++)>17){ cls(); xy=0; }
     gotoxy(0,(xy&0xff));
-    printf("Chkf:[%s]->PCR[%d] ",sha1_hash_buf_string,PCR_CHECKFILE);
+    printf("Chkf:[");
+    for (i=0; i<5; i++)
+	grub_printf("%x%x%x%x%x%x%x%x",((hash_result[i]>>28)&0x0f),((hash_result[i]>>24)&0x0f),
+	((hash_result[i]>>20)&0x0f),((hash_result[i]>>16)&0x0f),((hash_result[i]>>12)&0x0f),
+	((hash_result[i]>>8)&0x0f),((hash_result[i]>>4)&0x0f),(hash_result[i]&0x0f));
+    printf("]->PCR[%d] ",PCR_CHECKFILE);
     for (i=0; i<22; i++)
     {
 	if (file_name_buf[i])
@@ -253,11 +201,9 @@ load_checkfile (char *checkfile)
 #endif
 
     /* Compares the actual hash value with the reference value */
-    if (strcmp(sha1_hash_buf_string, hash_input_buf))
-    {
-	file_ok = 1;
-	general_error++;
-    }
+    for (i=0; i<5; i++)
+	if (hash_result[i] != reference[i])
+	    file_ok = 1;
     
     if (file_ok)
     {
@@ -268,18 +214,119 @@ load_checkfile (char *checkfile)
 #ifndef SHOW_SHA1
 	printf("\ntGRUB: Verifying %s -> Integrity Error!",file_name_buf);
 #endif
-	file_ok = 0;	
+	return 1;
     }
-    else
+
+    // calculate_sha1 has left the device of the file in current_drive
+    if (!checkfile_index_add (file_name_buf, reference))
+	printf("\ntGRUB: Checkfile index full, %s is not checked on loading\n",
+	       file_name_buf);
+
+    // An entry the log cannot replay must not be extended, and one the
+    // TPM has not extended into PCR 13 loses the log
+    if (!tcg_log_event (PCR_CHECKFILE, TCG_EV_IPL, hash_result, file_name_buf,
+			strlen (file_name_buf))
+	|| !tcg_log_extend (PCR_CHECKFILE, hash_result))
     {
-	if (!tpm_present())
+	printf("\ntGRUB error: %s cannot be measured: %s\n", file_name_buf,
+	       err_list[errnum]);
+	return -1;
+    }
+    return 0;
+}
+
+int
+load_checkfile (char *checkfile)
+{
+
+    int MY_BUFFER_SIZE = 2 * TCG_BUFFER_SIZE;
+    int result;
+    int general_error;
+    int offset;
+    int length;
+    int curr_length;
+    int line_start;
+    char check_file_data[MY_BUFFER_SIZE];
+#ifdef SHOW_SHA1  
+    printf("\ntGRUB: Opening checkfile %s\n",checkfile);
+#endif
+    /* Disabling loadage SHA1-measurement. This is because we call our internal
+    SHA1-function and do not need to measure via grub_read */
+    if (perform_sha1)
+    {
+	old_perform_sha1_value = perform_sha1;
+	perform_sha1 = 0;
+    }
+
+  general_error = 0;
+  offset = 0;
+
+  /* Every round reads the next chunk of the checkfile and checks all
+     entries that are completely contained in it */
+  while (1)
+    {
+      /* Try to open checkfile. If it fails, GRUB has to be stopped */
+      result = grub_open (checkfile);
+      if (!result)
 	{
-	    // Update the PCR register 13 with the calculated SHA1-value
-	    if (update_pcr(PCR_CHECKFILE,hash_result))
-		    printf("\ntGRUB: Error during PCR extension\n");
+	  printf("\ntGRUB error: Could not open checkfile (error code %d)\n",result);
+	  return -1;
 	}
+
+      if (offset >= filemax)
+	{
+	  grub_close ();
+	  break;
+	}
+
+      grub_seek (offset);
+      length = grub_read (check_file_data, MY_BUFFER_SIZE);
+      /* The last entry does not need a new line character */
+      if (length > 0 && length < MY_BUFFER_SIZE
+	  && check_file_data[length - 1] != '\n')
+	check_file_data[length++] = '\n';
+      grub_close ();
+
+      if (length <= 0)
+	{
+	  printf("\ntGRUB error: Could not read checkfile\n");
+	  return -1;
+	}
+
+      line_start = 0;
+      for (curr_length = 0; curr_length < length; curr_length++)
+	{
+	  /* Every entry in the checkfile has to be terminated by a new line character */
+	  if (check_file_data[curr_length] != '\n')
+	    continue;
+
+	  check_file_data[curr_length] = '\0';
+	  if (curr_length > line_start
+	      && check_file_data[curr_length - 1] == '\r')
+	    check_file_data[curr_length - 1] = '\0';
+
+	  /* Empty lines are skipped */
+	  if (check_file_data[line_start])
+	    {
+	      result = check_file_entry (&check_file_data[line_start]);
+	      if (result < 0)
+		return 1;
+	      general_error += result;
+	    }
+
+	  line_start = curr_length + 1;
+	}
+
+      /* An entry has to fit into a single chunk. The length of the file name is
+	 thus limited to a bit less than 8 kB, which is plenty in practice */
+      if (!line_start)
+	{
+	  printf("\ntGRUB error: File name too long\n");
+	  return -1;
+	}
+
+      offset += line_start;
     }
-    } // end while (curr_length < max_length)
   
   /* If not all computed hash values have been equal to the referenced ones, the user has to decide whether he wants to continue booting or not. The integrity of the checkfile itself can not be measured here, it has to be verfied later, together with all other data which have been measured by tGRUB */
     if (general_error)
@@ -296,6 +343,91 @@ load_checkfile (char *checkfile)
 	perform_sha1 = old_perform_sha1_value;
     return 0;
 }
+
+/* Copy the event log to where the kernel about to be booted finds it.
+   Multiboot kernels get it as an additional module named
+   "tgrub-eventlog". Linux kernels with boot protocol 2.09 or later get it
+   as setup data of the type LINUX_SETUP_TCG_EVENT_LOG, placed below the
+   initrd, which Linux keeps and shows in /sys/kernel/boot_params. Other
+   kernels get no log, which is said on the screen. If an event has not
+   been logged, or there is no room for the log, ERRNUM is set, since the
+   kernel must not be booted with PCRs that the log cannot replay. */
+void
+tcg_event_log_handoff (void)
+{
+    int len;
+    char *log = tcg_event_log (&len);
+
+    if (!log)
+    {
+	errnum = ERR_EVENT_LOG;
+	return;
+    }
+    if (!len)
+	return;
+
+    if (kernel_type == KERNEL_TYPE_MULTIBOOT)
+    {
+	/* The log goes behind the last module, like the VBE information */
+	cur_addr = (cur_addr + 0xFFF) & 0xFFFFF000;
+	if (mbi.mods_count >= sizeof (mll) / sizeof (*mll)
+	    || ! memcheck (cur_addr, len))
+	    goto fail;
+	grub_memmove ((char *) cur_addr, log, len);
+
+	mbi.flags |= MB_INFO_MODS;
+	mbi.mods_addr = (int) mll;
+	mll[mbi.mods_count].cmdline = (int) "tgrub-eventlog";
+	mll[mbi.mods_count].mod_start = cur_addr;
+	cur_addr += len;
+	mll[mbi.mods_count].mod_end = cur_addr;
+	mll[mbi.mods_count].pad = 0;
+	mbi.mods_count++;
+    }
+    else if (kernel_type == KERNEL_TYPE_LINUX
+	     || kernel_type == KERNEL_TYPE_BIG_LINUX)
+    {
+	struct linux_kernel_header *lh
+	    = (struct linux_kernel_header *) linux_data_tmp_addr;
+	struct linux_setup_data *sd;
+	unsigned long addr;
+
+	if (lh->header != LINUX_MAGIC_SIGNATURE || lh->version < 0x0209)
+	    goto no_log;
+
+	/* Below the initrd, or where the initrd would be put */
+	if (lh->ramdisk_image)
+	    addr = lh->ramdisk_image;
+	else
+	{
+	    addr = linux_mem_size ? linux_mem_size
+		: (mbi.mem_upper + 0x400) << 10;
+	    if (addr > lh->initrd_addr_max)
+		addr = lh->initrd_addr_max;
+	    addr -= 0x10000;
+	}
+	addr = (addr - sizeof (struct linux_setup_data) - len) & 0xfffff000;
+	if (! memcheck (RAW_ADDR (addr), sizeof (struct linux_setup_data) + len))
+	    goto fail;
+
+	sd = (struct linux_setup_data *) RAW_ADDR (addr);
+	sd->next = lh->setup_data;
+	sd->type = LINUX_SETUP_TCG_EVENT_LOG;
+	sd->len = len;
+	grub_memmove (sd->data, log, len);
+	lh->setup_data = addr;
+    }
+    else if (kernel_type != KERNEL_TYPE_NONE)
+	goto no_log;
+    return;
+
+ no_log:
+    printf("\ntGRUB: This kernel gets no event log\n");
+    return;
+
+ fail:
+    errnum = ERR_EVENT_LOG_ROOM;
+}
 /* End TCG extension */
 
 /*
@@ -324,9 +456,6 @@ load_image (char *kernel, char *arg, kernel_t suggested_type,
   /* presuming that MULTIBOOT_SEARCH is large enough to encompass an
      executable header */
   unsigned char buffer[MULTIBOOT_SEARCH];
-/* BEGIN TCG EXTENSION */
-    measure_kernel=1;
-/* END TCG EXTENSION */
 
   /* sets the header pointer to point to the beginning of the
      buffer by default */
@@ -670,6 +799,10 @@ load_image (char *kernel, char *arg, kernel_t suggested_type,
 	      linux_mem_size = 0;
 	  }
       
+	  /* The setup area may hold files kept by the measurement cache */
+	  memory_forget ((unsigned long) linux_data_tmp_addr,
+			 LINUX_SETUP_MOVE_SIZE);
+
 	  /* It is possible that DATA_LEN + SECTOR_SIZE is greater than
 	     MULTIBOOT_SEARCH, so the data may have been read partially.  */
 	  if (data_len + SECTOR_SIZE <= MULTIBOOT_SEARCH)
@@ -832,6 +965,7 @@ load_image (char *kernel, char *arg, kernel_t suggested_type,
 
 	  if (!errnum)
 	    {
+	      memory_forget (RAW_ADDR (cur_addr), bss_len);
 	      memset ((char *) RAW_ADDR (cur_addr), 0, bss_len);
 	      cur_addr += bss_len;
 
@@ -959,7 +1093,10 @@ load_image (char *kernel, char *arg, kernel_t suggested_type,
 		  && grub_read ((char *) memaddr, filesiz) == filesiz)
 		{
 		  if (memsiz > filesiz)
-		    memset ((char *) (memaddr + filesiz), 0, memsiz - filesiz);
+		    {
+		      memory_forget (memaddr + filesiz, memsiz - filesiz);
+		      memset ((char *) (memaddr + filesiz), 0, memsiz - filesiz);
+		    }
 		}
 	      else
 		break;
@@ -1311,12 +1448,18 @@ load_initrd (char *initrd)
 	      ? lh->initrd_addr_max : LINUX_INITRD_MAX_ADDRESS);
   if (moveto + len >= max_addr)
     moveto = (max_addr - len) & 0xfffff000;
+  /* BEGIN TCG EXTENSION */
+  // Keep the event log, which the kernel gets when it is booted
+  if (moveto + len > tcg_event_log_addr ())
+    moveto = (tcg_event_log_addr () - len) & 0xfffff000;
+  /* END TCG EXTENSION */
   
   /* XXX: Linux 2.3.xx has a bug in the memory range check, so avoid
      the last page.
      XXX: Linux 2.2.xx has a bug in the memory range check, which is
      worse than that of Linux 2.3.xx, so avoid the last 64kb. *sigh*  */
   moveto -= 0x10000;
+  memory_forget (RAW_ADDR (moveto), len);
   memmove ((void *) RAW_ADDR (moveto), (void *) cur_addr, len);
 
 #ifdef DEBUG
@@ -1353,6 +1496,7 @@ static void
 bsd_boot_entry (int flags, int bootdev, int sym_start, int sym_end,
 		int mem_upper, int mem_lower)
 {
+  boot_reached = 1;
   stop ();
 }
 
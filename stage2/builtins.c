@@ -237,6 +237,21 @@ static struct builtin builtin_blocklist =
 static int
 boot_func (char *arg, int flags)
 {
+/* BEGIN TCG EXTENSION */
+  /* Extend PCR 12 with the commands collected in batch mode, then pass
+     the complete event log on to the kernel.  */
+  if (! tcg_cmdline_flush ())
+    return 1;
+  tcg_event_log_handoff ();
+  if (errnum)
+    return 1;
+/* END TCG EXTENSION */
+
+#ifndef GRUB_UTIL
+  /* The OS expects the application processors in wait-for-SIPI.  */
+  imps_hash_stop ();
+#endif
+
   /* Clear the int15 handler if we can boot the kernel successfully.
      This assumes that the boot code never fails only if KERNEL_TYPE is
      not KERNEL_TYPE_NONE. Is this assumption is bad?  */
@@ -855,6 +870,7 @@ device_func (char *arg, int flags)
     }
 
   assign_device_name (current_drive, device);
+  sector_cache_invalidate (current_drive);
   
   return 0;
 }
@@ -890,6 +906,48 @@ static struct builtin builtin_dhcp =
 };
 #endif /* SUPPORT_NETBOOT */
 
+
+/* diskcache */
+static int
+diskcache_func (char *arg, int flags)
+{
+  int kb;
+
+  if (! *arg)
+    {
+      grub_printf (" Sector cache: %dKB, %d hits, %d misses\n",
+		   sector_cache_size (),
+		   (int) sector_cache_hits, (int) sector_cache_misses);
+      return 0;
+    }
+
+  if (! safe_parse_maxint (&arg, &kb))
+    return 1;
+
+  if (kb < 0)
+    {
+      errnum = ERR_BAD_ARGUMENT;
+      return 1;
+    }
+
+  sector_cache_resize (kb);
+  return 0;
+}
+
+static struct builtin builtin_diskcache =
+{
+  "diskcache",
+  diskcache_func,
+  BUILTIN_CMDLINE | BUILTIN_MENU | BUILTIN_HELP_LIST,
+  "diskcache [KBYTES]",
+  "Set the size of the disk sector cache to KBYTES kilobytes, at most an"
+  " eighth of the upper memory, and empty it. 0 turns the cache off."
+  " Without an argument, show the size in use and the hits and misses"
+  " so far. The cache is turned off when a loader writes over it, and"
+  " so are reads of many sectors at once when a loader writes over"
+  " their buffer."
+};
+
 
 /* displayapm */
 static int
@@ -1745,6 +1803,47 @@ static struct builtin builtin_impsprobe =
   " a tight loop."
 };
 
+
+/* smphash [on|off] */
+static int
+smphash_func (char *arg, int flags)
+{
+#ifdef GRUB_UTIL
+  /* In the grub shell, we cannot start other CPUs.  */
+  errnum = ERR_UNRECOGNIZED;
+  return 1;
+#else /* ! GRUB_UTIL */
+  if (grub_memcmp (arg, "on", 2) == 0)
+    {
+      if (! imps_hash_start ())
+	grub_printf (" No application processor could be started\n");
+    }
+  else if (grub_memcmp (arg, "off", 3) == 0)
+    imps_hash_stop ();
+  else if (*arg)
+    {
+      errnum = ERR_BAD_ARGUMENT;
+      return 1;
+    }
+
+  grub_printf (" Hashing on an application processor is %s\n",
+	       imps_hash_active () ? "on" : "off");
+  return 0;
+#endif /* ! GRUB_UTIL */
+}
+
+static struct builtin builtin_smphash =
+{
+  "smphash",
+  smphash_func,
+  BUILTIN_CMDLINE | BUILTIN_MENU | BUILTIN_HELP_LIST,
+  "smphash [on|off]",
+  "Start an application processor of an MPS system as a worker which"
+  " computes the SHA1 measurements while the files are still being read,"
+  " or stop it. Without an argument, show whether it runs. The worker is"
+  " always stopped before an OS is booted."
+};
+
 
 /* initrd */
 static int
@@ -2218,6 +2317,8 @@ install_func (char *arg, int flags)
 		}
 
 	      fclose (fp);
+	      /* The sector cache does not see writes through the OS.  */
+	      sector_cache_invalidate (-1);
 	    }
 	  else
 #endif /* GRUB_UTIL */
@@ -2259,6 +2360,8 @@ install_func (char *arg, int flags)
 	}
 
       fclose (fp);
+      /* The sector cache does not see writes through the OS.  */
+      sector_cache_invalidate (-1);
     }
   else
 #endif /* GRUB_UTIL */
@@ -2417,6 +2520,41 @@ static struct builtin builtin_sha1 =
   "Calcualtes SHA1 of the given file."
 };
 
+/* pcrbatch */
+
+static int
+pcrbatch_func (char *arg, int flags)
+{
+  if (grub_memcmp (arg, "--off", 5) == 0)
+    {
+      /* Keep the order of PCR 12 extensions in the event log.  */
+      cmdline_batch = 0;
+      if (! tcg_cmdline_flush ())
+	return 1;
+    }
+  else if (! *arg)
+    cmdline_batch = 1;
+  else
+    {
+      errnum = ERR_BAD_ARGUMENT;
+      return 1;
+    }
+
+  return 0;
+}
+
+static struct builtin builtin_pcrbatch =
+{
+  "pcrbatch",
+  pcrbatch_func,
+  BUILTIN_CMDLINE | BUILTIN_HELP_LIST,
+  "pcrbatch [--off]",
+  "Log the following commands in the event log and extend PCR 12 only"
+  " once, with the SHA1 over their SHA1 values, right before booting."
+  " This saves a TPM call per command. If --off is given, extend PCR 12"
+  " for each command again."
+};
+
 /* Integrates the checkfile mechanism into GRUB's command structure. */
 
 static struct builtin builtin_checkfile =
@@ -3305,6 +3443,9 @@ real_root_func (char *arg, int attempt_mount)
   saved_partition = current_partition;
   saved_drive = current_drive;
 
+  /* The paths resolved on the old root are of no use any more.  */
+  dentry_cache_invalidate ();
+
   if (attempt_mount)
     {
       /* BSD and chainloading evil hacks !!  */
@@ -5343,13 +5484,31 @@ static struct builtin builtin_vbeset =
  
 
 
-#define VARIABLE_STORE_SIZE 1024
+/* The variables. Names and values live in blocks of VARIABLE_STORE, each
+ * with a header pointing back to the pointer that refers to it, so that
+ * the store can be compacted when it runs full. The variables are found
+ * through a hash table chaining the used slots of VARIABLE_LIST. */
+#define VARIABLE_STORE_SIZE 0x4000
+#define VARIABLE_HASH_SIZE 64
+/* How deep the values of variables are expanded in one pass */
+#define VARIABLE_DEPTH 8
+
+struct var_block {
+  char **owner;		/* NULL if the block is free */
+  int size;		/* including this header */
+};
+
 char variable_store[VARIABLE_STORE_SIZE];
 unsigned int variable_store_actpos; /* Points to the next free entry */
 struct variable_list_struct {
   char *name;
   char *value;
+  short next;		/* The next slot in the hash chain plus 1, or 0 */
 } variable_list[VARIABLES_MAX];
+/* The first slot of each hash chain plus 1, or 0 */
+static short variable_hash[VARIABLE_HASH_SIZE];
+
+static int toggle_uses_var(int var);
 
 static void var_show(void)
 {
@@ -5364,21 +5523,38 @@ static void var_show(void)
       }
 }
 
-static int var_get_index(char *var)
+static unsigned int var_hash(char *name, int len)
 {
-  int i = 0;
+  unsigned int h = 0;
+
+  while (len--)
+    h = h * 31 + *name++;
+
+  return h & (VARIABLE_HASH_SIZE - 1);
+}
+
+/* Returns the slot of the variable named by the LEN characters at NAME */
+static int var_lookup(char *name, int len)
+{
+  int i;
 
-  if (!*var)
+  if (!len)
     return -1;
 
-  for (; i < VARIABLES_MAX; i++)
-    if (variable_list[i].name &&
-	grub_strcmp(variable_list[i].name, var) == 0)
+  for (i = variable_hash[var_hash(name, len)] - 1; i >= 0;
+       i = variable_list[i].next - 1)
+    if (grub_memcmp(variable_list[i].name, name, len) == 0
+	&& variable_list[i].name[len] == 0)
       return i;
 
   return -1;
 }
 
+static int var_get_index(char *var)
+{
+  return var_lookup(var, grub_strlen(var));
+}
+
 char *var_get(char *var)
 {
   int i;
@@ -5389,17 +5565,73 @@ char *var_get(char *var)
   return variable_list[i].value;
 }
 
-static char *var_alloc_mem(unsigned int len)
+/* Moves the used blocks to the start of the store, updating the
+ * pointers to them */
+static void var_compact(void)
+{
+  unsigned int from = 0, to = 0;
+
+  while (from < variable_store_actpos)
+    {
+      struct var_block *b = (struct var_block *) (variable_store + from);
+      int size = b->size;
+
+      if (b->owner)
+	{
+	  if (to != from)
+	    {
+	      grub_memmove(variable_store + to, b, size);
+	      b = (struct var_block *) (variable_store + to);
+	      *b->owner = (char *) (b + 1);
+	    }
+	  to += size;
+	}
+      from += size;
+    }
+
+  variable_store_actpos = to;
+}
+
+/* Allocates LEN bytes, to be referred to by *OWNER, which is set */
+static char *var_alloc_mem(unsigned int len, char **owner)
 {
-  if (VARIABLE_STORE_SIZE < variable_store_actpos + len
-      || !len)
+  struct var_block *b;
+  unsigned int size = (sizeof(struct var_block) + len + 3) & ~3;
+
+  if (!len)
+    return NULL;
+
+  if (VARIABLE_STORE_SIZE < variable_store_actpos + size)
+    var_compact();
+  if (VARIABLE_STORE_SIZE < variable_store_actpos + size)
     return NULL;
 
-  variable_store_actpos += len;
-  return &variable_store[variable_store_actpos - len];
+  b = (struct var_block *) (variable_store + variable_store_actpos);
+  b->owner = owner;
+  b->size = size;
+  variable_store_actpos += size;
+
+  return *owner = (char *) (b + 1);
+}
+
+static void var_free_mem(char *mem)
+{
+  struct var_block *b = (struct var_block *) mem - 1;
+
+  b->owner = NULL;
+  /* The last block is simply given back */
+  if ((char *) b + b->size == variable_store + variable_store_actpos)
+    variable_store_actpos -= b->size;
+}
+
+/* Returns whether STR fits into the block at MEM */
+static int var_fits_mem(char *mem, char *str)
+{
+  struct var_block *b = (struct var_block *) mem - 1;
+
+  return grub_strlen(str) + 1 <= b->size - sizeof(struct var_block);
 }
 
-/* Maybe we're implementing "unset" later? */
 static int var_get_free_var(void)
 {
   int i = 0;
@@ -5411,6 +5643,20 @@ static int var_get_free_var(void)
   return -1;
 }
 
+static void var_unset_index(int i)
+{
+  short *link = &variable_hash[var_hash(variable_list[i].name,
+					grub_strlen(variable_list[i].name))];
+
+  while (*link != i + 1)
+    link = &variable_list[*link - 1].next;
+  *link = variable_list[i].next;
+
+  var_free_mem(variable_list[i].value);
+  var_free_mem(variable_list[i].name);
+  variable_list[i].name = variable_list[i].value = NULL;
+}
+
 static inline char *skip_ws(char *s)
 {
   while (isspace(*s))
@@ -5418,46 +5664,54 @@ static inline char *skip_ws(char *s)
   return s;
 }
 
-static int var_sprint_once(char *buf, char *str)
+/* Copies STR into B, which must not go beyond END, with the variables
+ * replaced by their values, which are expanded as well, DEPTH levels
+ * deep. Returns the end of the copy, or NULL if it didn't fit, in which
+ * case B holds as much as did. */
+static char *var_expand(char *b, char *end, char *str, int depth)
 {
-  char *b = buf;
-
   while (*str)
     {
+      if (b == end)
+	{
+	  *b = 0;
+	  return NULL;
+	}
+
       if (*str == '$' && *(str + 1) == '(')
 	{
 	  /* Found start of variable */
 	  char *end_var;
 	  char *c = str + 2;
+	  int i;
 
 	  end_var = c;
 	  while (*end_var && *end_var != ')')
 	    end_var++;
 
-	  if (*end_var == ')')
+	  if (*end_var == ')' && (i = var_lookup(c, end_var - c)) != -1)
 	    {
-	      char *val;
-
-	      /* Copy variable name into var */
-
-              str = end_var + 1;
+	      char *val = variable_list[i].value;
 
-	      *end_var = 0;
-	      if ((val = var_get(c)))
+	      str = end_var + 1;
+	      if (depth)
 		{
-		  /* All ok, we got it */
-		  /* Copy to buf */
-		  while (*val)
-		    *b++ = *val++;
-
-		  *end_var = ')';
-
-		  continue;
+		  b = var_expand(b, end, val, depth - 1);
+		  if (!b)
+		    return NULL;
 		}
-	      /* else
-		grub_printf("Unknown variable: %var!\n", var); */
+	      else
+		while (*val)
+		  {
+		    if (b == end)
+		      {
+			*b = 0;
+			return NULL;
+		      }
+		    *b++ = *val++;
+		  }
 
-	      *end_var = ')';
+	      continue;
 	    }
 	}
 
@@ -5466,30 +5720,44 @@ static int var_sprint_once(char *buf, char *str)
 
   *b = 0;
 
-  return b - buf;
+  return b;
 }
 
-int var_sprint(char *buf, char *str)
+/* Expands the variables of STR into BUF, which holds SIZE bytes. Returns
+ * the length of the result, or -1 with ERRNUM set if it is too long, in
+ * which case BUF holds as much of it as fits. */
+int var_sprint(char *buf, int size, char *str)
 {
   int i = 10;
   /* Waste some stack here... */
-  const int buffer_size = 1000;
+  const int buffer_size = MAX_CMDLINE;
   char buffer[buffer_size];
+  int len = grub_strlen(str);
+
+  if (size > buffer_size)
+    size = buffer_size;
 
+  if (len >= size)
+    {
+      grub_memmove(buf, str, size - 1);
+      buf[size - 1] = 0;
+      errnum = ERR_VAR_OVERFLOW;
+      return -1;
+    }
   grub_strcpy(buf, str);
 
-  /* We're not checking any return values here or any array overflows... :( */
+  /* Values are expanded as they are copied, so a second pass normally
+   * only confirms the result; more are needed for names which are made
+   * up of variables. */
   do
     {
-      if (grub_strlen(buf) > buffer_size)
-	{
-	  grub_printf("Buffer overflow: %s(%d)\n", __FILE__, __LINE__);
-	  while (1) {}
-	}
-      
       grub_strcpy(buffer, buf);
 
-      var_sprint_once(buf, buffer);
+      if (!var_expand(buf, buf + size - 1, buffer, VARIABLE_DEPTH))
+	{
+	  errnum = ERR_VAR_OVERFLOW;
+	  return -1;
+	}
     }
   while (--i && grub_strcmp(buf, buffer));
 
@@ -5504,17 +5772,26 @@ int var_sprint(char *buf, char *str)
 
 /* Use our own buffer instead of a supplied one and
  * return the pointer to the buffer and not the bytes
- * processed. */
+ * processed. The result is for display, so a result
+ * that is too long is shown cut short and is no error. */
 /* We try to detect buffer overruns... */
 static char var_sprint_buffer[1500];
 static const long var_sprint_magic = 0x14233241;
+#define VAR_SPRINT_SIZE (sizeof(var_sprint_buffer) - sizeof(var_sprint_magic))
 char *var_sprint_buf(char *str, int *bytes)
 {
-  *(long *)(var_sprint_buffer + sizeof(var_sprint_buffer) - sizeof(var_sprint_magic)) = var_sprint_magic;
+  int old_errnum = errnum;
 
-  *bytes = var_sprint(var_sprint_buffer, str);
+  *(long *)(var_sprint_buffer + VAR_SPRINT_SIZE) = var_sprint_magic;
 
-  if (*(long *)(var_sprint_buffer + sizeof(var_sprint_buffer) - sizeof(var_sprint_magic)) != var_sprint_magic)
+  *bytes = var_sprint(var_sprint_buffer, VAR_SPRINT_SIZE, str);
+  if (*bytes < 0)
+    {
+      errnum = old_errnum;
+      *bytes = grub_strlen(var_sprint_buffer);
+    }
+
+  if (*(long *)(var_sprint_buffer + VAR_SPRINT_SIZE) != var_sprint_magic)
     {
       grub_printf("Possible buffer overrun: %s(%d)\n", __FILE__, __LINE__);
       while (1) {}
@@ -5522,62 +5799,34 @@ char *var_sprint_buf(char *str, int *bytes)
   return var_sprint_buffer;
 }
 
-/* This function just updates the pointer to the value, this value has to 
- * be inside the variable_store */
-static int var_set_no_copy(char *name, char *val)
+int var_set(char *name, char *value, int parse)
 {
   int i;
+  char *old;
 
-  if (val < variable_store || val >= (variable_store + VARIABLE_STORE_SIZE))
-    return 1;
-
-  i = var_get_index(name);
-
-  if (i == -1)
+  if (parse)
     {
-      /* The variable doesn't exist yet, so we have a new variable */
-      char *a = name;
-
-      /* Some sanity check */
-      while (*a)
-	{
-	  if (*a == '(' || *a == ')' || *a == ' ')
-	    return 1;
-	  a++;
-        }
-      
-
-      if ((i = var_get_free_var()) == -1)
+      /* A value cut short is an error, unlike on display */
+      if (var_sprint(var_sprint_buffer, VAR_SPRINT_SIZE, value) < 0)
 	return 1;
-
-      if ((a = var_alloc_mem(grub_strlen(name) + 1)) == NULL)
+      value = var_sprint_buffer;
+    }
+  else if (value >= variable_store
+	   && value < variable_store + VARIABLE_STORE_SIZE)
+    {
+      /* Compacting the store would move the value away under us */
+      if (grub_strlen(value) >= sizeof(var_sprint_buffer))
 	return 1;
-
-      grub_strcpy(a, name);
-      variable_list[i].name = a;
+      value = grub_strcpy(var_sprint_buffer, value);
     }
 
-  variable_list[i].value = val;
-
-  return 0; /* Ok */
-}
-
-/* XXX: this is a bit code duplication with var_set_no_copy, 
- *      so if someone has some free time, feel free to join this
- */
-int var_set(char *name, char *value, int parse)
-{
-  int i;
-
-  if (parse)
-    value = var_sprint_buf(value, &i);
-
   i = var_get_index(name);
 
   if (i == -1)
     {
       /* The variable doesn't exist yet, so we have a new variable */
       char *a = name;
+      unsigned int h;
 
       /* Some sanity check */
       while (*a)
@@ -5590,44 +5839,41 @@ int var_set(char *name, char *value, int parse)
       if ((i = var_get_free_var()) == -1)
 	return 1;
 
-      if ((a = var_alloc_mem(grub_strlen(name) + 1)) == NULL)
+      if (var_alloc_mem(grub_strlen(name) + 1, &variable_list[i].name) == NULL)
 	return 1;
+      grub_strcpy(variable_list[i].name, name);
 
-      grub_strcpy(a, name);
-      variable_list[i].name = a;
-
-      if ((a = var_alloc_mem(grub_strlen(value) + 1)) == NULL)
-	return 1;
+      if (var_alloc_mem(grub_strlen(value) + 1, &variable_list[i].value) == NULL)
+	{
+	  var_free_mem(variable_list[i].name);
+	  variable_list[i].name = NULL;
+	  return 1;
+	}
+      grub_strcpy(variable_list[i].value, value);
 
-      grub_strcpy(a, value);
-      variable_list[i].value = a;
+      h = var_hash(name, grub_strlen(name));
+      variable_list[i].next = variable_hash[h];
+      variable_hash[h] = i + 1;
     } 
+  else if (var_fits_mem(variable_list[i].value, value))
+    /* The new value fits into the space of the old one */
+    grub_strcpy(variable_list[i].value, value);
   else
     {
-      /* Variable already exists */
-      if (grub_strlen(variable_list[i].value) >= grub_strlen(value))
+      /* The old value is given back once the new one is in place; until
+       * then OLD follows it if the store is compacted */
+      old = variable_list[i].value;
+      ((struct var_block *) old - 1)->owner = &old;
+      if (var_alloc_mem(grub_strlen(value) + 1, &variable_list[i].value) == NULL)
 	{
-	  /* We can just replace the value but we're potentially 
-	   * loosing space */
-	  grub_strcpy(variable_list[i].value, value);
-	}
-      else
-	{
-	  /* New value is longer then the old one, we need to
-	   * allocate a new place and drop the old one (i.e. wasting it) */
-	  char *a;
-	  if ((a = var_alloc_mem(grub_strlen(value) + 1)) == NULL)
-	    return 1;
-
-	  grub_strcpy(a, value);
-
-	  variable_list[i].value = a;
+	  variable_list[i].value = old;
+	  ((struct var_block *) old - 1)->owner = &variable_list[i].value;
+	  return 1;
 	}
+      grub_strcpy(variable_list[i].value, value);
+      var_free_mem(old);
     }
 
-  //grub_printf("Saved %s=\"%s\" in slot %d.\n", variable_list[i].name, variable_list[i].value, i + 1);
-  //getkey();
-
   return 0; /* Ok */
 }
 
@@ -5717,6 +5963,41 @@ static struct builtin builtin_set =
   "Set a variable to a value."
 };
 
+static int
+unset_func(char *arg, int flags)
+{
+  char *end;
+  int i;
+
+  arg = skip_ws(arg);
+  end = arg;
+  while (*end && !isspace(*end))
+    end++;
+
+  if ((i = var_lookup(arg, end - arg)) == -1)
+    return 0;
+
+  /* The toggles refer to their variables by slot */
+  if (toggle_uses_var(i))
+    {
+      errnum = ERR_BAD_ARGUMENT;
+      return 1;
+    }
+
+  var_unset_index(i);
+  return 0;
+}
+
+static struct builtin builtin_unset =
+{
+  "unset",
+  unset_func,
+  BUILTIN_CMDLINE | BUILTIN_MENU | BUILTIN_HELP_LIST,
+  "unset var",
+  "Remove a variable and free its space. Variables used by \"toggle\""
+  " cannot be removed."
+};
+
 static int
 print_func(char *arg, int flags)
 {
@@ -5766,6 +6047,19 @@ int toggles_used = 0;
 
 char toggle_trigger_init_done;
 
+static int toggle_uses_var(int var)
+{
+  int t, b, v;
+
+  for (t = 0; t < toggles_used; t++)
+    for (b = 0; b < toggle_data[t].nr_blocks; b++)
+      for (v = 0; v < toggle_data[t].block[b].nr_vars; v++)
+	if (toggle_data[t].block[b].var[v].var == var)
+	  return 1;
+
+  return 0;
+}
+
 static int get_toggle_slot_for_key(int key)
 {
   int i = 0;
@@ -5846,7 +6140,8 @@ static int toggle_do_block(int slot, int block_nr)
     {
       int l = toggle_data[slot].block[block_nr].var[v].var;
 
-      var_set_no_copy(variable_list[l].name, toggle_data[slot].block[block_nr].var[v].value);
+      if (variable_list[l].name)
+	var_set(variable_list[l].name, toggle_data[slot].block[block_nr].var[v].value, 0);
     }
 
   return 1; /* Ok */
@@ -5928,16 +6223,22 @@ toggle_func(char *arg, int flags)
       }
     else
       {
-	/* Allocate space for the value and hang it in */
-	if ((v = var_alloc_mem(grub_strlen(p) + 1)) == NULL)
+	/* Allocate space for the value, in place of an older one */
+	if (toggle_data[slot].block[bl].var[var].value)
+	  {
+	    var_free_mem(toggle_data[slot].block[bl].var[var].value);
+	    toggle_data[slot].block[bl].var[var].value = NULL;
+	  }
+	if ((v = var_alloc_mem(grub_strlen(p) + 1,
+			       &toggle_data[slot].block[bl].var[var].value)) == NULL)
 	  return 1;
 	grub_strcpy(v, p);
 
-	var_set_no_copy(start, v);
+	if (var_set(start, v, 0))
+	  return 1;
 
 	if ((toggle_data[slot].block[bl].var[var].var = var_get_index(start)) == -1)
 	  return 1; /* internal error */
-	toggle_data[slot].block[bl].var[var].value = v;
       }
 
     *origvarp = origvar;
@@ -6290,6 +6591,7 @@ struct builtin *builtin_table[] =
 #ifdef SUPPORT_NETBOOT
   &builtin_dhcp,
 #endif /* SUPPORT_NETBOOT */
+  &builtin_diskcache,
   &builtin_displayapm,
   &builtin_displaymem,
 #ifdef GRUB_UTIL
@@ -6327,6 +6629,7 @@ struct builtin *builtin_table[] =
   &builtin_parttype,
   &builtin_password,
   &builtin_pause,
+  &builtin_pcrbatch,     /* newly added for TCG functionality */
   &builtin_print,
 #ifdef GRUB_UTIL
   &builtin_quit,
@@ -6346,6 +6649,7 @@ struct builtin *builtin_table[] =
   &builtin_setkey,
   &builtin_setup,
   &builtin_sha1,    	 /* newly added for TCG functionality */
+  &builtin_smphash,
 #if defined(SUPPORT_SERIAL) || defined(SUPPORT_HERCULES)
   &builtin_terminal,
 #endif /* SUPPORT_SERIAL || SUPPORT_HERCULES */
@@ -6361,6 +6665,7 @@ struct builtin *builtin_table[] =
   &builtin_title,
   &builtin_toggle,
   &builtin_unhide,
+  &builtin_unset,
   &builtin_uppermem,
   &builtin_varexpand,
   &builtin_vbeprobe,
@@ -1271,9 +1271,18 @@ void *
 grub_memset (void *start, int c, int len)
 {
   char *p = start;
+  unsigned int word = (c & 0xff) * 0x01010101;
 
   if (memcheck ((int) start, len))
     {
+      /* Up to a word boundary byte by byte, then a word at a time.  */
+      while (len > 0 && ((unsigned long) p & 3))
+	{
+	  *p ++ = c;
+	  len --;
+	}
+      for (; len >= 4; p += 4, len -= 4)
+	*(unsigned int *) p = word;
       while (len -- > 0)
 	*p ++ = c;
     }
@@ -28,8 +28,8 @@
 grub_jmp_buf restart_cmdline_env;
 
 /* BEGIN TCG EXTENSION */
-// Here all commands from menu.lst and the console are measured and
-// extended into PCR 12
+// Here all commands from menu.lst and the console are measured,
+// logged and extended into PCR 12
 void extend_cmdline_into_pcr(unsigned char* grub_cmdline)
 {
     int i;
@@ -63,9 +63,9 @@ void extend_cmdline_into_pcr(unsigned char* grub_cmdline)
         ((hash_result[i]>>8)&0x0f),((hash_result[i]>>4)&0x0f),(hash_result[i]&0x0f));
     printf("]\n");
 #endif
-    // If we have a TPM, update PCR 14 with the result
-    if (!(tpm_present()))
-        update_pcr(PCR_CMDLINE,hash_result);
+    // Log the command and extend PCR 12, now or in batch mode before booting.
+    // If it cannot be logged, ERRNUM is set and the command must not run
+    tcg_cmdline_event(hash_result, (char *) grub_cmdline);
 }			    
 /* END TCG EXTENSION */
 
@@ -212,6 +212,8 @@ enter_cmdline (char *heap, int forever)
 /* BEGIN TCG EXTENSION */
 
 extend_cmdline_into_pcr(heap);
+      if (errnum)
+	continue;
 
 /* END TCG EXTENSION */
 
@@ -241,7 +243,7 @@ run_script (char *script, char *heap)
       struct builtin *builtin;
       char *arg;
       int len;
-      char dump[700];
+      char dump[MAX_CMDLINE];
 
       print_error ();
 
@@ -278,11 +280,17 @@ run_script (char *script, char *heap)
 	  grub_memmove (heap, "boot", 5);
 	}
 
-      len = var_sprint(dump, heap);
+      /* A command cut short would run, and be measured, with the wrong
+	 arguments.  */
+      len = var_sprint(dump, sizeof (dump), heap);
+      if (len < 0)
+	continue;
 
 /* BEGIN TCG EXTENSION */
 
     extend_cmdline_into_pcr(heap);
+    if (errnum)
+      continue;
 
 /* END TCG EXTENSION */
 
@@ -91,6 +91,10 @@ char *err_list[] =
   [ERR_WONT_FIT] = "Selected item cannot fit into memory",
   [ERR_WRITE] = "Disk write error",
   [ERR_BADMODADDR] = "Bad modaddr",
+  [ERR_VAR_OVERFLOW] = "Line too long after expanding the variables",
+  [ERR_EVENT_LOG] = "Event log full or overwritten, cannot measure",
+  [ERR_TPM_EXTEND] = "The TPM did not extend the PCR, cannot measure",
+  [ERR_EVENT_LOG_ROOM] = "No room to pass the event log to the kernel",
 };
 
 
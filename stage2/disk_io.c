@@ -52,11 +52,14 @@ int sha1_byte_count = 0;
 int sha1_has_to_measure = 0;
 int laststatus = 0;
 int xy=1;
-// This stuff is needed for the kernel measurement
-int measure_kernel = 0;
-int kernel_filesize = 0;
-int kernel_compressed_filesize = 0;
-unsigned long kernel_real_addr;
+#ifndef STAGE1_5
+/* The measurement cache entry the open file is served from, if any */
+static struct measure_cache_entry *cached_file = 0;
+/* The reference value of the open file from the checkfile index, if any */
+static unsigned long *checked_digest = 0;
+/* The name of the open file for the event log */
+static char measured_name[128];
+#endif
 /* END TCG EXTENSION */
 
 int fsmax;
@@ -154,11 +157,498 @@ log2 (unsigned long word)
   return word;
 }
 
+#ifndef STAGE1_5
+/* The sector cache. The track buffer holds only the last track read, so
+   every switch between filesystem metadata and file data goes back to
+   the BIOS. The cache keeps lines of SECTOR_CACHE_LINE bytes, aligned
+   to their size on the disk, in upper memory just below the area left
+   to inflate; the measurement cache is placed below it. Lines are
+   grouped into sets of SECTOR_CACHE_WAYS, tagged with their drive and
+   replaced in LRU order. Lines filled by long reads enter their set as
+   the least recently used line, so that streaming a kernel through the
+   cache does not push out the metadata.  */
+#define SECTOR_CACHE_LINE	0x1000
+#define SECTOR_CACHE_LINE_BITS	12
+#define SECTOR_CACHE_WAYS	8
+/* Reads of more sectors than this are streaming reads.  */
+#define SECTOR_CACHE_STREAM	16
+
+struct sector_cache_tag
+{
+  int drive;			/* -1 if the line is unused */
+  unsigned long line;		/* The line number on the drive */
+  unsigned long stamp;		/* The time of the last use */
+};
+
+/* The size of the cache in kilobytes, as set by "diskcache".  */
+int sector_cache_kb = 4096;
+unsigned long sector_cache_hits;
+unsigned long sector_cache_misses;
+
+static struct sector_cache_tag *sector_cache_tags;
+static char *sector_cache_data;
+/* The number of sets, a power of two, or zero if the cache is off.  */
+static int sector_cache_sets;
+static unsigned long sector_cache_clock;
+/* The bottom of the cache, or zero if it has not been placed yet.  */
+static unsigned long sector_cache_bottom;
+static unsigned long sector_cache_mem_upper;
+/* Set when a loader has written over the cache.  */
+static int sector_cache_clobbered;
+/* Set when a loader has written into LARGE_BUFFERADDR.  */
+static int large_buffer_clobbered;
+
+/* Place the cache in upper memory, if that has not been done for the
+   current size of upper memory, and return its bottom.  */
+unsigned long
+sector_cache_start (void)
+{
+  unsigned long top, size;
+  int i;
+
+  if (sector_cache_bottom && sector_cache_mem_upper == mbi.mem_upper)
+    return sector_cache_bottom;
+
+  /* Move the event log out of the way first.  */
+  tcg_event_log_place ();
+  top = (RAW_ADDR ((mbi.mem_upper << 10) + 0x100000) - INFLATE_MEM_GAP
+	 - TCG_EVENT_LOG_SIZE);
+  /* Leave most of upper memory to the loaders.  */
+  size = sector_cache_kb;
+  if (size > mbi.mem_upper / 8)
+    size = mbi.mem_upper / 8;
+  size <<= 10;
+
+  sector_cache_sets = size / ((SECTOR_CACHE_LINE
+			       + sizeof (struct sector_cache_tag))
+			      * SECTOR_CACHE_WAYS);
+  while (sector_cache_sets & (sector_cache_sets - 1))
+    sector_cache_sets &= sector_cache_sets - 1;
+  if (sector_cache_clobbered || top < RAW_ADDR (0x100000) + size)
+    sector_cache_sets = 0;
+
+  sector_cache_data = (char *) top - (sector_cache_sets * SECTOR_CACHE_WAYS
+				      * SECTOR_CACHE_LINE);
+  sector_cache_tags = ((struct sector_cache_tag *) sector_cache_data
+		       - sector_cache_sets * SECTOR_CACHE_WAYS);
+  for (i = 0; i < sector_cache_sets * SECTOR_CACHE_WAYS; i++)
+    sector_cache_tags[i].drive = -1;
+
+  sector_cache_bottom = (unsigned long) sector_cache_tags;
+  sector_cache_mem_upper = mbi.mem_upper;
+
+  /* The measurement cache may now overlap.  */
+  measure_cache_reset ();
+  return sector_cache_bottom;
+}
+
+/* Return the first tag of the set for LINE on DRIVE.  */
+static struct sector_cache_tag *
+sector_cache_set (int drive, unsigned long line)
+{
+  unsigned long set = (line ^ (line >> 11) ^ (drive << 5))
+    & (sector_cache_sets - 1);
+
+  return sector_cache_tags + set * SECTOR_CACHE_WAYS;
+}
+
+/* Return the cached data of SECTOR on DRIVE, or zero.  */
+static char *
+sector_cache_lookup (int drive, unsigned long sector, int sector_size_bits)
+{
+  int line_bits = SECTOR_CACHE_LINE_BITS - sector_size_bits;
+  unsigned long line = sector >> line_bits;
+  struct sector_cache_tag *tag;
+  int i;
+
+  if (! sector_cache_start () || ! sector_cache_sets || line_bits < 0)
+    return 0;
+
+  tag = sector_cache_set (drive, line);
+  for (i = 0; i < SECTOR_CACHE_WAYS; i++, tag++)
+    if (tag->drive == drive && tag->line == line)
+      {
+	tag->stamp = ++sector_cache_clock;
+	sector_cache_hits++;
+	return (sector_cache_data
+		+ ((tag - sector_cache_tags) << SECTOR_CACHE_LINE_BITS)
+		+ ((sector & ((1 << line_bits) - 1)) << sector_size_bits));
+      }
+
+  sector_cache_misses++;
+  return 0;
+}
+
+/* Copy the line LINE of DRIVE from DATA into the cache. A STREAM line
+   becomes the least recently used line of its set.  */
+static void
+sector_cache_insert (int drive, unsigned long line, char *data, int stream)
+{
+  struct sector_cache_tag *tag, *victim;
+  int i;
+
+  if (! sector_cache_sets)
+    return;
+
+  tag = victim = sector_cache_set (drive, line);
+  for (i = 0; i < SECTOR_CACHE_WAYS; i++, tag++)
+    {
+      if (tag->drive == drive && tag->line == line)
+	{
+	  victim = tag;
+	  break;
+	}
+      if (tag->drive == -1
+	  || (victim->drive != -1 && tag->stamp < victim->stamp))
+	victim = tag;
+    }
+
+  victim->drive = drive;
+  victim->line = line;
+  victim->stamp = stream ? 0 : ++sector_cache_clock;
+  grub_memmove (sector_cache_data
+		+ ((victim - sector_cache_tags) << SECTOR_CACHE_LINE_BITS),
+		data, SECTOR_CACHE_LINE);
+}
+
+/* Drop the lines of DRIVE, or all lines if DRIVE is -1.  */
+void
+sector_cache_invalidate (int drive)
+{
+  int i;
+
+  for (i = 0; i < sector_cache_sets * SECTOR_CACHE_WAYS; i++)
+    if (drive == -1 || sector_cache_tags[i].drive == drive)
+      sector_cache_tags[i].drive = -1;
+
+  /* The paths resolved on DRIVE may have changed as well.  */
+  dentry_cache_invalidate ();
+}
+
+/* Drop the line holding SECTOR of DRIVE.  */
+static void
+sector_cache_invalidate_sector (int drive, unsigned long sector,
+				int sector_size_bits)
+{
+  int line_bits = SECTOR_CACHE_LINE_BITS - sector_size_bits;
+  struct sector_cache_tag *tag;
+  int i;
+
+  if (! sector_cache_sets || line_bits < 0)
+    return;
+
+  tag = sector_cache_set (drive, sector >> line_bits);
+  for (i = 0; i < SECTOR_CACHE_WAYS; i++, tag++)
+    if (tag->drive == drive && tag->line == sector >> line_bits)
+      tag->drive = -1;
+}
+
+/* A loader is about to write to the memory range ADDR...ADDR+LEN. If
+   that overlaps the cache or the buffer of rawread_large, such as a
+   zImage does, turn them off until "diskcache" is used.  */
+void
+sector_cache_forget (unsigned long addr, int len)
+{
+  if (len > 0 && addr < LARGE_BUFFERADDR + LARGE_BUFFERLEN
+      && addr + len > LARGE_BUFFERADDR)
+    large_buffer_clobbered = 1;
+
+  if (len <= 0 || ! sector_cache_bottom || ! sector_cache_sets
+      || addr >= RAW_ADDR ((sector_cache_mem_upper << 10) + 0x100000)
+      || addr + len <= sector_cache_bottom)
+    return;
+
+  sector_cache_clobbered = 1;
+  sector_cache_sets = 0;
+}
+
+/* A loader is about to write to the memory range ADDR...ADDR+LEN. Tell
+   everything that keeps data in memory across loads about it.  */
+void
+memory_forget (unsigned long addr, int len)
+{
+  /* BEGIN TCG EXTENSION */
+  measure_cache_forget (addr, len);
+  tcg_event_log_forget (addr, len);
+  /* END TCG EXTENSION */
+  sector_cache_forget (addr, len);
+}
+
+/* Copy the whole lines within the LEN sectors from START on DRIVE, read
+   into BUFFER, into the cache.  */
+static void
+sector_cache_fill (int drive, int start, int len, char *buffer,
+		   int sector_size_bits, int stream)
+{
+  int line_sect = SECTOR_CACHE_LINE >> sector_size_bits;
+  int s;
+
+  if (line_sect <= 0)
+    return;
+
+  for (s = (start + line_sect - 1) & ~(line_sect - 1);
+       s + line_sect <= start + len;
+       s += line_sect)
+    sector_cache_insert (drive,
+			 s >> (SECTOR_CACHE_LINE_BITS - sector_size_bits),
+			 buffer + ((s - start) << sector_size_bits),
+			 stream);
+}
+
+/* Change the size of the cache to KB kilobytes and empty it.  */
+void
+sector_cache_resize (int kb)
+{
+  sector_cache_kb = kb;
+  sector_cache_clobbered = 0;
+  large_buffer_clobbered = 0;
+  sector_cache_bottom = 0;
+  sector_cache_hits = sector_cache_misses = 0;
+  sector_cache_start ();
+}
+
+/* Return the size of the cache in use in kilobytes.  */
+int
+sector_cache_size (void)
+{
+  sector_cache_start ();
+  return sector_cache_sets * SECTOR_CACHE_WAYS * (SECTOR_CACHE_LINE >> 10);
+}
+
+/* The dentry cache. Each open walks its path from the root directory
+   again, although a boot opens the menu, the checkfile, the kernel and
+   the files these name below the same few directories. The cache keeps
+   the path prefixes that the dir functions of the filesystems have
+   resolved, each with DENTRY_CACHE_DATA bytes of what that filesystem
+   needs to go on from there, such as the inode and the inode of its
+   parent. Entries belong to a partition of a fixed disk, and are
+   replaced in LRU order. Removable disks are not cached, since their
+   media may be exchanged.  */
+#define DENTRY_CACHE_ENTRIES	64
+#define DENTRY_CACHE_PATH	64
+
+struct dentry_cache_entry
+{
+  int len;			/* The length of PATH, or 0 if unused */
+  unsigned long drive;
+  unsigned long partition;
+  int fsys;
+  unsigned long stamp;		/* The time of the last use */
+  char path[DENTRY_CACHE_PATH];
+  char data[DENTRY_CACHE_DATA];
+};
+
+static struct dentry_cache_entry dentry_cache[DENTRY_CACHE_ENTRIES];
+static unsigned long dentry_cache_clock;
+
+/* Whether the dir function may use the cache now: when it opens a file
+   on a fixed disk, rather than listing completions.  */
+static int
+dentry_cache_usable (void)
+{
+  return (! print_possibilities && fsys_type != NUM_FSYS
+	  && (current_drive & 0x80) && current_drive != cdrom_drive);
+}
+
+/* Look up the longest prefix of PATH that has been resolved on the
+   current partition, and copy SIZE bytes of its data into DATA. Return
+   the rest of PATH after the prefix, or PATH if there is none.  */
+char *
+dentry_cache_lookup (char *path, void *data, int size)
+{
+  struct dentry_cache_entry *entry, *best = 0;
+  int i;
+
+  if (! dentry_cache_usable ())
+    return path;
+
+  for (i = 0, entry = dentry_cache; i < DENTRY_CACHE_ENTRIES; i++, entry++)
+    if (entry->len && (! best || entry->len > best->len)
+	&& entry->drive == current_drive
+	&& entry->partition == current_partition
+	&& entry->fsys == fsys_type
+	&& ! grub_memcmp (entry->path, path, entry->len)
+	&& (! path[entry->len] || path[entry->len] == '/'
+	    || grub_isspace (path[entry->len])))
+      best = entry;
+
+  if (! best)
+    return path;
+
+  best->stamp = ++dentry_cache_clock;
+  grub_memmove (data, best->data, size);
+  return path + best->len;
+}
+
+/* Remember that the prefix of PATH up to END has been resolved on the
+   current partition, with the SIZE bytes of DATA.  */
+void
+dentry_cache_insert (char *path, char *end, void *data, int size)
+{
+  struct dentry_cache_entry *entry, *victim;
+  int len = end - path;
+  int i;
+
+  if (! dentry_cache_usable () || len <= 0 || len > DENTRY_CACHE_PATH
+      || size > DENTRY_CACHE_DATA)
+    return;
+
+  victim = dentry_cache;
+  for (i = 0, entry = dentry_cache; i < DENTRY_CACHE_ENTRIES; i++, entry++)
+    {
+      if (entry->len == len
+	  && entry->drive == current_drive
+	  && entry->partition == current_partition
+	  && entry->fsys == fsys_type
+	  && ! grub_memcmp (entry->path, path, len))
+	{
+	  victim = entry;
+	  break;
+	}
+      if (! entry->len || (victim->len && entry->stamp < victim->stamp))
+	victim = entry;
+    }
+
+  victim->len = len;
+  victim->drive = current_drive;
+  victim->partition = current_partition;
+  victim->fsys = fsys_type;
+  victim->stamp = ++dentry_cache_clock;
+  grub_memmove (victim->path, path, len);
+  grub_memmove (victim->data, data, size);
+}
+
+/* Forget all resolved paths, because the root device has changed or a
+   disk may have.  */
+void
+dentry_cache_invalidate (void)
+{
+  int i;
+
+  for (i = 0; i < DENTRY_CACHE_ENTRIES; i++)
+    dentry_cache[i].len = 0;
+}
+#endif /* ! STAGE1_5 */
+
+#ifndef STAGE1_5
+#ifdef GRUB_UTIL
+/* The grub shell keeps the file descriptor of a disk in the flags of its
+   geometry, and can read any number of sectors to any address.  */
+# define LARGE_READS(geom)	1
+# define FLAT_READS(geom)	1
+#else
+# define LARGE_READS(geom)	((geom)->flags & BIOSDISK_FLAG_LBA_EXTENSION)
+# define FLAT_READS(geom)	((geom)->flags & BIOSDISK_FLAG_FLAT_ADDRESS)
+#endif
+
+/* The drive LARGE_READ_MAX applies to.  */
+static int large_read_drive = -1;
+/* The most sectors read at once from it without an error so far.  */
+static int large_read_max;
+
+/* Whether reads to flat addresses work on a drive: 0 if not known yet,
+   FLAT_READ_OK, or FLAT_READ_FAILED.  */
+#define FLAT_READ_OK		1
+#define FLAT_READ_FAILED	2
+static char flat_read_state[0x100];
+
+/* Return the most sectors to read from DRIVE at once.  */
+static int
+large_read_limit (int drive)
+{
+  if (drive != large_read_drive)
+    {
+      large_read_drive = drive;
+      large_read_max = BIOSDISK_MAX_SECTORS;
+    }
+
+  return large_read_max;
+}
+
+/* Read up to NSEC sectors from SECTOR on DRIVE into LARGE_BUFFERADDR
+   with one extended read, and return the number of sectors read, or
+   zero if the track buffer should be used instead. A BIOS which fails
+   a read gets half as many sectors the next time.  */
+static int
+rawread_large (int drive, int sector, int nsec, int sector_size_bits)
+{
+  /* A failed read must not turn off LBA for the track buffer.  */
+  struct geometry geom = buf_geom;
+
+  if (! LARGE_READS (&geom) || sector == 0 || large_buffer_clobbered)
+    return 0;
+
+  if (nsec > large_read_limit (drive))
+    nsec = large_read_max;
+  if (nsec > (LARGE_BUFFERLEN >> sector_size_bits))
+    nsec = LARGE_BUFFERLEN >> sector_size_bits;
+  if (nsec <= 1)
+    return 0;
+
+  if (biosdisk (BIOSDISK_READ, drive, &geom, sector, nsec, LARGE_BUFFERSEG))
+    {
+      large_read_max = nsec / 2;
+      return 0;
+    }
+
+  return nsec;
+}
+
+/* Read up to NSEC sectors from SECTOR on DRIVE straight into BUF with one
+   EDD 3.0 read to a flat address, and return the number of sectors read,
+   or zero if a buffer in low memory must be used instead. The first
+   such read from a drive is checked against a read into BUFFERADDR, as
+   some BIOSes claim EDD 3.0 but ignore the flat address.  */
+static int
+rawread_flat (int drive, int sector, int nsec, char *buf,
+	      int sector_size_bits)
+{
+  struct geometry geom = buf_geom;
+  int state = flat_read_state[drive & 0xff];
+
+  if (! FLAT_READS (&geom) || state == FLAT_READ_FAILED || sector == 0)
+    return 0;
+
+  if (nsec > large_read_limit (drive))
+    nsec = large_read_max;
+  if (! state)
+    nsec = 1;
+
+  if (biosdisk_flat (BIOSDISK_READ, drive, &geom, sector, nsec,
+		     (unsigned long) buf))
+    {
+      if (state)
+	large_read_max = nsec / 2;
+      else
+	flat_read_state[drive & 0xff] = FLAT_READ_FAILED;
+      return 0;
+    }
+
+  if (! state)
+    {
+      buf_track = -1;
+      if (biosdisk (BIOSDISK_READ, drive, &geom, sector, 1, BUFFERSEG)
+	  || grub_memcmp (buf, (char *) BUFFERADDR, 1 << sector_size_bits))
+	{
+	  flat_read_state[drive & 0xff] = FLAT_READ_FAILED;
+	  return 0;
+	}
+      flat_read_state[drive & 0xff] = FLAT_READ_OK;
+    }
+
+  return nsec;
+}
+#endif /* ! STAGE1_5 */
+
 int
 rawread (int drive, int sector, int byte_offset, int byte_len, char *buf)
 {
   int slen, sectors_per_vtrack;
   int sector_size_bits = log2 (buf_geom.sector_size);
+#ifndef STAGE1_5
+  int stream = ((byte_offset + byte_len) >> sector_size_bits
+		> SECTOR_CACHE_STREAM);
+#endif
 
   if (byte_len <= 0)
     return 1;
@@ -166,6 +656,9 @@ rawread (int drive, int sector, int byte_offset, int byte_len, char *buf)
   while (byte_len > 0 && !errnum)
     {
       int soff, num_sect, track, size = byte_len;
+#ifndef STAGE1_5
+      int large_sect;
+#endif
       char *bufaddr;
 
       /*
@@ -182,6 +675,11 @@ rawread (int drive, int sector, int byte_offset, int byte_len, char *buf)
 	  buf_drive = drive;
 	  buf_track = -1;
 	  sector_size_bits = log2 (buf_geom.sector_size);
+#ifndef STAGE1_5
+	  /* The user may have exchanged a removable disk.  */
+	  if (! (drive & 0x80) || drive == cdrom_drive)
+	    sector_cache_invalidate (drive);
+#endif
 	}
 
       /* Make sure that SECTOR is valid.  */
@@ -207,9 +705,46 @@ rawread (int drive, int sector, int byte_offset, int byte_len, char *buf)
       bufaddr = ((char *) BUFFERADDR
 		 + (soff << sector_size_bits) + byte_offset);
 
+#ifndef STAGE1_5
+      /* Serve the sector from the sector cache, up to the end of its
+	 line.  */
+      if (track != buf_track
+	  && (bufaddr = sector_cache_lookup (drive, sector,
+					     sector_size_bits)) != 0)
+	{
+	  int line_sect = SECTOR_CACHE_LINE >> sector_size_bits;
+
+	  num_sect = line_sect - (sector & (line_sect - 1));
+	  bufaddr += byte_offset;
+	}
+      /* Read whole sectors beyond this track straight into BUF.  */
+      else if (track != buf_track && byte_offset == 0
+	       && (byte_len >> sector_size_bits) > num_sect
+	       && (large_sect = rawread_flat (drive, sector,
+					      byte_len >> sector_size_bits,
+					      buf, sector_size_bits)) > 0)
+	{
+	  num_sect = large_sect;
+	  bufaddr = buf;
+	}
+      /* Read the sectors beyond this track in as few calls as the BIOS
+	 allows, leaving the track buffer as it is.  */
+      else if (track != buf_track && slen > num_sect
+	       && (large_sect = rawread_large (drive, sector, slen,
+					       sector_size_bits)) > 0)
+	{
+	  num_sect = large_sect;
+	  bufaddr = (char *) LARGE_BUFFERADDR + byte_offset;
+	  sector_cache_fill (drive, sector, num_sect,
+			     (char *) LARGE_BUFFERADDR, sector_size_bits,
+			     stream);
+	}
+      else
+#endif /* ! STAGE1_5 */
       if (track != buf_track)
 	{
 	  int bios_err, read_start = track, read_len = sectors_per_vtrack;
+	  int remapped = 0;
 
 	  /*
 	   *  If there's more than one read in this entire loop, then
@@ -245,8 +780,12 @@ rawread (int drive, int sector, int byte_offset, int byte_len, char *buf)
 		  bufaddr = (char *) BUFFERADDR + byte_offset;
 		}
 	    }
-	  else
+	  else if (read_start == track)
 	    buf_track = track;
+	  else
+	    /* The buffer holds only the end of the track, not at the
+	       offsets of a whole track.  */
+	    buf_track = -1;
 
 	  if ((buf_track == 0 || sector == 0)
 	      && (PC_SLICE_TYPE (BUFFERADDR, 0) == PC_SLICE_TYPE_EZD
@@ -254,6 +793,8 @@ rawread (int drive, int sector, int byte_offset, int byte_len, char *buf)
 		  || PC_SLICE_TYPE (BUFFERADDR, 2) == PC_SLICE_TYPE_EZD
 		  || PC_SLICE_TYPE (BUFFERADDR, 3) == PC_SLICE_TYPE_EZD))
 	    {
+	      remapped = 1;
+
 	      /* This is a EZD disk map sector 0 to sector 1 */
 	      if (buf_track == 0 || slen >= 2)
 		{
@@ -269,6 +810,13 @@ rawread (int drive, int sector, int byte_offset, int byte_len, char *buf)
 		    errnum = ERR_READ;
 		}
 	    }
+
+#ifndef STAGE1_5
+	  /* Keep the whole lines just read in the sector cache.  */
+	  if (! bios_err && ! remapped && ! errnum)
+	    sector_cache_fill (drive, read_start, read_len,
+			       (char *) BUFFERADDR, sector_size_bits, stream);
+#endif /* ! STAGE1_5 */
 	}
 	  
       if (size > ((num_sect << sector_size_bits) - byte_offset))
@@ -296,7 +844,8 @@ rawread (int drive, int sector, int byte_offset, int byte_len, char *buf)
 	    }
 	}
 
-      grub_memmove (buf, bufaddr, size);
+      if (bufaddr != buf)
+	grub_memmove (buf, bufaddr, size);
 
       buf += size;
       byte_len -= size;
@@ -376,6 +925,15 @@ rawwrite (int drive, int sector, char *buf)
   if (sector - sector % buf_geom.sectors == buf_track)
     /* Clear the cache.  */
     buf_track = -1;
+  sector_cache_invalidate_sector (drive, sector, log2 (buf_geom.sector_size));
+
+  /* The sector may hold a directory or an inode.  */
+  dentry_cache_invalidate ();
+
+/* BEGIN TCG EXTENSION */
+  // Cached measurements may no longer match the disk
+  measure_cache_reset ();
+/* END TCG EXTENSION */
 
   return 1;
 }
@@ -391,6 +949,7 @@ devwrite (int sector, int sector_count, char *buf)
 	 embed a Stage 1.5 into a partition instead of a MBR, use system
 	 calls directly instead of biosdisk, because of the bug in
 	 Linux. *sigh*  */
+      sector_cache_invalidate (current_drive);
       return write_to_partition (device_map, current_drive, current_partition,
 				 sector, sector_count, buf);
     }
@@ -1568,6 +2127,101 @@ print_completions (int is_filename, int is_completion)
 #endif /* STAGE1_5 */
 
 
+/* Read LEN bytes of the raw file at FILEPOS, bypassing decompression
+   and measurement.  */
+static int read_raw (char *buf, int len);
+
+#ifndef STAGE1_5
+/* BEGIN TCG EXTENSION */
+/* The file being opened is measured as one stream of its on-disk bytes,
+   starting at offset zero.  A gzip'd file is measured compressed, from
+   the reads that feed the inflate code, and calculate_sha1 hashes the
+   same bytes for a checkfile, so that every digest of a file can be
+   reproduced from the file on disk, e.g. by util/create_sha1.
+   SHA1_BYTE_COUNT is the end of the part already hashed, so the loaders
+   can read straight into the final addresses; gaps skipped by a forward
+   seek are hashed through a small bounce buffer and bytes read again
+   after a backward seek are not hashed twice.  */
+
+/* Long reads are measured in parts of this size, so that the hashing
+   worker can hash one part while the next one is read.  */
+#define MEASURE_CHUNK	0x40000
+
+/* Hash the bytes from SHA1_BYTE_COUNT up to the file offset POS.  */
+static void
+measure_up_to (int pos)
+{
+  char tcgbuffer[TCG_BUFFER_SIZE];
+  int saved_filepos = filepos;
+
+  filepos = sha1_byte_count;
+  while (filepos < pos && !errnum)
+    {
+      int size = pos - filepos;
+
+      if (size > TCG_BUFFER_SIZE)
+	size = TCG_BUFFER_SIZE;
+
+      size = read_raw (tcgbuffer, size);
+      if (size <= 0)
+	break;
+
+      sha1_update (&my_sha1, tcgbuffer, size);
+      sha1_byte_count += size;
+    }
+
+  filepos = saved_filepos;
+}
+/* END TCG EXTENSION */
+#endif /* ! STAGE1_5 */
+
+/* Check the file FILENAME just opened for a gzip header.  */
+static int
+test_header (char *filename)
+{
+#ifndef STAGE1_5
+/* BEGIN TCG EXTENSION */
+  if (perform_sha1)
+    {
+      int ret = 1, i;
+
+      /* The probe reads the header and the trailer of the file, so it
+	 must not advance the measured stream.  */
+      sha1_has_to_measure = filemax;
+
+      /* A file already hashed by checkfile and still held in memory
+	 is served from there, and its digest is taken as is.  */
+      cached_file = measure_cache_lookup ();
+      if (cached_file && ! cached_file->data)
+	cached_file = 0;
+      if (cached_file)
+	sha1_byte_count = filemax;
+
+      /* A file listed in a checkfile must still match it.  */
+      checked_digest = checkfile_index_lookup (filename);
+
+      for (i = 0; i < sizeof (measured_name) - 1
+	     && filename[i] && ! isspace (filename[i]); i++)
+	measured_name[i] = filename[i];
+      measured_name[i] = 0;
+
+      perform_sha1 = 0;
+# ifndef NO_DECOMPRESSION
+      ret = gunzip_test_header ();
+# endif /* NO_DECOMPRESSION */
+      perform_sha1 = 1;
+      return ret;
+    }
+/* END TCG EXTENSION */
+#endif /* ! STAGE1_5 */
+
+#ifndef NO_DECOMPRESSION
+  return gunzip_test_header ();
+#else /* NO_DECOMPRESSION */
+  return 1;
+#endif /* NO_DECOMPRESSION */
+}
+
 /*
  *  This is the generic file open function.
  */
@@ -1602,8 +2256,8 @@ restart:
     sha1_byte_count = 0;
     sha1_has_to_measure = 0;
     laststatus = 0;
-    kernel_filesize = 0;
-    kernel_compressed_filesize = 0;
+    cached_file = 0;
+    checked_digest = 0;
 /* END TCG EXTENSION */
 
 #endif
@@ -1635,10 +2289,10 @@ restart:
     {
 #ifndef NO_BLOCK_FILES
       char *ptr = filename;
-      int tmp, list_addr = BLK_BLKLIST_START;
+      int tmp, start, num = 0;
       filemax = 0;
 
-      while (list_addr < BLK_MAX_ADDR)
+      while (num < BLK_MAX_SEGMENTS)
 	{
 	  tmp = 0;
 	  safe_parse_maxint (&ptr, &tmp);
@@ -1659,7 +2313,7 @@ restart:
 	     be remounted */
 	  fsys_type = NUM_FSYS;
 
-	  BLK_BLKSTART (list_addr) = tmp;
+	  start = tmp;
 	  ptr++;
 
 	  if (!safe_parse_maxint (&ptr, &tmp)
@@ -1670,10 +2324,18 @@ restart:
 	      break;
 	    }
 
-	  BLK_BLKLENGTH (list_addr) = tmp;
+	  /* a block that continues the previous one extends it */
+	  if (num && (BLK_SEGMENT_START (num - 1) + BLK_SEGMENT_END (num - 1)
+		      - BLK_SEGMENT_BEGIN (num - 1)) == start)
+	    BLK_SEGMENT_END (num - 1) += tmp;
+	  else
+	    {
+	      BLK_SEGMENT_START (num) = start;
+	      BLK_SEGMENT_END (num) = (filemax >> SECTOR_BITS) + tmp;
+	      num++;
+	    }
 
 	  filemax += (tmp * SECTOR_SIZE);
-	  list_addr += BLK_BLKLIST_INC_VAL;
 
 	  if (*ptr != ',')
 	    break;
@@ -1681,18 +2343,13 @@ restart:
 	  ptr++;
 	}
 
-      if (list_addr < BLK_MAX_ADDR && ptr != filename && !errnum)
+      if (num < BLK_MAX_SEGMENTS && ptr != filename && !errnum)
 	{
 	  block_file = 1;
-	  BLK_CUR_FILEPOS = 0;
-	  BLK_CUR_BLKLIST = BLK_BLKLIST_START;
-	  BLK_CUR_BLKNUM = 0;
+	  BLK_NUM_SEGMENTS = num;
+	  BLK_CUR_SEGMENT = 0;
 
-#ifndef NO_DECOMPRESSION
-	    return gunzip_test_header ();
-#else /* NO_DECOMPRESSION */
-	  return 1;
-#endif /* NO_DECOMPRESSION */
+	  return test_header (filename);
 	}
 #else /* NO_BLOCK_FILES */
       errnum = ERR_BAD_FILENAME;
@@ -1709,77 +2366,29 @@ restart:
 
   if (!errnum && (*(fsys_table[fsys_type].dir_func)) (filename))
     {
-#ifndef NO_DECOMPRESSION
+#if !defined(STAGE1_5) && defined(SHOW_SHA1)
 /* BEGIN TCG EXTENSION */
-	if (perform_sha1)
+      if (perform_sha1)
 	{
-	    int temp;
-
-	    // Getting the plain filesize of the kernel
-	    if (measure_kernel)
-		kernel_filesize = filemax;
-
-	    // Testing the header for gzip information
-	    perform_sha1 = 0;
-	    if (measure_kernel)
-	    {
-		measure_kernel = 0;
-		temp = gunzip_test_header();
-		measure_kernel = 1;
-	    }
-	    else
-		temp = gunzip_test_header();
-
-	    perform_sha1 = 1;
-	    if (measure_kernel)
-	    {
-		// The uncompressed filesize
-		kernel_compressed_filesize = filemax;
-		kernel_real_addr = (LINUX_BZIMAGE_ADDR) + (2*kernel_compressed_filesize);
-#ifdef DEBUG
-		printf("tGRUB: Kernel filesize (real): %d                       \n",kernel_filesize);
-		printf("tGRUB: Kernel filesize (compressed): %d                       \n",kernel_compressed_filesize);
-		printf("tGRUB: LINUX_BZIMAGE_ADDR: %x                       \n",LINUX_BZIMAGE_ADDR);
-		printf("tGRUB: LINUX_BZIMAGE_ADDR Offset: %x                       \n",(2*kernel_compressed_filesize));
-		printf("tGRUB: Loading kernel to memory address: %x                        \n",kernel_real_addr);
-#endif
+	  int i;
 
-		{
-		    measure_kernel = 0;
-		    sha1_has_to_measure = kernel_filesize;
-		    filepos = 0;
-		    if (compressed_file)
-			grub_read( (char*)kernel_real_addr, kernel_compressed_filesize);
-		    else
-			grub_read( (char*)kernel_real_addr, kernel_filesize);
-		    filepos = 0;
-		    measure_kernel = 1;
-		}
-	    }
-#ifdef SHOW_SHA1
-	    if ((xy++)>17) { cls(); xy=0; }
-	    gotoxy(0,(xy&0xff));
-	    printf("File:[           Please wait...               ]->PCR[%d] ",PCR_KERNEL);
-	    int i;
-	    for (i=0; i<22; i++)
+	  if ((xy++)>17) { cls(); xy=0; }
+	  gotoxy(0,(xy&0xff));
+	  printf("File:[           Please wait...               ]->PCR[%d] ",PCR_KERNEL);
+	  for (i=0; i<22; i++)
 	    {
-    		if (filename[i])
-        	    printf("%c",filename[i]);
-		else
-		    break;
+	      if (filename[i])
+		printf("%c",filename[i]);
+	      else
+		break;
 	    }
-	    if (i<22)
-    		for ( ; i<22 ; i++)
-        	    printf(" ");
-#endif
-	    return temp;
+	  if (i<22)
+	    for ( ; i<22 ; i++)
+	      printf(" ");
 	}
-	else
 /* END TCG EXTENSION */
-    	    return gunzip_test_header ();
-#else /* NO_DECOMPRESSION */
-      return 1;
-#endif /* NO_DECOMPRESSION */
+#endif
+      return test_header (filename);
     }
 
 retry:
@@ -1814,31 +2423,14 @@ retry:
 int
 grub_read (char *buf, int len)
 {
-    int result;
+#ifndef STAGE1_5
+  int start, result;
+#endif
 
   /* Make sure "filepos" is a sane value */
   if ((filepos < 0) || (filepos > filemax))
     filepos = filemax;
 
-/* BEGIN TCG EXTENSION */
-// Publish the filesize
-    if (!sha1_has_to_measure)
-	sha1_has_to_measure = filemax;
-/* END TCG EXTENSION */
-
-/* BEGIN TCG EXTENSION */
-    // if we are loading a kernel, then the data is already in memory
-    if (measure_kernel)
-    {
-#ifdef DEBUG
-	printf("Kernel: Data is in memory -> copying %d Bytes at file position: %d      \n", len, filepos);
-#endif
-	memcpy(buf, RAW_ADDR(kernel_real_addr + filepos), len);
-	filepos += len;
-	return len;
-    }
-/* END TCG EXTENSION */
-
   /* Make sure "len" is a sane value */
   if ((len < 0) || (len > (filemax - filepos)))
     len = filemax - filepos;
@@ -1852,71 +2444,144 @@ grub_read (char *buf, int len)
       return 0;
     }
 
+#ifndef STAGE1_5
+/* BEGIN TCG EXTENSION */
+  /* Overwriting cached contents, possibly those of this very file,
+     sends the rest of the read back to the disk and the hash back to
+     the start of the file.  */
+  memory_forget ((unsigned long) buf, len);
+  if (cached_file && ! cached_file->data)
+    {
+      cached_file = 0;
+      sha1_init (&my_sha1);
+      sha1_byte_count = 0;
+    }
+/* END TCG EXTENSION */
+#endif /* ! STAGE1_5 */
+
 #ifndef NO_DECOMPRESSION
-    if (perform_sha1)
+  /* The inflate code reads the compressed data back through here, so
+     it is measured like any other file.  */
+  if (compressed_file)
+    return gunzip_read (buf, len);
+#endif /* NO_DECOMPRESSION */
+
+#ifndef STAGE1_5
+/* BEGIN TCG EXTENSION */
+  if (! perform_sha1)
+    return read_raw (buf, len);
+
+  /* Hash whatever a forward seek has skipped, then hash the new part
+     of the data in place.  */
+  if (filepos > sha1_byte_count)
+    measure_up_to (filepos);
+
+  result = 0;
+  while (len > 0)
     {
-	if ((!(sha1_byte_count)) && (filepos > 0))
+      int size = len > MEASURE_CHUNK ? MEASURE_CHUNK : len;
+      int got;
+
+      start = filepos;
+      got = read_raw (buf, size);
+      if (got <= 0)
+	break;
+
+      if (start + got > sha1_byte_count && start <= sha1_byte_count)
 	{
-	    int buf_len = filepos;
-	    char zero_buffer[buf_len];
-	    memset (zero_buffer,0,buf_len);
-	    filepos = 0;
-	    perform_sha1 = 0;
-	    grub_read(zero_buffer, buf_len);
-	    perform_sha1 = 1;
-	    sha1_update(&my_sha1,zero_buffer,buf_len);
-	    sha1_byte_count += filepos;
+	  sha1_update_queued (&my_sha1, (t_U8 *) buf + (sha1_byte_count - start),
+			      start + got - sha1_byte_count);
+	  sha1_byte_count = start + got;
 	}
+
+      buf += got;
+      len -= got;
+      result += got;
+      if (got < size || errnum)
+	break;
     }
-    if (compressed_file)
-	return gunzip_read (buf, len);
 
-#endif /* NO_DECOMPRESSION */
+  /* The caller may change the data as soon as we return.  */
+  sha1_wait ();
+  return result;
+/* END TCG EXTENSION */
+#else /* STAGE1_5 */
+  return read_raw (buf, len);
+#endif /* STAGE1_5 */
+}
+
+#ifndef NO_BLOCK_FILES
+/* Return the segment of the block file holding SECTOR of the file, or
+   BLK_NUM_SEGMENTS if there is none.  */
+static int
+blk_find_segment (int sector)
+{
+  int low = 0, high = BLK_NUM_SEGMENTS;
+
+  while (low < high)
+    {
+      int mid = (low + high) >> 1;
+
+      if (sector < BLK_SEGMENT_END (mid))
+	high = mid;
+      else
+	low = mid + 1;
+    }
+
+  return low;
+}
+#endif /* NO_BLOCK_FILES */
+
+static int
+read_raw (char *buf, int len)
+{
+#ifndef STAGE1_5
+/* BEGIN TCG EXTENSION */
+  if (cached_file)
+    {
+      memmove (buf, cached_file->data + filepos, len);
+      filepos += len;
+      return len;
+    }
+/* END TCG EXTENSION */
+#endif /* ! STAGE1_5 */
 
 #ifndef NO_BLOCK_FILES
   if (block_file)
     {
-      int size, off, ret = 0;
+      int size, off, sector, seg, ret = 0;
 
       while (len && !errnum)
 	{
-	  /* we may need to look for the right block in the list(s) */
-	  if (filepos < BLK_CUR_FILEPOS)
-	    {
-	      BLK_CUR_FILEPOS = 0;
-	      BLK_CUR_BLKLIST = BLK_BLKLIST_START;
-	      BLK_CUR_BLKNUM = 0;
-	    }
-
-	  /* run BLK_CUR_FILEPOS up to filepos */
-	  while (filepos > BLK_CUR_FILEPOS)
+	  sector = filepos >> SECTOR_BITS;
+	  seg = BLK_CUR_SEGMENT;
+
+	  /* look for the segment holding SECTOR, unless it is the one
+	     last read from or the next one */
+	  if (sector < BLK_SEGMENT_BEGIN (seg))
+	    seg = blk_find_segment (sector);
+	  else if (sector >= BLK_SEGMENT_END (seg))
 	    {
-	      if ((filepos - (BLK_CUR_FILEPOS & ~(SECTOR_SIZE - 1)))
-		  >= SECTOR_SIZE)
-		{
-		  BLK_CUR_FILEPOS += SECTOR_SIZE;
-		  BLK_CUR_BLKNUM++;
-
-		  if (BLK_CUR_BLKNUM >= BLK_BLKLENGTH (BLK_CUR_BLKLIST))
-		    {
-		      BLK_CUR_BLKLIST += BLK_BLKLIST_INC_VAL;
-		      BLK_CUR_BLKNUM = 0;
-		    }
-		}
+	      if (seg + 1 < BLK_NUM_SEGMENTS
+		  && sector < BLK_SEGMENT_END (seg + 1))
+		seg++;
 	      else
-		BLK_CUR_FILEPOS = filepos;
+		seg = blk_find_segment (sector);
 	    }
 
+	  if (seg >= BLK_NUM_SEGMENTS)
+	    break;
+	  BLK_CUR_SEGMENT = seg;
+
 	  off = filepos & (SECTOR_SIZE - 1);
-	  size = ((BLK_BLKLENGTH (BLK_CUR_BLKLIST) - BLK_CUR_BLKNUM)
-		  * SECTOR_SIZE) - off;
+	  size = ((BLK_SEGMENT_END (seg) - sector) * SECTOR_SIZE) - off;
 	  if (size > len)
 	    size = len;
 
 	  disk_read_func = disk_read_hook;
 
 	  /* read current block and put it in the right place in memory */
-	  devread (BLK_BLKSTART (BLK_CUR_BLKLIST) + BLK_CUR_BLKNUM,
+	  devread (BLK_SEGMENT_START (seg) + sector - BLK_SEGMENT_BEGIN (seg),
 		   off, size, buf);
 
 	  disk_read_func = NULL;
@@ -1939,18 +2604,7 @@ grub_read (char *buf, int len)
       return 0;
     }
 
-  result =  (*(fsys_table[fsys_type].read_func)) (buf, len);
-#ifndef STAGE1_5
-/* BEGIN TCG EXTENSION */
-    // Update the SHA1-buffer
-    if (perform_sha1)
-    {
-	sha1_update(&my_sha1,buf,len);
-	sha1_byte_count += len;
-    }
-/* END TCG EXTENSION */
-#endif
-  return result;
+  return (*(fsys_table[fsys_type].read_func)) (buf, len);
 }
 
 #ifndef STAGE1_5
@@ -1958,10 +2612,6 @@ grub_read (char *buf, int len)
 int
 grub_seek (int offset)
 {
-#ifdef DEBUG
-    if (measure_kernel)
-	printf("Kernel: grub_seek() Requesting file offset: %d      \n", offset);
-#endif
   if (offset > filemax || offset < 0)
     return -1;
 
@@ -1999,20 +2649,33 @@ void
 grub_close (void)
 {
 #ifndef STAGE1_5 /* STAGE1_5 */
-/* BEGIN TCG EXTENSION */
-    if (measure_kernel)
-    {
-	measure_kernel = 0;  
-	grub_close;
-    }
-/* END TCG EXTENSION */
-
 /* BEGIN TCG EXTENSION */
     if (perform_sha1)
     {
         unsigned long hash_result[5];
-	// Finishing SHA1-caluclation
-        sha1_finish(&my_sha1, hash_result);
+
+#ifndef NO_DECOMPRESSION
+	// Go back to the compressed view to measure what was not read
+	if (compressed_file)
+	{
+	    compressed_file = 0;
+	    gunzip_swap_values ();
+	}
+#endif
+	if (cached_file)
+	{
+	    int i;
+
+	    for (i = 0; i < 5; i++)
+		hash_result[i] = cached_file->digest[i];
+	}
+	else
+	{
+	    measure_up_to (sha1_has_to_measure);
+
+	    // Finishing SHA1-caluclation
+	    sha1_finish(&my_sha1, hash_result);
+	}
 	// Check if we have measured all bytes
 	if (sha1_byte_count - sha1_has_to_measure)
 	{
@@ -2044,14 +2707,35 @@ grub_close (void)
 		((hash_result[i]>>20)&0x0f),((hash_result[i]>>16)&0x0f),((hash_result[i]>>12)&0x0f),
 		((hash_result[i]>>8)&0x0f),((hash_result[i]>>4)&0x0f),(hash_result[i]&0x0f));
 #endif
-	    // If we have a TPM, update PCR 14 with the result
-	    if (!(tpm_present()))
-		update_pcr(PCR_KERNEL,hash_result);
+	    // Without a log entry or with PCR 14 not extended the file must
+	    // not be booted; ERRNUM stops it
+	    if (tcg_log_event (PCR_KERNEL, TCG_EV_IPL, hash_result,
+			       measured_name, strlen (measured_name)))
+		tcg_log_extend (PCR_KERNEL, hash_result);
 //#ifdef SHOW_SHA1
 //	    printf("\n");
 //#endif
+
+	    // Check the file against the reference value of its checkfile
+	    if (checked_digest)
+	    {
+		int i;
+
+		for (i = 0; i < 5; i++)
+		    if (hash_result[i] != checked_digest[i])
+			break;
+		if (i < 5)
+		{
+		    printf("\ntGRUB: File differs from its checkfile entry -> Integrity Error!\n"
+			   "tGRUB: Press ESC to stop booting or any other key to continue ...\n");
+		    if (ASCII_CHAR (getkey ()) == '\e')
+			grub_halt (0);
+		}
+	    }
 	}
     }
+    cached_file = 0;
+    checked_digest = 0;
 /* END TCG EXTENSION */
 #endif STAGE1_5 /* STAGE1_5 */
 
@@ -0,0 +1,218 @@
+/*      This file contains the event log of the Trusted GRUB project.
+
+	Every measurement of tGRUB (commands in PCR 12, checkfile entries in
+	PCR 13 and loaded files in PCR 14) is recorded in an event log in the
+	format of the TCG PC Client specification, so that a verifier can
+	replay the values of the PCRs. The log is handed over to the booted
+	kernel by tcg_event_log_handoff in stage2/boot.c. The commands can either be extended
+	into PCR 12 one by one, or, in batch mode, be collected and extended
+	into PCR 12 once, right before booting. As every extension is a call
+	into the TPM through the BIOS, the latter saves most of the time
+	spent in the TPM while booting a menu entry.
+
+	An event that cannot be logged is not extended either, since the
+	log could no longer replay the PCRs. The command, the checkfile or
+	the load that caused it fails, and so does the boot. The same holds
+	for an event the TPM has not extended, after which the log is lost.
+
+	In batch mode the log contains an EV_NO_ACTION event for each
+	command, holding the SHA1 of the command and the command itself,
+	and these are not extended on their own. They are followed by an
+	EV_IPL event holding the SHA1 over the concatenated SHA1 values of
+	all commands since the last EV_IPL event of PCR 12, which is the
+	value that has been extended into PCR 12. Outside batch mode each
+	command is logged as an EV_IPL event of its own.
+
+	Parameters:
+
+	int tcg_log_event(int pcr, int type, unsigned long *digest, char *data, int len)
+	int tcg_log_extend(int pcr, unsigned long *digest)
+	int tcg_cmdline_event(unsigned long *digest, char *cmdline)
+	int tcg_cmdline_flush(void)
+	char *tcg_event_log(int *len)
+	unsigned long tcg_event_log_addr(void)
+	void tcg_event_log_place(void)
+	void tcg_event_log_forget(unsigned long addr, int len)
+*/
+
+#include "shared.h"
+
+/* The log lives in upper memory right below the buffers of gunzip, with
+   room for thousands of events. load_initrd puts the initrd below it, and
+   the loaders report their other writes through memory_forget. */
+static char *event_log;
+static unsigned long event_log_mem_upper;
+static int event_log_len;
+// The room of the log, less what a loader has taken from its end
+static int event_log_size;
+// Set once an event could not be logged, for good
+static int event_log_lost;
+
+// Non-zero if commands are collected for a single extension of PCR 12
+int cmdline_batch = 0;
+static int cmdline_batch_count;
+static sha1_context cmdline_batch_sha1;
+
+// Store a SHA1 result as the 20 bytes sent to the TPM
+static void digest_to_bytes (unsigned long *digest, unsigned char *bytes)
+{
+    int i;
+
+    for (i=0; i<5; i++)
+    {
+	bytes[4*i+0] = (digest[i] >> 24) & 0xff;
+	bytes[4*i+1] = (digest[i] >> 16) & 0xff;
+	bytes[4*i+2] = (digest[i] >>  8) & 0xff;
+	bytes[4*i+3] = (digest[i]      ) & 0xff;
+    }
+}
+
+/* Return the physical address of the log, for the current size of upper
+   memory. */
+unsigned long tcg_event_log_addr (void)
+{
+    return (mbi.mem_upper << 10) + 0x100000 - INFLATE_MEM_GAP
+	- TCG_EVENT_LOG_SIZE;
+}
+
+/* Place the log for the current size of upper memory, and move the events
+   logged so far there. */
+void tcg_event_log_place (void)
+{
+    char *log;
+
+    if (event_log_mem_upper == mbi.mem_upper)
+	return;
+    event_log_mem_upper = mbi.mem_upper;
+
+    if ((mbi.mem_upper << 10) < INFLATE_MEM_GAP + TCG_EVENT_LOG_SIZE)
+    {
+	event_log = 0;
+	event_log_lost = 1;
+	return;
+    }
+
+    log = (char *) RAW_ADDR (tcg_event_log_addr ());
+    if (event_log)
+	memmove (log, event_log, event_log_len);
+    event_log = log;
+    event_log_size = TCG_EVENT_LOG_SIZE;
+}
+
+/* A loader is about to write to the memory range ADDR...ADDR+LEN. What
+   it leaves of the log after the events logged so far stays usable. */
+void tcg_event_log_forget (unsigned long addr, int len)
+{
+    unsigned long log;
+
+    tcg_event_log_place ();
+    log = (unsigned long) event_log;
+    if (!log || len <= 0 || addr >= log + event_log_size || addr + len <= log)
+	return;
+
+    if (addr < log + event_log_len)
+	event_log_lost = 1;
+    else
+	event_log_size = addr - log;
+}
+
+/* Append an event to the log. Return zero, with ERRNUM set, if it does
+   not fit or the log has been lost, in which case no later event is
+   logged either. */
+int tcg_log_event (int pcr, int type, unsigned long *digest, char *data, int len)
+{
+    struct tcg_pcr_event *event;
+
+    tcg_event_log_place ();
+    if (event_log_lost
+	|| event_log_len + sizeof (struct tcg_pcr_event) + len > event_log_size)
+    {
+	event_log_lost = 1;
+	errnum = ERR_EVENT_LOG;
+	return 0;
+    }
+
+    event = (struct tcg_pcr_event *) (event_log + event_log_len);
+    event->pcr_index = pcr;
+    event->event_type = type;
+    digest_to_bytes (digest, event->digest);
+    event->event_size = len;
+    memmove (event->event, data, len);
+    event_log_len += sizeof (struct tcg_pcr_event) + len;
+    return 1;
+}
+
+/* Extend the event just logged with the SHA1 value DIGEST into PCR, if
+   there is a TPM. Return zero, with ERRNUM set, if the TPM fails, in
+   which case the log is lost, as it no longer replays the PCRs. */
+int tcg_log_extend (int pcr, unsigned long *digest)
+{
+    if (tpm_present())
+	return 1;
+
+    if (update_pcr(pcr,digest))
+    {
+	event_log_lost = 1;
+	errnum = ERR_TPM_EXTEND;
+	return 0;
+    }
+    return 1;
+}
+
+/* Log the command CMDLINE with the SHA1 value DIGEST and extend it into
+   PCR 12, either now or, in batch mode, with the next flush. Return zero,
+   with ERRNUM set, if it cannot be logged or extended. */
+int tcg_cmdline_event (unsigned long *digest, char *cmdline)
+{
+    unsigned char bytes[20];
+
+    if (cmdline_batch)
+    {
+	if (!tcg_log_event (PCR_CMDLINE, TCG_EV_NO_ACTION, digest,
+			    cmdline, strlen (cmdline)))
+	    return 0;
+	if (!cmdline_batch_count++)
+	    sha1_init (&cmdline_batch_sha1);
+	digest_to_bytes (digest, bytes);
+	sha1_update (&cmdline_batch_sha1, bytes, 20);
+	return 1;
+    }
+
+    if (!tcg_log_event (PCR_CMDLINE, TCG_EV_IPL, digest, cmdline,
+			strlen (cmdline)))
+	return 0;
+    return tcg_log_extend (PCR_CMDLINE, digest);
+}
+
+/* Extend the commands collected in batch mode into PCR 12. This has to
+   happen before anything is booted. Return zero, with ERRNUM set, if it
+   cannot be logged or extended. */
+int tcg_cmdline_flush (void)
+{
+    unsigned long hash_result[5];
+    char text[32];
+
+    if (!cmdline_batch_count)
+	return 1;
+
+    sha1_finish (&cmdline_batch_sha1, hash_result);
+    sprintf (text, "tGRUB: %d commands", cmdline_batch_count);
+    cmdline_batch_count = 0;
+
+    if (!tcg_log_event (PCR_CMDLINE, TCG_EV_IPL, hash_result, text,
+			strlen (text)))
+	return 0;
+    return tcg_log_extend (PCR_CMDLINE, hash_result);
+}
+
+/* Return the event log and store its length in LEN, or return 0 if an
+   event has not been logged, so that the log cannot replay the PCRs. */
+char *tcg_event_log (int *len)
+{
+    *len = 0;
+    if (event_log_lost)
+	return 0;
+
+    *len = event_log_len;
+    return event_log;
+}
@@ -140,16 +140,17 @@ int iso9660_dir (char *dirname);
    + FSYS_TFTP_NUM + FSYS_ISO9660_NUM + FSYS_UFS2_NUM)
 #endif
 
-/* defines for the block filesystem info area */
+/* defines for the block filesystem info area: the number of segments,
+   the segment last read from, and the segments, each with its first
+   sector on the disk and the sector of the file that follows it, so that
+   a file position is found by a binary search */
 #ifndef NO_BLOCK_FILES
-#define BLK_CUR_FILEPOS      (*((int*)FSYS_BUF))
-#define BLK_CUR_BLKLIST      (*((int*)(FSYS_BUF+4)))
-#define BLK_CUR_BLKNUM       (*((int*)(FSYS_BUF+8)))
-#define BLK_MAX_ADDR         (FSYS_BUF+0x7FF9)
-#define BLK_BLKSTART(l)      (*((int*)l))
-#define BLK_BLKLENGTH(l)     (*((int*)(l+4)))
-#define BLK_BLKLIST_START    (FSYS_BUF+12)
-#define BLK_BLKLIST_INC_VAL  8
+#define BLK_NUM_SEGMENTS     (*((int*)FSYS_BUF))
+#define BLK_CUR_SEGMENT      (*((int*)(FSYS_BUF+4)))
+#define BLK_SEGMENT_START(i) (((int*)(FSYS_BUF+8))[2*(i)])
+#define BLK_SEGMENT_END(i)   (((int*)(FSYS_BUF+8))[2*(i)+1])
+#define BLK_SEGMENT_BEGIN(i) ((i) ? BLK_SEGMENT_END ((i) - 1) : 0)
+#define BLK_MAX_SEGMENTS     ((FSYS_BUFLEN - 8) / 8)
 #endif /* NO_BLOCK_FILES */
 
 /* this next part is pretty ugly, but it keeps it in one place! */
@@ -22,7 +22,19 @@
 #include "shared.h"
 #include "filesys.h"
 
-static int mapblock1, mapblock2;
+/* The indirect blocks of files without extents: the blocks held in
+   IND_SLOT(slot), or 0, and when they were used last. */
+#define IND_SLOTS	16
+static int ind_block[IND_SLOTS];
+static unsigned long ind_stamp[IND_SLOTS];
+static unsigned long ind_clock;
+
+/* The ext4 extent tree: the blocks of the index and leaf nodes along the
+   path of the last lookup, held in EXT4_NODE(level), or 0, and the
+   extent found last, of EXT4_EXT_LEN blocks, or 0. */
+#define EXT4_MAX_DEPTH	5
+static int ext4_node[EXT4_MAX_DEPTH + 1];
+static int ext4_ext_block, ext4_ext_len, ext4_ext_start;
 
 /* sizes are always in bytes, BLOCK values are always in DEV_BSIZE (sectors) */
 #define DEV_BSIZE 512
@@ -125,7 +137,13 @@ struct ext2_super_block
     __u32 s_first_meta_bg;	/* First metablock group */
     __u32 s_mkfs_time;		/* When the filesystem was created */
     __u32 s_jnl_blocks[17]; 	/* Backup of the journal inode */
-    __u32 s_reserved[172];	/* Padding to the end of the block */
+    __u32 s_blocks_count_hi;	/* Blocks count MSB */
+    __u32 s_r_blocks_count_hi;	/* Reserved blocks count MSB */
+    __u32 s_free_blocks_hi;	/* Free blocks count MSB */
+    __u16 s_min_extra_isize;	/* All inodes have at least # bytes */
+    __u16 s_want_extra_isize;	/* New inodes should reserve # bytes */
+    __u32 s_flags;		/* Miscellaneous flags */
+    __u32 s_reserved[167];	/* Padding to the end of the block */
   };
 
 struct ext4_group_desc
@@ -234,6 +252,10 @@ struct ext2_inode
 #define EXT4_HAS_INCOMPAT_FEATURE(sb,mask)			\
 	( sb->s_feature_incompat & mask )
 
+#define EXT2_FEATURE_COMPAT_DIR_INDEX	0x0020
+#define EXT2_FLAGS_UNSIGNED_HASH	0x0002
+
+#define EXT2_INDEX_FL		0x00001000 /* hash-indexed directory */
 #define EXT4_EXTENTS_FL		0x00080000 /* Inode uses extents */
 #define EXT4_HUGE_FILE_FL	0x00040000 /* Set to each huge file */
 
@@ -294,6 +316,8 @@ struct ext4_extent_header
   };
 
 #define EXT4_EXT_MAGIC      (0xf30a)
+/* Longer extents are uninitialized, of ee_len - EXT_INIT_MAX_LEN blocks */
+#define EXT_INIT_MAX_LEN    (1UL << 15)
 #define EXT_FIRST_EXTENT(__hdr__) \
     ((struct ext4_extent *) (((char *) (__hdr__)) +     \
                  sizeof(struct ext4_extent_header)))
@@ -305,6 +329,42 @@ struct ext4_extent_header
 #define EXT_LAST_INDEX(__hdr__) \
     (EXT_FIRST_INDEX((__hdr__)) + (__u16)((__hdr__)->eh_entries) - 1)
 
+/* linux/ext3/namei.c */
+/* The hashed index of a directory. Its root is in the first block, after
+ * the entries of "." and "..", and its nodes fill blocks of their own,
+ * behind an empty entry. The first entry of each node holds the limit
+ * and the count of the entries in place of the hash.
+ */
+struct dx_entry
+  {
+    __u32 hash;
+    __u32 block;	/* logical block of the directory */
+  };
+
+struct dx_countlimit
+  {
+    __u16 limit;
+    __u16 count;
+  };
+
+struct dx_root_info
+  {
+    __u32 reserved_zero;
+    __u8  hash_version;
+    __u8  info_length;	/* 8 */
+    __u8  indirect_levels;
+    __u8  unused_flags;
+  };
+
+#define DX_ROOT_INFO_OFFSET	24	/* after "." and ".." */
+#define DX_NODE_OFFSET		8	/* after the empty entry */
+#define DX_MAX_LEVELS		3
+#define DX_HASH_LEGACY		0
+#define DX_HASH_HALF_MD4	1
+#define DX_HASH_TEA		2
+/* with EXT2_FLAGS_UNSIGNED_HASH, names are hashed as unsigned chars */
+#define DX_HASH_UNSIGNED	3
+
 
 
 /* linux/ext2fs.h */
@@ -340,6 +400,17 @@ struct ext4_extent_header
     ((int)((int)INODE + sizeof(struct ext2_inode)))
 #define DATABLOCK2 \
     ((int)((int)DATABLOCK1 + EXT2_BLOCK_SIZE(SUPERBLOCK)))
+/* the nodes of an ext4 extent tree below the root in the inode, for as
+   many levels as there is room for */
+#define EXT4_NODE(level) \
+    ((int)DATABLOCK2 + (level) * EXT2_BLOCK_SIZE(SUPERBLOCK))
+#define EXT4_NODE_FITS(level) \
+    (EXT4_NODE((level) + 1) <= (int)FSYS_BUF + FSYS_BUFLEN)
+/* files without extents use the same room for their indirect blocks */
+#define IND_SLOT(slot) \
+    ((slot) ? EXT4_NODE(slot) : DATABLOCK1)
+#define IND_SLOT_FITS(slot) \
+    ((slot) < IND_SLOTS && (!(slot) || EXT4_NODE_FITS(slot)))
 
 /* linux/ext2_fs.h */
 #define EXT2_ADDR_PER_BLOCK(s)          (EXT2_BLOCK_SIZE(s) / sizeof (__u32))
@@ -423,14 +494,75 @@ ext2_rdfsb (int fsblock, int buffer)
 		  EXT2_BLOCK_SIZE (SUPERBLOCK), (char *) buffer);
 }
 
+/* Returns the number of the MAX block numbers from ENTRIES on that
+   number consecutive blocks, at least 1. */
+static int
+ext2fs_run (__u32 *entries, int max)
+{
+  int n;
+
+  for (n = 1; n < max && entries[n] && entries[n] == entries[0] + n; n++)
+    ;
+  return n;
+}
+
+/* Forget the indirect blocks and the extent tree of the last inode. */
+static void
+map_reset (void)
+{
+  int i;
+
+  for (i = 0; i < IND_SLOTS; i++)
+    ind_block[i] = ind_stamp[i] = 0;
+  for (i = 0; i <= EXT4_MAX_DEPTH; i++)
+    ext4_node[i] = 0;
+  ext4_ext_len = 0;
+}
+
+/* Returns the indirect block FSBLOCK, read into the least recently used
+   slot unless it is in one already, or 0 on an error. */
+static __u32 *
+ext2_indirect (int fsblock)
+{
+  int slot, victim = 0;
+
+  for (slot = 0; IND_SLOT_FITS (slot); slot++)
+    {
+      if (ind_block[slot] == fsblock)
+	{
+	  ind_stamp[slot] = ++ind_clock;
+	  return (__u32 *) IND_SLOT (slot);
+	}
+      if (ind_stamp[slot] < ind_stamp[victim])
+	victim = slot;
+    }
+
+  ind_block[victim] = 0;
+  if (!ext2_rdfsb (fsblock, IND_SLOT (victim)))
+    {
+      errnum = ERR_FSYS_CORRUPT;
+      return 0;
+    }
+  ind_block[victim] = fsblock;
+  ind_stamp[victim] = ++ind_clock;
+  return (__u32 *) IND_SLOT (victim);
+}
+
 /* from
   ext2/inode.c:ext2_bmap()
 */
 /* Maps LOGICAL_BLOCK (the file offset divided by the blocksize) into
-   a physical block (the location in the file system) via an inode. */
+   a physical block (the location in the file system) via an inode.
+   If RUN is not NULL, the number of blocks from LOGICAL_BLOCK on that
+   follow each other on the disk is stored there, as far as it is known
+   from the block of addresses at hand. */
 static int
-ext2fs_block_map (int logical_block)
+ext2fs_block_map (int logical_block, int *run)
 {
+  int bits = EXT2_ADDR_PER_BLOCK_BITS (SUPERBLOCK);
+  int mask = EXT2_ADDR_PER_BLOCK (SUPERBLOCK) - 1;
+  __u32 *entries = 0;
+  int bnum, level, index = 0;
 
 #ifdef E2DEBUG
   unsigned char *i;
@@ -459,75 +591,49 @@ ext2fs_block_map (int logical_block)
       printf ("returning %d\n", (unsigned char *) (INODE->i_block[logical_block]));
       printf ("returning %d\n", INODE->i_block[logical_block]);
 #endif /* E2DEBUG */
+      if (run)
+	*run = ext2fs_run (INODE->i_block + logical_block,
+			   EXT2_NDIR_BLOCKS - logical_block);
       return INODE->i_block[logical_block];
     }
-  /* else */
+  /* else, find the indirect, double or triple indirect block, and the
+     number of levels of blocks of addresses from there on */
   logical_block -= EXT2_NDIR_BLOCKS;
-  /* try the indirect block */
-  if (logical_block < EXT2_ADDR_PER_BLOCK (SUPERBLOCK))
-    {
-      if (mapblock1 != 1
-	  && !ext2_rdfsb (INODE->i_block[EXT2_IND_BLOCK], DATABLOCK1))
-	{
-	  errnum = ERR_FSYS_CORRUPT;
-	  return -1;
-	}
-      mapblock1 = 1;
-      return ((__u32 *) DATABLOCK1)[logical_block];
-    }
-  /* else */
-  logical_block -= EXT2_ADDR_PER_BLOCK (SUPERBLOCK);
-  /* now try the double indirect block */
-  if (logical_block < (1 << (EXT2_ADDR_PER_BLOCK_BITS (SUPERBLOCK) * 2)))
+  if (logical_block <= mask)
     {
-      int bnum;
-      if (mapblock1 != 2
-	  && !ext2_rdfsb (INODE->i_block[EXT2_DIND_BLOCK], DATABLOCK1))
-	{
-	  errnum = ERR_FSYS_CORRUPT;
-	  return -1;
-	}
-      mapblock1 = 2;
-      if ((bnum = (((__u32 *) DATABLOCK1)
-		   [logical_block >> EXT2_ADDR_PER_BLOCK_BITS (SUPERBLOCK)]))
-	  != mapblock2
-	  && !ext2_rdfsb (bnum, DATABLOCK2))
-	{
-	  errnum = ERR_FSYS_CORRUPT;
-	  return -1;
-	}
-      mapblock2 = bnum;
-      return ((__u32 *) DATABLOCK2)
-	[logical_block & (EXT2_ADDR_PER_BLOCK (SUPERBLOCK) - 1)];
+      bnum = INODE->i_block[EXT2_IND_BLOCK];
+      level = 1;
     }
-  /* else */
-  mapblock2 = -1;
-  logical_block -= (1 << (EXT2_ADDR_PER_BLOCK_BITS (SUPERBLOCK) * 2));
-  if (mapblock1 != 3
-      && !ext2_rdfsb (INODE->i_block[EXT2_TIND_BLOCK], DATABLOCK1))
+  else if ((logical_block -= mask + 1) < (1 << (bits * 2)))
     {
-      errnum = ERR_FSYS_CORRUPT;
-      return -1;
+      bnum = INODE->i_block[EXT2_DIND_BLOCK];
+      level = 2;
     }
-  mapblock1 = 3;
-  if (!ext2_rdfsb (((__u32 *) DATABLOCK1)
-		   [logical_block >> (EXT2_ADDR_PER_BLOCK_BITS (SUPERBLOCK)
-				      * 2)],
-		   DATABLOCK2))
+  else
     {
-      errnum = ERR_FSYS_CORRUPT;
-      return -1;
+      logical_block -= 1 << (bits * 2);
+      bnum = INODE->i_block[EXT2_TIND_BLOCK];
+      level = 3;
     }
-  if (!ext2_rdfsb (((__u32 *) DATABLOCK2)
-		   [(logical_block >> EXT2_ADDR_PER_BLOCK_BITS (SUPERBLOCK))
-		    & (EXT2_ADDR_PER_BLOCK (SUPERBLOCK) - 1)],
-		   DATABLOCK2))
+
+  for (; level > 0; level--)
     {
-      errnum = ERR_FSYS_CORRUPT;
-      return -1;
+      /* a hole of whole blocks of addresses */
+      if (!bnum)
+	{
+	  if (run)
+	    *run = 1;
+	  return 0;
+	}
+      if (!(entries = ext2_indirect (bnum)))
+	return -1;
+      index = (logical_block >> (bits * (level - 1))) & mask;
+      bnum = entries[index];
     }
-  return ((__u32 *) DATABLOCK2)
-    [logical_block & (EXT2_ADDR_PER_BLOCK (SUPERBLOCK) - 1)];
+
+  if (run)
+    *run = ext2fs_run (entries + index, mask + 1 - index);
+  return bnum;
 }
 
 /* extent binary search index
@@ -574,15 +680,21 @@ ext4_ext_binsearch(struct ext4_extent_header* eh, int logical_block)
 
 /* Maps extents enabled logical block into physical block via an inode. 
  * EXT4_HUGE_FILE_FL should be checked before calling this.
+ * If RUN is not NULL, the number of blocks left in the extent is stored
+ * there.
+ * Lookups within the extent found last take no walk at all, and the
+ * walk reads only the nodes that are not on the path of the last one.
+ * Holes and uninitialized extents map to block 0.
  */
 static int
-ext4fs_block_map (int logical_block)
+ext4fs_block_map (int logical_block, int *run)
 {
   struct ext4_extent_header *eh;
-  struct ext4_extent *ex, *extent;
-  struct ext4_extent_idx *ei, *index;
-  int depth;
-  int i;
+  struct ext4_extent *ex;
+  struct ext4_extent_idx *ei;
+  int node;
+  int level;
+  int len;
 
 #ifdef E2DEBUG
   unsigned char *i;
@@ -603,47 +715,81 @@ ext4fs_block_map (int logical_block)
     }
   printf ("logical block %d\n", logical_block);
 #endif /* E2DEBUG */
+  if ((unsigned) (logical_block - ext4_ext_block) < ext4_ext_len)
+    goto found;
+
   eh = (struct ext4_extent_header*)INODE->i_block;
   if (eh->eh_magic != EXT4_EXT_MAGIC)
   {
           errnum = ERR_FSYS_CORRUPT;
           return -1;
   }
-  while((depth = eh->eh_depth) != 0)
+  for (level = 1; eh->eh_depth != 0; level++)
   	{ /* extent index */
-	  if (eh->eh_magic != EXT4_EXT_MAGIC)
-	  {
-	          errnum = ERR_FSYS_CORRUPT;
-		  return -1;
-	  }
+	  if (level > EXT4_MAX_DEPTH || !eh->eh_entries)
+	{
+	  errnum = ERR_FSYS_CORRUPT;
+	  return -1;
+	}
 	  ei = ext4_ext_binsearch_idx(eh, logical_block);
 	  if (ei->ei_leaf_hi)
 	{/* 64bit physical block number not supported */
 	  errnum = ERR_FILELENGTH;
 	  return -1;
 	}
-	  if (!ext2_rdfsb(ei->ei_leaf_lo, DATABLOCK1))
+	  /* deeper levels than fit are read into DATABLOCK1 each time */
+	  node = EXT4_NODE_FITS (level) ? EXT4_NODE (level) : DATABLOCK1;
+	  if (node == DATABLOCK1 || ext4_node[level] != ei->ei_leaf_lo)
 	{
-	  errnum = ERR_FSYS_CORRUPT;
-	  return -1;
+	  if (node == DATABLOCK1)
+	    ind_block[0] = 0;
+	  ext4_node[level] = 0;
+	  if (!ext2_rdfsb(ei->ei_leaf_lo, node))
+	    {
+	      errnum = ERR_FSYS_CORRUPT;
+	      return -1;
+	    }
+	  if (node != DATABLOCK1)
+	    ext4_node[level] = ei->ei_leaf_lo;
 	}
-	  eh = (struct ext4_extent_header*)DATABLOCK1;
+	  eh = (struct ext4_extent_header*)node;
+	  if (eh->eh_magic != EXT4_EXT_MAGIC)
+	  {
+	          errnum = ERR_FSYS_CORRUPT;
+		  return -1;
+	  }
   	}
 
   /* depth==0, we come to the leaf */
+  if (!eh->eh_entries)
+    goto hole;
   ex = ext4_ext_binsearch(eh, logical_block);
   if (ex->ee_start_hi) 
 	{/* 64bit physical block number not supported */
 	  errnum = ERR_FILELENGTH;
 	  return -1;
 	}
-  if ((ex->ee_block + ex->ee_len) < logical_block)
-	{
-	  errnum = ERR_FSYS_CORRUPT;
-	  return -1;
-	}
-  return ex->ee_start_lo + logical_block - ex->ee_block;
-
+  len = ex->ee_len;
+  if (len > EXT_INIT_MAX_LEN)
+    len -= EXT_INIT_MAX_LEN;
+  if ((unsigned) (logical_block - ex->ee_block) >= len)
+    goto hole;
+
+  ext4_ext_block = ex->ee_block;
+  ext4_ext_len = len;
+  ext4_ext_start = (ex->ee_len > EXT_INIT_MAX_LEN) ? 0 : ex->ee_start_lo;
+
+ found:
+  if (run)
+    *run = ext4_ext_block + ext4_ext_len - logical_block;
+  if (!ext4_ext_start)
+    return 0;
+  return ext4_ext_start + logical_block - ext4_ext_block;
+
+ hole:
+  if (run)
+    *run = 1;
+  return 0;
 }
 
 /* preconditions: all preconds of ext2fs_block_map */
@@ -653,6 +799,7 @@ ext2fs_read (char *buf, int len)
   int logical_block;
   int offset;
   int map;
+  int run;
   int ret = 0;
   int size = 0;
 
@@ -683,16 +830,23 @@ ext2fs_read (char *buf, int len)
       /* map extents enabled logical block number to physical fs on-dick block number */
       if (EXT4_HAS_INCOMPAT_FEATURE(SUPERBLOCK,EXT4_FEATURE_INCOMPAT_EXTENTS) 
                     && INODE->i_flags & EXT4_EXTENTS_FL)
-          map = ext4fs_block_map (logical_block);
+          map = ext4fs_block_map (logical_block, &run);
       else
-      map = ext2fs_block_map (logical_block);
+      map = ext2fs_block_map (logical_block, &run);
 #ifdef E2DEBUG
-      printf ("map=%d\n", map);
+      printf ("map=%d run=%d\n", map, run);
 #endif /* E2DEBUG */
       if (map < 0)
 	break;
 
-      size = EXT2_BLOCK_SIZE (SUPERBLOCK);
+      /* read the blocks that follow each other on the disk at once */
+      if (map == 0)
+	run = 1;
+      else if (run > ((len + offset + EXT2_BLOCK_SIZE (SUPERBLOCK) - 1)
+		      >> EXT2_BLOCK_SIZE_BITS (SUPERBLOCK)))
+	run = ((len + offset + EXT2_BLOCK_SIZE (SUPERBLOCK) - 1)
+	       >> EXT2_BLOCK_SIZE_BITS (SUPERBLOCK));
+      size = run << EXT2_BLOCK_SIZE_BITS (SUPERBLOCK);
       size -= offset;
       if (size > len)
 	size = len;
@@ -752,6 +906,258 @@ int ext2_is_fast_symlink (void)
   return INODE->i_blocks == ea_blocks;
 }
 
+#ifndef STAGE1_5
+/* lib/ext2fs/dirhash.c */
+#define DX_F(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define DX_G(x, y, z) (((x) & (y)) + (((x) ^ (y)) & (z)))
+#define DX_H(x, y, z) ((x) ^ (y) ^ (z))
+#define DX_ROUND(f, a, b, c, d, x, s) \
+    (a += f (b, c, d) + (x), a = (a << s) | (a >> (32 - s)))
+#define DX_K2 013240474631UL
+#define DX_K3 015666365641UL
+
+/* the half MD4 transform, 24 rounds instead of 48 */
+static void
+dx_half_md4 (__u32 buf[4], __u32 *in)
+{
+  __u32 a = buf[0], b = buf[1], c = buf[2], d = buf[3];
+
+  DX_ROUND (DX_F, a, b, c, d, in[0], 3);
+  DX_ROUND (DX_F, d, a, b, c, in[1], 7);
+  DX_ROUND (DX_F, c, d, a, b, in[2], 11);
+  DX_ROUND (DX_F, b, c, d, a, in[3], 19);
+  DX_ROUND (DX_F, a, b, c, d, in[4], 3);
+  DX_ROUND (DX_F, d, a, b, c, in[5], 7);
+  DX_ROUND (DX_F, c, d, a, b, in[6], 11);
+  DX_ROUND (DX_F, b, c, d, a, in[7], 19);
+
+  DX_ROUND (DX_G, a, b, c, d, in[1] + DX_K2, 3);
+  DX_ROUND (DX_G, d, a, b, c, in[3] + DX_K2, 5);
+  DX_ROUND (DX_G, c, d, a, b, in[5] + DX_K2, 9);
+  DX_ROUND (DX_G, b, c, d, a, in[7] + DX_K2, 13);
+  DX_ROUND (DX_G, a, b, c, d, in[0] + DX_K2, 3);
+  DX_ROUND (DX_G, d, a, b, c, in[2] + DX_K2, 5);
+  DX_ROUND (DX_G, c, d, a, b, in[4] + DX_K2, 9);
+  DX_ROUND (DX_G, b, c, d, a, in[6] + DX_K2, 13);
+
+  DX_ROUND (DX_H, a, b, c, d, in[3] + DX_K3, 3);
+  DX_ROUND (DX_H, d, a, b, c, in[7] + DX_K3, 9);
+  DX_ROUND (DX_H, c, d, a, b, in[2] + DX_K3, 11);
+  DX_ROUND (DX_H, b, c, d, a, in[6] + DX_K3, 15);
+  DX_ROUND (DX_H, a, b, c, d, in[1] + DX_K3, 3);
+  DX_ROUND (DX_H, d, a, b, c, in[5] + DX_K3, 9);
+  DX_ROUND (DX_H, c, d, a, b, in[0] + DX_K3, 11);
+  DX_ROUND (DX_H, b, c, d, a, in[4] + DX_K3, 15);
+
+  buf[0] += a;
+  buf[1] += b;
+  buf[2] += c;
+  buf[3] += d;
+}
+
+/* the TEA transform, 16 cycles */
+static void
+dx_tea (__u32 buf[4], __u32 *in)
+{
+  __u32 sum = 0, b0 = buf[0], b1 = buf[1];
+  int n;
+
+  for (n = 0; n < 16; n++)
+    {
+      sum += 0x9E3779B9;
+      b0 += ((b1 << 4) + in[0]) ^ (b1 + sum) ^ ((b1 >> 5) + in[1]);
+      b1 += ((b0 << 4) + in[2]) ^ (b0 + sum) ^ ((b0 >> 5) + in[3]);
+    }
+  buf[0] += b0;
+  buf[1] += b1;
+}
+
+/* Packs up to NUM * 4 chars of the LEN of NAME into NUM words of BUF,
+   padded with the length. */
+static void
+dx_str2hashbuf (const char *name, int len, __u32 *buf, int num, int unsigned_chars)
+{
+  __u32 pad, val;
+  int i, c;
+
+  pad = (__u32) len | ((__u32) len << 8);
+  pad |= pad << 16;
+  val = pad;
+  if (len > num * 4)
+    len = num * 4;
+  for (i = 0; i < len; i++)
+    {
+      c = unsigned_chars ? (unsigned char) name[i] : (signed char) name[i];
+      val = c + (val << 8);
+      if ((i % 4) == 3)
+	{
+	  *buf++ = val;
+	  val = pad;
+	  num--;
+	}
+    }
+  if (--num >= 0)
+    *buf++ = val;
+  while (--num >= 0)
+    *buf++ = pad;
+}
+
+/* Returns the hash of the LEN chars of NAME in VERSION (DX_HASH_*, plus
+   DX_HASH_UNSIGNED for unsigned chars), or 1, which no name has, if
+   VERSION is unknown. */
+static __u32
+dx_hash (const char *name, int len, int version)
+{
+  __u32 buf[4], in[8], hash, hash0 = 0x12a3fe2d, hash1 = 0x37abe8f9;
+  int unsigned_chars = version >= DX_HASH_UNSIGNED;
+  int i, c;
+
+  buf[0] = 0x67452301;
+  buf[1] = 0xefcdab89;
+  buf[2] = 0x98badcfe;
+  buf[3] = 0x10325476;
+  for (i = 0; i < 4; i++)
+    if (SUPERBLOCK->s_hash_seed[i])
+      break;
+  if (i < 4)
+    memmove ((char *) buf, (char *) SUPERBLOCK->s_hash_seed, sizeof (buf));
+
+  switch (version % DX_HASH_UNSIGNED)
+    {
+    case DX_HASH_LEGACY:
+      for (i = 0; i < len; i++)
+	{
+	  c = unsigned_chars ? (unsigned char) name[i] : (signed char) name[i];
+	  hash = hash1 + (hash0 ^ (c * 7152373));
+	  if (hash & 0x80000000)
+	    hash -= 0x7fffffff;
+	  hash1 = hash0;
+	  hash0 = hash;
+	}
+      hash = hash0 << 1;
+      break;
+    case DX_HASH_HALF_MD4:
+      for (i = 0; i < len; i += 32)
+	{
+	  dx_str2hashbuf (name + i, len - i, in, 8, unsigned_chars);
+	  dx_half_md4 (buf, in);
+	}
+      hash = buf[1];
+      break;
+    case DX_HASH_TEA:
+      for (i = 0; i < len; i += 16)
+	{
+	  dx_str2hashbuf (name + i, len - i, in, 4, unsigned_chars);
+	  dx_tea (buf, in);
+	}
+      hash = buf[0];
+      break;
+    default:
+      return 1;
+    }
+
+  hash &= ~1;
+  /* the end of the directory for 32-bit readdir cookies */
+  if (hash == 0x7fffffffU << 1)
+    hash = (0x7fffffffU - 1) << 1;
+  return hash;
+}
+
+/* Reads the logical block BLK of the directory in INODE into DATABLOCK2. */
+static int
+ext2_rddirblk (int blk)
+{
+  int map;
+
+  if (EXT4_HAS_INCOMPAT_FEATURE(SUPERBLOCK,EXT4_FEATURE_INCOMPAT_EXTENTS)
+      && INODE->i_flags & EXT4_EXTENTS_FL)
+    map = ext4fs_block_map (blk, NULL);
+  else
+    map = ext2fs_block_map (blk, NULL);
+  return map > 0 && ext2_rdfsb (map, DATABLOCK2);
+}
+
+/* Looks NAME up through the hashed index of the directory in INODE.
+ * Returns the inode number, or 0 if the index does not lead to NAME: if
+ * the name is not there, if the index is of an unknown kind or broken,
+ * or if NAME shares its hash with names in the leaf after its own. The
+ * caller then scans the whole directory, so that the index never hides
+ * a name a scan would find.
+ */
+static int
+ext2_dx_lookup (char *name)
+{
+  struct dx_root_info *info;
+  struct dx_countlimit *cl;
+  struct dx_entry *entries, *l, *r, *m;
+  struct ext2_dir_entry *dp;
+  int len = grub_strlen (name);
+  int bsize = EXT2_BLOCK_SIZE (SUPERBLOCK);
+  int version, levels, off;
+  __u32 hash;
+
+  if (!(SUPERBLOCK->s_feature_compat & EXT2_FEATURE_COMPAT_DIR_INDEX)
+      || !(INODE->i_flags & EXT2_INDEX_FL)
+      || !ext2_rddirblk (0))
+    return 0;
+
+  info = (struct dx_root_info *) (DATABLOCK2 + DX_ROOT_INFO_OFFSET);
+  if (info->reserved_zero || info->indirect_levels >= DX_MAX_LEVELS)
+    return 0;
+  version = info->hash_version;
+  if (version <= DX_HASH_TEA
+      && (SUPERBLOCK->s_flags & EXT2_FLAGS_UNSIGNED_HASH))
+    version += DX_HASH_UNSIGNED;
+  hash = dx_hash (name, len, version);
+  if (hash & 1)
+    return 0;
+
+  /* from the root down through the nodes, to the leaf for HASH */
+  off = DX_ROOT_INFO_OFFSET + info->info_length;
+  for (levels = info->indirect_levels; ; levels--)
+    {
+      entries = (struct dx_entry *) (DATABLOCK2 + off);
+      cl = (struct dx_countlimit *) entries;
+      if (!cl->count || cl->count > cl->limit
+	  || off + cl->limit * sizeof (struct dx_entry) > bsize)
+	return 0;
+
+      /* the last entry with a hash not above HASH */
+      l = entries + 1;
+      r = entries + cl->count - 1;
+      while (l <= r)
+	{
+	  m = l + (r - l) / 2;
+	  if (m->hash > hash)
+	    r = m - 1;
+	  else
+	    l = m + 1;
+	}
+      m = l - 1;
+      /* names of the same hash go on in the next leaf */
+      if (l < entries + cl->count && (l->hash & ~1) == hash)
+	return 0;
+
+      if (!ext2_rddirblk (m->block & 0x0fffffff))
+	return 0;
+      if (!levels)
+	break;
+      off = DX_NODE_OFFSET;
+    }
+
+  for (off = 0; off < bsize; off += dp->rec_len)
+    {
+      dp = (struct ext2_dir_entry *) (DATABLOCK2 + off);
+      if (dp->rec_len < 12 || off + dp->rec_len > bsize)
+	return 0;
+      if (dp->inode && dp->name_len == len
+	  && !grub_memcmp (dp->name, name, len))
+	return dp->inode;
+    }
+  return 0;
+}
+#endif /* ! STAGE1_5 */
+
 /* preconditions: ext2fs_mount already executed, therefore supblk in buffer
  *   known as SUPERBLOCK
  * returns: 0 if error, nonzero iff we were able to find the file successfully
@@ -786,6 +1192,17 @@ ext2fs_dir (char *dirname)
 #ifdef E2DEBUG
   unsigned char *i;
 #endif	/* E2DEBUG */
+#ifndef STAGE1_5
+  char *path = dirname;		/* the whole name, for the dentry cache */
+  int dentry[2];		/* current_ino and updir_ino */
+
+  /* start below the longest directory resolved before */
+  dentry[0] = current_ino;
+  dentry[1] = updir_ino;
+  dirname = dentry_cache_lookup (path, dentry, sizeof (dentry));
+  current_ino = dentry[0];
+  updir_ino = dentry[1];
+#endif /* ! STAGE1_5 */
 
   /* loop invariants:
      current_ino = inode to lookup
@@ -800,6 +1217,16 @@ ext2fs_dir (char *dirname)
       printf ("dirname=%s\n", dirname);
 #endif /* E2DEBUG */
 
+#ifndef STAGE1_5
+      /* remember where the name has led so far, unless through a link */
+      if (!link_count)
+	{
+	  dentry[0] = current_ino;
+	  dentry[1] = updir_ino;
+	  dentry_cache_insert (path, dirname, dentry, sizeof (dentry));
+	}
+#endif /* ! STAGE1_5 */
+
       /* look up an inode */
       group_id = (current_ino - 1) / (SUPERBLOCK->s_inodes_per_group);
       group_desc = group_id >> log2 (EXT2_DESC_PER_BLOCK (SUPERBLOCK));
@@ -835,7 +1262,7 @@ ext2fs_dir (char *dirname)
 	}
 
       /* reset indirect blocks! */
-      mapblock2 = mapblock1 = -1;
+      map_reset ();
 
       raw_inode = (struct ext2_inode *)((char *)INODE +
 	((current_ino - 1) & (EXT2_INODES_PER_BLOCK (SUPERBLOCK) - 1)) *
@@ -985,6 +1412,22 @@ ext2fs_dir (char *dirname)
       *rest = 0;
       loc = 0;
 
+#ifndef STAGE1_5
+      /* a hashed index finds the name without a scan, but completions
+	 need all the names */
+      if (!print_possibilities && *dirname)
+	{
+	  if ((map = ext2_dx_lookup (dirname)) > 0)
+	    {
+	      current_ino = map;
+	      *(dirname = rest) = ch;
+	      continue;
+	    }
+	  /* scan the directory instead */
+	  errnum = ERR_NONE;
+	}
+#endif /* ! STAGE1_5 */
+
       do
 	{
 
@@ -1020,13 +1463,12 @@ ext2fs_dir (char *dirname)
 	  /* map extents enabled logical block number to physical fs on-dick block number */
 	  if (EXT4_HAS_INCOMPAT_FEATURE(SUPERBLOCK,EXT4_FEATURE_INCOMPAT_EXTENTS) 
                         && INODE->i_flags & EXT4_EXTENTS_FL)
-              map = ext4fs_block_map (blk);
+              map = ext4fs_block_map (blk, NULL);
 	  else
-	  map = ext2fs_block_map (blk);
+	  map = ext2fs_block_map (blk, NULL);
 #ifdef E2DEBUG
 	  printf ("fs block=%d\n", map);
 #endif /* E2DEBUG */
-	  mapblock2 = -1;
 	  if (map < 0) 
 	  {
 	      *rest = ch;
@@ -296,6 +296,8 @@ fat_dir (char *dirname)
   int attrib = FAT_ATTRIB_DIR;
 #ifndef STAGE1_5
   int do_possibilities = 0;
+  char *path = dirname;		/* the whole name, for the dentry cache */
+  int dentry[3];		/* the cluster, attributes and length */
 #endif
   
   /* XXX I18N:
@@ -310,9 +312,28 @@ fat_dir (char *dirname)
   filepos = 0;
   FAT_SUPER->current_cluster_num = MAXINT;
   
+#ifndef STAGE1_5
+  /* start below the longest directory resolved before */
+  dentry[0] = FAT_SUPER->file_cluster;
+  dentry[1] = attrib;
+  dentry[2] = filemax;
+  dirname = dentry_cache_lookup (path, dentry, sizeof (dentry));
+  FAT_SUPER->file_cluster = dentry[0];
+  attrib = dentry[1];
+  filemax = dentry[2];
+#endif
+  
   /* main loop to find desired directory entry */
  loop:
   
+#ifndef STAGE1_5
+  /* remember where the name has led so far */
+  dentry[0] = FAT_SUPER->file_cluster;
+  dentry[1] = attrib;
+  dentry[2] = filemax;
+  dentry_cache_insert (path, dirname, dentry, sizeof (dentry));
+#endif
+  
   /* if we have a real file (and we're not just printing possibilities),
      then this is where we want to exit */
   
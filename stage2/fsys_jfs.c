@@ -42,6 +42,13 @@ struct jfs_info
 	int dttype;
 	xad_t *xad;
 	ldtentry_t *de;
+	/* The extent cursor of jfs_read: the extent it is in, and the end
+	   of the one before */
+	int xvalid;
+	s64 xoff;
+	s64 xlen;
+	s64 xaddr;
+	s64 xprev;
 };
 
 static struct jfs_info jfs;
@@ -73,6 +80,8 @@ first_extent (dinode_t *di)
 	jfs.xad = &xtp->xad[2];
 	if (xtp->header.flag & BT_LEAF) {
 	    	jfs.xlastindex = xtp->header.nextindex;
+		/* No page of the tree follows the root in the inode */
+		xtpage->header.next = 0;
 	} else {
 		do {
 			devread (addressXAD (jfs.xad) << jfs.bdlog, 0,
@@ -114,6 +123,7 @@ di_read (u32 inum, dinode_t *di)
 	key = (((inum >> L2INOSPERIAG) << L2INOSPERIAG) + 4096) >> jfs.l2bsize;
 	xd = (inum & (INOSPERIAG - 1)) >> L2INOSPEREXT;
 	ioffset = ((inum & (INOSPERIAG - 1)) & (INOSPEREXT - 1)) << L2DISIZE;
+	jfs.xvalid = 0;
 	xad = first_extent (fileset);
 	do {
 		offset = offsetXAD (xad);
@@ -224,47 +234,71 @@ jfs_mount (void)
 	return 1;
 }
 
+/* Move the extent cursor of jfs_read to XAD, or past the last extent */
+static void
+set_cursor (xad_t *xad)
+{
+	if (xad) {
+		jfs.xoff = offsetXAD (xad);
+		jfs.xlen = lengthXAD (xad);
+		jfs.xaddr = addressXAD (xad);
+	} else {
+		jfs.xoff = (1ULL << 62) - 1;
+		jfs.xlen = 0;
+	}
+}
+
+/* The bytes from filepos up to block END of the file, but no further
+   than ENDPOS */
+static int
+bytes_to (s64 end, int endpos)
+{
+	if (end > (s64)(endpos - 1) >> jfs.l2bsize)
+		return endpos - filepos;
+	return (end << jfs.l2bsize) - filepos;
+}
+
 int
 jfs_read (char *buf, int len)
 {
 	xad_t *xad;
-	s64 endofprev, endofcur;
-	s64 offset, xadlen;
+	s64 block;
 	int toread, startpos, endpos;
 
 	startpos = filepos;
 	endpos = filepos + len;
-	endofprev = (1ULL << 62) - 1;
-	xad = first_extent (inode);
-	do {
-		offset = offsetXAD (xad);
-		xadlen = lengthXAD (xad);
-		if (isinxt (filepos >> jfs.l2bsize, offset, xadlen)) {
-			endofcur = (offset + xadlen) << jfs.l2bsize; 
-			toread = (endofcur >= endpos)
-				  ? len : (endofcur - filepos);
 
-			disk_read_func = disk_read_hook;
-			devread (addressXAD (xad) << jfs.bdlog,
-				 filepos - (offset << jfs.l2bsize), toread, buf);
-			disk_read_func = NULL;
+	/* Go on from the extent the last read ended in, unless filepos lies
+	   before it and the hole in front of it */
+	if (!jfs.xvalid || (filepos >> jfs.l2bsize) < jfs.xprev) {
+		xad = first_extent (inode);
+		set_cursor ((jfs.xindex < jfs.xlastindex) ? xad : NULL);
+		jfs.xprev = 0;
+		jfs.xvalid = 1;
+	}
 
-			buf += toread;
-			len -= toread;
-			filepos += toread;
-		} else if (offset > endofprev) {
-			toread = ((offset << jfs.l2bsize) >= endpos)
-				  ? len : ((offset - endofprev) << jfs.l2bsize);
-			len -= toread;
-			filepos += toread;
-			for (; toread; toread--) {
-				*buf++ = 0;
-			}
+	while (len > 0) {
+		block = filepos >> jfs.l2bsize;
+		if (block >= jfs.xoff + jfs.xlen) {
+			jfs.xprev = jfs.xoff + jfs.xlen;
+			set_cursor (next_extent ());
 			continue;
 		}
-		endofprev = offset + xadlen; 
-		xad = next_extent ();
-	} while (len > 0 && xad);
+
+		if (block < jfs.xoff) {
+			toread = bytes_to (jfs.xoff, endpos);
+			memset (buf, 0, toread);
+		} else {
+			toread = bytes_to (jfs.xoff + jfs.xlen, endpos);
+			disk_read_func = disk_read_hook;
+			devread (jfs.xaddr << jfs.bdlog,
+				 filepos - (jfs.xoff << jfs.l2bsize), toread, buf);
+			disk_read_func = NULL;
+		}
+		buf += toread;
+		len -= toread;
+		filepos += toread;
+	}
 
 	return filepos - startpos;
 }
@@ -280,10 +314,30 @@ jfs_dir (char *dirname)
 	u32 di_mode;
 	int namlen, cmp, n, link_count;
 	char namebuf[JFS_NAME_MAX + 1], linkbuf[JFS_PATH_MAX];
+#ifndef STAGE1_5
+	char *path = dirname;
+	u32 dentry[2];
+#endif
 
 	parent_inum = inum = ROOT_I;
 	link_count = 0;
+#ifndef STAGE1_5
+	/* Start below the longest directory resolved before */
+	dentry[0] = inum;
+	dentry[1] = parent_inum;
+	dirname = dentry_cache_lookup (path, dentry, sizeof (dentry));
+	inum = dentry[0];
+	parent_inum = dentry[1];
+#endif
 	for (;;) {
+#ifndef STAGE1_5
+		/* Remember where the name has led so far, unless through a link */
+		if (!link_count) {
+			dentry[0] = inum;
+			dentry[1] = parent_inum;
+			dentry_cache_insert (path, dirname, dentry, sizeof (dentry));
+		}
+#endif
 		di_read (inum, inode);
 		di_size = inode->di_size;
 		di_mode = inode->di_mode;
@@ -998,6 +998,8 @@ reiserfs_dir (char *dirname)
   __u32 dir_id, objectid, parent_dir_id = 0, parent_objectid = 0;
 #ifndef STAGE1_5
   int do_possibilities = 0;
+  char *path = dirname;		/* the whole name, for the dentry cache */
+  __u32 dentry[4];
 #endif /* ! STAGE1_5 */
   char linkbuf[PATH_MAX];	/* buffer for following symbolic links */
   int link_count = 0;
@@ -1005,12 +1007,37 @@ reiserfs_dir (char *dirname)
 
   dir_id = REISERFS_ROOT_PARENT_OBJECTID;
   objectid = REISERFS_ROOT_OBJECTID;
+
+#ifndef STAGE1_5
+  /* Start below the longest directory resolved before.  */
+  dentry[0] = dir_id;
+  dentry[1] = objectid;
+  dentry[2] = parent_dir_id;
+  dentry[3] = parent_objectid;
+  dirname = dentry_cache_lookup (path, dentry, sizeof (dentry));
+  dir_id = dentry[0];
+  objectid = dentry[1];
+  parent_dir_id = dentry[2];
+  parent_objectid = dentry[3];
+#endif /* ! STAGE1_5 */
   
   while (1)
     {
 #ifdef REISERDEBUG
       printf ("dirname=%s\n", dirname);
 #endif /* REISERDEBUG */
+
+#ifndef STAGE1_5
+      /* Remember where the name has led so far, unless through a link.  */
+      if (! link_count)
+	{
+	  dentry[0] = dir_id;
+	  dentry[1] = objectid;
+	  dentry[2] = parent_dir_id;
+	  dentry[3] = parent_objectid;
+	  dentry_cache_insert (path, dirname, dentry, sizeof (dentry));
+	}
+#endif /* ! STAGE1_5 */
       
       /* Search for the stat info first. */
       if (! search_stat (dir_id, objectid))
@@ -55,7 +55,13 @@ struct xfs_info {
 	int dirmax;
 	int blkoff;
 	int fpos;
+	xfs_bmbt_rec_32_t *xtend;
 	xfs_ino_t rootino;
+	/* The extent cursor of xfs_read: the extent it is in, and the end
+	   of the one before */
+	int xvalid;
+	xad_t xad;
+	xfs_fileoff_t xprev;
 };
 
 static struct xfs_info xfs;
@@ -214,6 +220,7 @@ di_read (xfs_ino_t ino)
 	daddr = agb2daddr (agno, agbno);
 
 	devread (daddr, offset*xfs.isize, xfs.isize, (char *)inode);
+	xfs.xvalid = 0;
 
 	xfs.ptr0 = *(xfs_bmbt_ptr_t *)
 		    (inode->di_u.di_c + sizeof(xfs_bmdr_block_t)
@@ -222,12 +229,20 @@ di_read (xfs_ino_t ino)
 	return 1;
 }
 
+static xfs_daddr_t
+rightsib (xfs_btree_lblock_t *h)
+{
+	return (h->bb_rightsib == (xfs_dfsbno_t)-1)
+		? 0 : fsb2daddr (le64(h->bb_rightsib));
+}
+
 static void
 init_extents (void)
 {
 	xfs_bmbt_ptr_t ptr0;
 	xfs_btree_lblock_t h;
 
+	xfs.xvalid = 0;
 	switch (icore.di_format) {
 	case XFS_DINODE_FMT_EXTENTS:
 		xfs.xt = inode->di_u.di_bmx;
@@ -241,8 +256,9 @@ init_extents (void)
 				 sizeof(xfs_btree_lblock_t), (char *)&h);
 			if (!h.bb_level) {
 				xfs.nextents = le16(h.bb_numrecs);
-				xfs.next = fsb2daddr (le64(h.bb_rightsib));
+				xfs.next = rightsib (&h);
 				xfs.fpos = sizeof(xfs_btree_block_t);
+				xfs.xt = xfs.xtend = NULL;
 				return;
 			}
 			devread (xfs.daddr, xfs.btnode_ptr0_off,
@@ -251,10 +267,13 @@ init_extents (void)
 	}
 }
 
+#define XT_PER_FILEBUF	(4096 / sizeof(xfs_bmbt_rec_t))
+
 static xad_t *
 next_extent (void)
 {
 	static xad_t xad;
+	int n;
 
 	switch (icore.di_format) {
 	case XFS_DINODE_FMT_EXTENTS:
@@ -269,13 +288,19 @@ next_extent (void)
 			xfs.daddr = xfs.next;
 			devread (xfs.daddr, 0, sizeof(xfs_btree_lblock_t), (char *)&h);
 			xfs.nextents = le16(h.bb_numrecs);
-			xfs.next = fsb2daddr (le64(h.bb_rightsib));
+			xfs.next = rightsib (&h);
 			xfs.fpos = sizeof(xfs_btree_block_t);
 		}
-		/* Yeah, I know that's slow, but I really don't care */
-		devread (xfs.daddr, xfs.fpos, sizeof(xfs_bmbt_rec_t), filebuf);
-		xfs.xt = (xfs_bmbt_rec_32_t *)filebuf;
-		xfs.fpos += sizeof(xfs_bmbt_rec_32_t);
+		/* Read the records of the leaf as many at a time as fit */
+		if (xfs.xt == xfs.xtend) {
+			n = (xfs.nextents < XT_PER_FILEBUF)
+			    ? xfs.nextents : XT_PER_FILEBUF;
+			devread (xfs.daddr, xfs.fpos,
+				 n * sizeof(xfs_bmbt_rec_t), filebuf);
+			xfs.xt = (xfs_bmbt_rec_32_t *)filebuf;
+			xfs.xtend = xfs.xt + n;
+			xfs.fpos += n * sizeof(xfs_bmbt_rec_t);
+		}
 	}
 	xad.offset = xt_offset (xfs.xt);
 	xad.start = xt_start (xfs.xt);
@@ -483,12 +508,23 @@ xfs_mount (void)
 	return 1;
 }
 
+/*
+ * The bytes from filepos up to block END of the file, but no further
+ * than ENDPOS
+ */
+static int
+bytes_to (xfs_fileoff_t end, int endpos)
+{
+	if (end > (xfs_fileoff_t)(endpos - 1) >> xfs.blklog)
+		return endpos - filepos;
+	return (end << xfs.blklog) - filepos;
+}
+
 int
 xfs_read (char *buf, int len)
 {
 	xad_t *xad;
-	xfs_fileoff_t endofprev, endofcur, offset;
-	xfs_filblks_t xadlen;
+	xfs_fileoff_t block;
 	int toread, startpos, endpos;
 
 	if (icore.di_format == XFS_DINODE_FMT_LOCAL) {
@@ -499,35 +535,46 @@ xfs_read (char *buf, int len)
 
 	startpos = filepos;
 	endpos = filepos + len;
-	endofprev = (xfs_fileoff_t)-1;
-	init_extents ();
-	while (len > 0 && (xad = next_extent ())) {
-		offset = xad->offset;
-		xadlen = xad->len;
-		if (isinxt (filepos >> xfs.blklog, offset, xadlen)) {
-			endofcur = (offset + xadlen) << xfs.blklog; 
-			toread = (endofcur >= endpos)
-				  ? len : (endofcur - filepos);
 
-			disk_read_func = disk_read_hook;
-			devread (fsb2daddr (xad->start),
-				 filepos - (offset << xfs.blklog), toread, buf);
-			disk_read_func = NULL;
+	/*
+	 * Go on from the extent the last read ended in, unless filepos
+	 * lies before it and the hole in front of it
+	 */
+	if (!xfs.xvalid || (filepos >> xfs.blklog) < xfs.xprev) {
+		init_extents ();
+		xfs.xvalid = 1;
+		xfs.xad.offset = xfs.xad.len = 0;
+		xfs.xprev = 0;
+	}
 
-			buf += toread;
-			len -= toread;
-			filepos += toread;
-		} else if (offset > endofprev) {
-			toread = ((offset << xfs.blklog) >= endpos)
-				  ? len : ((offset - endofprev) << xfs.blklog);
-			len -= toread;
-			filepos += toread;
-			for (; toread; toread--) {
-				*buf++ = 0;
+	while (len > 0) {
+		block = filepos >> xfs.blklog;
+		if (block >= xfs.xad.offset + xfs.xad.len) {
+			xfs.xprev = xfs.xad.offset + xfs.xad.len;
+			if ((xad = next_extent ())) {
+				xfs.xad = *xad;
+			} else {
+				/* A hole up to the end of the file */
+				xfs.xad.offset = ~(xfs_fileoff_t)0;
+				xfs.xad.len = 0;
 			}
 			continue;
 		}
-		endofprev = offset + xadlen; 
+
+		if (block < xfs.xad.offset) {
+			toread = bytes_to (xfs.xad.offset, endpos);
+			memset (buf, 0, toread);
+		} else {
+			toread = bytes_to (xfs.xad.offset + xfs.xad.len, endpos);
+			disk_read_func = disk_read_hook;
+			devread (fsb2daddr (xfs.xad.start),
+				 filepos - (xfs.xad.offset << xfs.blklog),
+				 toread, buf);
+			disk_read_func = NULL;
+		}
+		buf += toread;
+		len -= toread;
+		filepos += toread;
 	}
 
 	return filepos - startpos;
@@ -542,10 +589,30 @@ xfs_dir (char *dirname)
 	int cmp, n, link_count;
 	char linkbuf[xfs.bsize];
 	char *rest, *name, ch;
+#ifndef STAGE1_5
+	char *path = dirname;
+	xfs_ino_t dentry[2];
+#endif
 
 	parent_ino = ino = xfs.rootino;
 	link_count = 0;
+#ifndef STAGE1_5
+	/* Start below the longest directory resolved before */
+	dentry[0] = ino;
+	dentry[1] = parent_ino;
+	dirname = dentry_cache_lookup (path, dentry, sizeof (dentry));
+	ino = dentry[0];
+	parent_ino = dentry[1];
+#endif
 	for (;;) {
+#ifndef STAGE1_5
+		/* Remember where the name has led so far, unless through a link */
+		if (!link_count) {
+			dentry[0] = ino;
+			dentry[1] = parent_ino;
+			dentry_cache_insert (path, dirname, dentry, sizeof (dentry));
+		}
+#endif
 		di_read (ino);
 		di_size = le64 (icore.di_size);
 		di_mode = le16 (icore.di_mode);
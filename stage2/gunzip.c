@@ -22,6 +22,10 @@
  * by Mark Adler.  It has been very heavily modified.  In particular, the
  * original would run through the whole file at once, and this version can
  * be stopped and restarted on any boundary during the decompression process.
+ * The decoding itself has since been reworked along the lines of zlib's
+ * inflate: the bit buffer is refilled a word at a time from a large input
+ * buffer, the Huffman tables are flat arrays with a root table and
+ * subtables, and matches are copied a word at a time.
  *
  * The license and header comments that file are included here.
  */
@@ -74,7 +78,7 @@
    The Huffman codes themselves are decoded using a mutli-level table
    lookup, in order to maximize the speed of decoding plus the speed of
    building the decoding tables.  See the comments below that precede the
-   lbits and dbits tuning parameters.
+   LBITS and DBITS tuning parameters.
  */
 
 
@@ -152,29 +156,11 @@ static int code_state;
 
 /* Function prototypes */
 static void initialize_tables (void);
-
-/*
- *  Linear allocator.
- */
-
-static unsigned long linalloc_topaddr;
-
-static void *
-linalloc (int size)
-{
-  linalloc_topaddr = (linalloc_topaddr - size) & ~3;
-  return (void *) linalloc_topaddr;
-}
-
-static void
-reset_linalloc (void)
-{
-  linalloc_topaddr = RAW_ADDR ((mbi.mem_upper << 10) + 0x100000);
-}
+static void reset_checkpoints (void);
 
 
 /* internal variable swap function */
-static void
+void
 gunzip_swap_values (void)
 {
   register int itmp;
@@ -319,6 +305,7 @@ gunzip_test_header (void)
   gzip_crc = *((unsigned long *) buf);
   gzip_fsmax = gzip_filemax = *((unsigned long *) (buf + 4));
 
+  reset_checkpoints ();
   initialize_tables ();
 
   compressed_file = 1;
@@ -333,34 +320,36 @@ gunzip_test_header (void)
 }
 
 
-/* Huffman code lookup table entry--this entry is four bytes for machines
-   that have 16-bit pointers (e.g. PC's in the small or medium model).
-   Valid extra bits are 0..13.  e == 15 is EOB (end of block), e == 16
-   means that v is a literal, 16 < e < 32 means that v is a pointer to
-   the next table, which codes e - 16 bits, and lastly e == 99 indicates
-   an unused code.  If a code with e == 99 is looked up, this implies an
-   error in the data. */
-struct huft
+/* Huffman code lookup table entry.  The low bits of the bit buffer index
+   the root table of a code; codes longer than the root table continue in
+   a subtable, which the root entry links to.  OP says what the entry is:
+
+     0		a literal, whose byte is VAL,
+     1..15	a link to a subtable, which starts at entry VAL of the
+		table array and is indexed by the next OP bits,
+     16 + e	a length or distance base VAL with e extra bits,
+     32		the end of block,
+     64		an invalid code, which is an error in the data.
+
+   BITS is the number of bits the entry decodes, not counting the bits
+   of the root table for an entry in a subtable.  */
+struct code
 {
-  uch e;			/* number of extra bits or operation */
-  uch b;			/* number of bits in this code or subcode */
-  union
-    {
-      ush n;			/* literal, length base, or distance base */
-      struct huft *t;		/* pointer to next level of table */
-    }
-  v;
+  uch op;			/* operation, extra bits, table bits */
+  uch bits;			/* bits in this part of the code */
+  ush val;			/* literal, base value, or table offset */
 };
 
+#define OP_LITERAL	0
+#define OP_BASE		16
+#define OP_EOB		32
+#define OP_INVALID	64
+
 
 /* The inflate algorithm uses a sliding 32K byte window on the uncompressed
    stream to find repeated byte strings.  This is implemented here as a
    circular buffer.  The index is updated simply by incrementing and then
    and'ing with 0x7fff (32K-1). */
-/* It is left to other modules to supply the 32K area.  It is assumed
-   to be usable as if it were declared "uch slide[32768];" or as just
-   "uch *slide;" and then malloc'ed in the latter case.  The definition
-   must be in unzip.h, included above. */
 
 
 /* sliding window in uncompressed data */
@@ -387,57 +376,44 @@ static ush cpdist[] =
 {				/* Copy offsets for distance codes 0..29 */
   1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
   257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
-  8193, 12289, 16385, 24577};
+  8193, 12289, 16385, 24577, 0, 0};
 static ush cpdext[] =
 {				/* Extra bits for distance codes */
   0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
   7, 7, 8, 8, 9, 9, 10, 10, 11, 11,
-  12, 12, 13, 13};
+  12, 12, 13, 13, 99, 99};	/* 99==invalid */
 
 
 /*
-   Huffman code decoding is performed using a multi-level table lookup.
-   The fastest way to decode is to simply build a lookup table whose
-   size is determined by the longest code.  However, the time it takes
-   to build this table can also be a factor if the data being decoded
-   is not very long.  The most common codes are necessarily the
-   shortest codes, so those codes dominate the decoding time, and hence
-   the speed.  The idea is you can have a shorter table that decodes the
-   shorter, more probable codes, and then point to subsidiary tables for
-   the longer codes.  The time it costs to decode the longer codes is
-   then traded against the time it takes to make longer tables.
-
-   This results of this trade are in the variables lbits and dbits
-   below.  lbits is the number of bits the first level table for literal/
-   length codes can decode in one step, and dbits is the same thing for
-   the distance codes.  Subsequent tables are also less than or equal to
-   those sizes.  These values may be adjusted either when all of the
-   codes are shorter than that, in which case the longest code length in
-   bits is used, or when the shortest code is *longer* than the requested
-   table size, in which case the length of the shortest code in bits is
-   used.
-
-   There are two different values for the two tables, since they code a
-   different number of possibilities each.  The literal/length table
-   codes 286 possible values, or in a flat code, a little over eight
-   bits.  The distance table codes 30 possible values, or a little less
-   than five bits, flat.  The optimum values for speed end up being
-   about one bit more than those, so lbits is 8+1 and dbits is 5+1.
-   The optimum values may differ though from machine to machine, and
-   possibly even between compilers.  Your mileage may vary.
+   Huffman code decoding is performed using a two-level table lookup.
+   The root table is indexed by the next LBITS resp. DBITS bits of the
+   stream and decodes all codes up to that length in one step.  Each
+   group of longer codes that share the same root bits gets a subtable
+   of its own, which is as small as the lengths of the codes in it
+   allow.  The most common codes are necessarily the shortest codes, so
+   nearly every code is decoded by the root table alone.
+
+   All the tables of a code are built into one array, so they need no
+   pointers and no allocation.  The sizes of the arrays are the largest
+   number of entries any set of code lengths can need for the given
+   root table sizes, which Mark Adler's "enough" program from the zlib
+   distribution found by an exhaustive search.  9 and 6 root bits are
+   one more than the flat codes of the 286 literal/length and the 30
+   distance codes take, as in the original inflate.c.
  */
 
+#define LBITS		9	/* bits in root literal/length table */
+#define DBITS		6	/* bits in root distance table */
+#define ENOUGH_LENS	852	/* entries for LBITS */
+#define ENOUGH_DISTS	592	/* entries for DBITS */
 
-static int lbits = 9;		/* bits in base literal/length lookup table */
-static int dbits = 6;		/* bits in base distance lookup table */
-
-
-/* If BMAX needs to be larger than 16, then h and x[] should be ulg. */
-#define BMAX 16			/* maximum bit length of any code (16 for explode) */
+#define BMAX 15			/* maximum bit length of any code */
 #define N_MAX 288		/* maximum number of codes in any set */
 
-
-static unsigned hufts;		/* track memory usage */
+static struct code lencode[ENOUGH_LENS];	/* literal/length tables */
+static struct code distcode[ENOUGH_DISTS];	/* distance tables */
+static int bl;			/* root bits of lencode */
+static int bd;			/* root bits of distcode */
 
 
 /* Macros for inflate() bit peeking and grabbing.
@@ -453,21 +429,16 @@ static unsigned hufts;		/* track memory usage */
    variables for speed, and are initialized at the beginning of a
    routine that uses these macros from a global bit buffer and count.
 
-   If we assume that EOB will be the longest code, then we will never
-   ask for bits with NEEDBITS that are beyond the end of the stream.
-   So, NEEDBITS should not read any more bytes than are needed to
-   meet the request.  Then no bytes need to be "returned" to the buffer
-   at the end of the last block.
-
-   However, this assumption is not true for fixed blocks--the EOB code
-   is 7 bits, but the other literal/length codes can be 8 or 9 bits.
-   (The EOB code is shorter than other codes because fixed blocks are
-   generally short.  So, while a block always has an EOB, many other
-   literal/length codes have a significantly lower probability of
-   showing up at all.)  However, by making the first table have a
-   lookup of seven bits, the EOB code will be found in that first
-   lookup, and so will not require that too many bits be pulled from
-   the stream.
+   NEEDBITS does not fetch the stream a byte at a time, but loads the
+   next 32-bit word of the input buffer above the bits b already has,
+   and then keeps as many whole bytes of it as fit, which leaves 24 to
+   31 bits in b.  The bits of the partial byte on top are loaded again,
+   at the same place, by the next NEEDBITS, so they need not be cleared
+   and no byte is ever split.  The input buffer always has the word to
+   load: it is refilled when less than that is left, and the 8 bytes of
+   the gzip trailer follow the compressed data, so NEEDBITS never reads
+   past the end of the file, even for a final code that is shorter than
+   the NEEDBITS before it.
  */
 
 static ulg bb;			/* bit buffer */
@@ -480,228 +451,418 @@ static ush mask_bits[] =
   0x01ff, 0x03ff, 0x07ff, 0x0fff, 0x1fff, 0x3fff, 0x7fff, 0xffff
 };
 
-#define NEEDBITS(n) do {while(k<(n)){b|=((ulg)get_byte())<<k;k+=8;}} while (0)
+#define NEEDBITS(n) \
+  do \
+    { \
+      if (k < (unsigned) (n)) \
+	{ \
+	  if (inend - inptr < (int) sizeof (unsigned int)) \
+	    fill_inbuf (); \
+	  b |= (ulg) *((unsigned int *) inptr) << k; \
+	  inptr += (31 - k) >> 3; \
+	  k |= 24; \
+	} \
+    } \
+  while (0)
 #define DUMPBITS(n) do {b>>=(n);k-=(n);} while (0)
 
-#define INBUFSIZ  0x2000
+/* The input buffer is kept in the top INFLATE_MEM_GAP bytes of upper
+   memory, which is left free by the sector cache, so that each refill
+   reads many sectors in one go.  A word past its end is readable too.  */
+#define INBUFSIZ  0x10000
 
-static uch inbuf[INBUFSIZ];
-static int bufloc;
+static uch *inbuf;
+static uch *inptr;		/* next byte in inbuf */
+static uch *inend;		/* end of the data in inbuf */
 
-static int
-get_byte (void)
+static void
+fill_inbuf (void)
 {
-  if (filepos == gzip_data_offset || bufloc == INBUFSIZ)
+  int left = inend - inptr;
+  int len;
+
+  /* Keep the bytes not consumed yet, fewer than a word.  */
+  if (left < 0)
+    left = 0;
+  for (len = 0; len < left; len++)
+    inbuf[len] = inptr[len];
+
+  len = grub_read ((char *) inbuf + left, INBUFSIZ - left);
+  if (len <= 0)
     {
-      bufloc = 0;
-      grub_read (inbuf, INBUFSIZ);
+      /* The compressed data are truncated.  */
+      len = 0;
+      if (! errnum)
+	errnum = ERR_BAD_GZIP_DATA;
     }
 
-  return inbuf[bufloc++];
+  inptr = inbuf;
+  inend = inbuf + left + len;
+  *((unsigned int *) inend) = 0;
 }
 
-/* decompression global pointers */
-static struct huft *tl;		/* literal/length code table */
-static struct huft *td;		/* distance code table */
-static int bl;			/* lookup bits for tl */
-static int bd;			/* lookup bits for td */
-
-
-/* more function prototypes */
-static int huft_build (unsigned *, unsigned, unsigned, ush *, ush *,
-		       struct huft **, int *);
-static int inflate_codes_in_window (void);
-
 
 /* Given a list of code lengths and a maximum table size, make a set of
-   tables to decode that set of codes.  Return zero on success, one if
-   the given code set is incomplete (the tables are still built in this
-   case), two if the input is invalid (all zero length codes or an
-   oversubscribed set of lengths), and three if not enough memory. */
+   tables to decode that set of codes into the SIZE entries of TABLE.
+   Return zero on success, one if the given code set is incomplete,
+   two if the input is invalid (all zero length codes or an
+   oversubscribed set of lengths), and three if TABLE is too small.
+
+   A set of only one code of one bit is complete enough: the other bit
+   value becomes an invalid code.  A set of no codes at all, which a
+   block without matches may send for the distances, becomes a table of
+   invalid codes.  */
 
 static int
-huft_build (unsigned *b,	/* code lengths in bits (all assumed <= BMAX) */
-	    unsigned n,		/* number of codes (assumed <= N_MAX) */
-	    unsigned s,		/* number of simple-valued codes (0..s-1) */
-	    ush * d,		/* list of base values for non-simple codes */
-	    ush * e,		/* list of extra bits for non-simple codes */
-	    struct huft **t,	/* result: starting table */
-	    int *m)		/* maximum lookup bits, returns actual */
+build_table (unsigned *b,	/* code lengths in bits (all assumed <= BMAX) */
+	     unsigned n,	/* number of codes (assumed <= N_MAX) */
+	     unsigned s,	/* number of simple-valued codes (0..s-1) */
+	     ush * d,		/* list of base values for non-simple codes */
+	     ush * e,		/* list of extra bits for non-simple codes */
+	     struct code *table,	/* result: root table and subtables */
+	     unsigned size,	/* number of entries in table */
+	     int *m)		/* maximum root bits, returns actual */
 {
-  unsigned a;			/* counter for codes of length k */
   unsigned c[BMAX + 1];		/* bit length count table */
-  unsigned f;			/* i repeats in table every f entries */
-  int g;			/* maximum code length */
-  int h;			/* table level */
-  register unsigned i;		/* counter, current code */
-  register unsigned j;		/* counter */
-  register int k;		/* number of bits in current code */
-  int l;			/* bits per table (returned in m) */
-  register unsigned *p;		/* pointer into c[], b[], or v[] */
-  register struct huft *q;	/* points to current table */
-  struct huft r;		/* table entry for structure assignment */
-  struct huft *u[BMAX];		/* table stack */
-  unsigned v[N_MAX];		/* values in order of bit length */
-  register int w;		/* bits before this table == (l * h) */
-  unsigned x[BMAX + 1];		/* bit offsets, then code stack */
-  unsigned *xp;			/* pointer into x */
-  int y;			/* number of dummy codes added */
-  unsigned z;			/* number of entries in current table */
+  unsigned x[BMAX + 1];		/* offsets of each length in v[] */
+  ush v[N_MAX];			/* values in order of bit length */
+  unsigned i;			/* counter, current value */
+  unsigned k;			/* number of bits in current code */
+  unsigned g;			/* maximum code length */
+  unsigned root;		/* bits in root table */
+  unsigned huff;		/* current code, bit-reversed */
+  unsigned incr;		/* increment for filling a table */
+  unsigned fill;		/* index for filling a table */
+  unsigned low;			/* root index of the current subtable */
+  unsigned mask;		/* mask for the root index */
+  unsigned curr;		/* bits in the current table */
+  unsigned drop;		/* bits dropped before the current table */
+  unsigned used;		/* entries of table used */
+  int left;			/* code patterns left */
+  struct code r;		/* table entry for structure assignment */
+  struct code *q;		/* current table */
 
   /* Generate counts for each bit length */
   memset ((char *) c, 0, sizeof (c));
-  p = b;
-  i = n;
-  do
-    {
-      c[*p]++;			/* assume all entries <= BMAX */
-      p++;			/* Can't combine with above line (Solaris bug) */
-    }
-  while (--i);
-  if (c[0] == n)		/* null input--all zero length codes */
-    {
-      *t = (struct huft *) NULL;
-      *m = 0;
-      return 0;
-    }
+  for (i = 0; i < n; i++)
+    c[b[i]]++;
 
   /* Find minimum and maximum length, bound *m by those */
-  l = *m;
-  for (j = 1; j <= BMAX; j++)
-    if (c[j])
+  for (g = BMAX; g; g--)
+    if (c[g])
       break;
-  k = j;			/* minimum code length */
-  if ((unsigned) l < j)
-    l = j;
-  for (i = BMAX; i; i--)
-    if (c[i])
+  if (! g)
+    {
+      /* null input--all zero length codes */
+      r.op = OP_INVALID;
+      r.bits = 1;
+      r.val = 0;
+      table[0] = table[1] = r;
+      *m = 1;
+      return 0;
+    }
+  for (k = 1; k < g; k++)
+    if (c[k])
       break;
-  g = i;			/* maximum code length */
-  if ((unsigned) l > i)
-    l = i;
-  *m = l;
-
-  /* Adjust last length count to fill out codes, if needed */
-  for (y = 1 << j; j < i; j++, y <<= 1)
-    if ((y -= c[j]) < 0)
-      return 2;			/* bad input: more codes than bits */
-  if ((y -= c[i]) < 0)
-    return 2;
-  c[i] += y;
-
-  /* Generate starting offsets into the value table for each length */
-  x[1] = j = 0;
-  p = c + 1;
-  xp = x + 2;
-  while (--i)
-    {				/* note that i == g from above */
-      *xp++ = (j += *p++);
+  root = *m;
+  if (root > g)
+    root = g;
+  if (root < k)
+    root = k;
+  *m = root;
+
+  /* Check for an oversubscribed or incomplete set of lengths */
+  left = 1;
+  for (i = 1; i <= BMAX; i++)
+    {
+      left <<= 1;
+      left -= c[i];
+      if (left < 0)
+	return 2;		/* bad input: more codes than bits */
     }
+  if (left > 0 && g != 1)
+    return 1;
 
   /* Make a table of values in order of bit lengths */
-  p = b;
-  i = 0;
-  do
-    {
-      if ((j = *p++) != 0)
-	v[x[j]++] = i;
-    }
-  while (++i < n);
+  x[1] = 0;
+  for (i = 1; i < BMAX; i++)
+    x[i + 1] = x[i] + c[i];
+  for (i = 0; i < n; i++)
+    if (b[i])
+      v[x[b[i]]++] = i;
 
   /* Generate the Huffman codes and for each, make the table entries */
-  x[0] = i = 0;			/* first Huffman code is zero */
-  p = v;			/* grab values in bit order */
-  h = -1;			/* no tables yet--level -1 */
-  w = -l;			/* bits decoded == (l * h) */
-  u[0] = (struct huft *) NULL;	/* just to keep compilers happy */
-  q = (struct huft *) NULL;	/* ditto */
-  z = 0;			/* ditto */
-
-  /* go through the bit lengths (k already is bits in shortest code) */
-  for (; k <= g; k++)
+  huff = 0;			/* first Huffman code is zero */
+  i = 0;			/* grab values in bit order */
+  q = table;			/* start with the root table */
+  curr = root;
+  drop = 0;
+  low = (unsigned) -1;
+  used = 1 << root;
+  mask = used - 1;
+  if (used > size)
+    return 3;
+
+  for (;;)
     {
-      a = c[k];
-      while (a--)
+      /* here huff is the Huffman code of length k bits for value v[i] */
+      r.bits = (uch) (k - drop);
+      if (v[i] < s)
 	{
-	  /* here i is the Huffman code of length k bits for value *p */
-	  /* make tables up to required level */
-	  while (k > w + l)
-	    {
-	      h++;
-	      w += l;		/* previous table always l bits */
-
-	      /* compute minimum size table less than or equal to l bits */
-	      z = (z = g - w) > (unsigned) l ? l : z;	/* upper limit on table size */
-	      if ((f = 1 << (j = k - w)) > a + 1)	/* try a k-w bit table */
-		{		/* too few codes for k-w bit table */
-		  f -= a + 1;	/* deduct codes from patterns left */
-		  xp = c + k;
-		  while (++j < z)	/* try smaller tables up to z bits */
-		    {
-		      if ((f <<= 1) <= *++xp)
-			break;	/* enough codes to use up j bits */
-		      f -= *xp;	/* else deduct codes from patterns */
-		    }
-		}
-	      z = 1 << j;	/* table entries for j-bit table */
-
-	      /* allocate and link in new table */
-	      q = (struct huft *) linalloc ((z + 1) * sizeof (struct huft));
-
-	      hufts += z + 1;	/* track memory usage */
-	      *t = q + 1;	/* link to list for huft_free() */
-	      *(t = &(q->v.t)) = (struct huft *) NULL;
-	      u[h] = ++q;	/* table starts after link */
-
-	      /* connect to last table, if there is one */
-	      if (h)
-		{
-		  x[h] = i;	/* save pattern for backing up */
-		  r.b = (uch) l;	/* bits to dump before this table */
-		  r.e = (uch) (16 + j);		/* bits in this table */
-		  r.v.t = q;	/* pointer to this table */
-		  j = i >> (w - l);	/* (get around Turbo C bug) */
-		  u[h - 1][j] = r;	/* connect to last table */
-		}
-	    }
+	  r.op = v[i] < 256 ? OP_LITERAL : OP_EOB;	/* 256 is end-of-block */
+	  r.val = v[i];
+	}
+      else if (e[v[i] - s] == 99)
+	{
+	  r.op = OP_INVALID;
+	  r.val = 0;
+	}
+      else
+	{
+	  r.op = (uch) (OP_BASE + e[v[i] - s]);
+	  r.val = d[v[i] - s];
+	}
+
+      /* fill code-like entries with r */
+      incr = 1 << (k - drop);
+      fill = 1 << curr;
+      do
+	{
+	  fill -= incr;
+	  q[(huff >> drop) + fill] = r;
+	}
+      while (fill);
 
-	  /* set up table entry in r */
-	  r.b = (uch) (k - w);
-	  if (p >= v + n)
-	    r.e = 99;		/* out of values--invalid code */
-	  else if (*p < s)
+      /* backwards increment the k-bit code huff */
+      for (incr = 1 << (k - 1); huff & incr; incr >>= 1)
+	;
+      huff = incr ? (huff & (incr - 1)) + incr : 0;
+
+      /* go to the next value, and to the next length if needed */
+      i++;
+      if (! --c[k])
+	{
+	  if (k == g)
+	    break;
+	  k = b[v[i]];
+	}
+
+      /* start a new subtable for the codes longer than the root table
+	 that do not share its root index with the last one */
+      if (k > root && (huff & mask) != low)
+	{
+	  if (! drop)
+	    drop = root;
+	  q += 1 << curr;
+
+	  /* compute minimum size table for the codes left */
+	  curr = k - drop;
+	  left = 1 << curr;
+	  while (curr + drop < g)
 	    {
-	      r.e = (uch) (*p < 256 ? 16 : 15);		/* 256 is end-of-block code */
-	      r.v.n = (ush) (*p);	/* simple code is just the value */
-	      p++;		/* one compiler does not like *p++ */
+	      left -= c[curr + drop];
+	      if (left <= 0)
+		break;
+	      curr++;
+	      left <<= 1;
 	    }
+
+	  used += 1 << curr;
+	  if (used > size)
+	    return 3;
+
+	  /* connect to the root table */
+	  low = huff & mask;
+	  table[low].op = (uch) curr;
+	  table[low].bits = (uch) root;
+	  table[low].val = (ush) (q - table);
+	}
+    }
+
+  /* A single code of one bit leaves the other bit value */
+  if (huff)
+    {
+      r.op = OP_INVALID;
+      r.bits = (uch) (k - drop);
+      r.val = 0;
+      q[huff] = r;
+    }
+
+  return 0;
+}
+
+
+/* Copy the LEN bytes DIST bytes back in the window to W.  They must
+   fit below the end of the window.  Return the new window position.  */
+
+static inline unsigned
+copy_match (unsigned w, unsigned dist, unsigned len)
+{
+  unsigned src = (w - dist) & (WSIZE - 1);
+  unsigned e;
+  uch *to, *from;
+
+  while (len)
+    {
+      /* the source may wrap around the end of the window */
+      e = len;
+      if (src > w && e > WSIZE - src)
+	e = WSIZE - src;
+      len -= e;
+
+      to = slide + w;
+      from = slide + src;
+      w += e;
+      src = (src + e) & (WSIZE - 1);
+
+      if (from + 1 == to)
+	{
+	  /* a run of one byte */
+	  unsigned int c = (unsigned int) *from * 0x01010101;
+
+	  for (; e >= 4; e -= 4, to += 4)
+	    *((unsigned int *) to) = c;
+	  while (e--)
+	    *to++ = (uch) c;
+	}
+      else if (from < to && to - from < 4)
+	{
+	  /* purposefully use the overlap for extra copies here!! */
+	  while (e--)
+	    *to++ = *from++;
+	}
+      else
+	{
+	  /* A word at the source is complete before it is read, even
+	     if source and destination overlap, as they are at least a
+	     word apart or the source is ahead.  */
+	  for (; e >= 4; e -= 4, to += 4, from += 4)
+	    *((unsigned int *) to) = *((unsigned int *) from);
+	  while (e--)
+	    *to++ = *from++;
+	}
+    }
+
+  return w;
+}
+
+
+/* The longest match, and the most input bytes that one code and its
+   distance take, rounded up to the reloads of the bit buffer.  */
+#define MAX_MATCH	258
+#define MAX_CODE_BYTES	16
+
+/* Decode literals and matches for as long as the input buffer holds the
+   bytes of the longest code and the window has room for the longest
+   match, which saves checking either for each code.  Return one at the
+   end of the block, and zero when one of the two runs short or on an
+   error.  */
+
+static int
+inflate_fast (void)
+{
+  register ulg b;		/* bit buffer */
+  register unsigned k;		/* number of bits in bit buffer */
+  uch *in, *last;		/* next input byte, and last to start at */
+  uch *out, *end;		/* next output byte, and last to start at */
+  unsigned ml, md;		/* masks for bl and bd bits */
+  unsigned e;			/* number of extra bits */
+  unsigned n, d;		/* length and distance for copy */
+  struct code t;		/* table entry */
+  int ret = 0;
+
+  b = bb;
+  k = bk;
+  in = inptr;
+  last = inend - MAX_CODE_BYTES;
+  out = slide + wp;
+  end = slide + WSIZE - MAX_MATCH;
+  ml = mask_bits[bl];
+  md = mask_bits[bd];
+
+  /* NEEDBITS without the check for the end of the input buffer */
+#define FASTBITS(n) \
+  do \
+    { \
+      if (k < (unsigned) (n)) \
+	{ \
+	  b |= (ulg) *((unsigned int *) in) << k; \
+	  in += (31 - k) >> 3; \
+	  k |= 24; \
+	} \
+    } \
+  while (0)
+
+  while (in < last && out < end)
+    {
+      FASTBITS (BMAX);
+      t = lencode[(unsigned) b & ml];
+      if (t.op && t.op < OP_BASE)
+	{
+	  DUMPBITS (t.bits);
+	  t = lencode[t.val + ((unsigned) b & mask_bits[t.op])];
+	}
+      DUMPBITS (t.bits);
+
+      if (t.op == OP_LITERAL)
+	{
+	  *out++ = (uch) t.val;
+	  continue;
+	}
+      if (! (t.op & OP_BASE))
+	{
+	  if (t.op & OP_EOB)
+	    ret = 1;
 	  else
-	    {
-	      r.e = (uch) e[*p - s];	/* non-simple--look up in lists */
-	      r.v.n = d[*p++ - s];
-	    }
+	    errnum = ERR_BAD_GZIP_DATA;
+	  break;
+	}
 
-	  /* fill code-like entries with r */
-	  f = 1 << (k - w);
-	  for (j = i >> w; j < z; j += f)
-	    q[j] = r;
+      e = t.op & 15;
+      FASTBITS (e);
+      n = t.val + ((unsigned) b & mask_bits[e]);
+      DUMPBITS (e);
 
-	  /* backwards increment the k-bit code i */
-	  for (j = 1 << (k - 1); i & j; j >>= 1)
-	    i ^= j;
-	  i ^= j;
+      FASTBITS (BMAX);
+      t = distcode[(unsigned) b & md];
+      if (t.op && t.op < OP_BASE)
+	{
+	  DUMPBITS (t.bits);
+	  t = distcode[t.val + ((unsigned) b & mask_bits[t.op])];
+	}
+      DUMPBITS (t.bits);
+      if (! (t.op & OP_BASE))
+	{
+	  errnum = ERR_BAD_GZIP_DATA;
+	  break;
+	}
+      e = t.op & 15;
+      FASTBITS (e);
+      d = t.val + ((unsigned) b & mask_bits[e]);
+      DUMPBITS (e);
 
-	  /* backup over finished tables */
-	  while ((i & ((1 << w) - 1)) != x[h])
-	    {
-	      h--;		/* don't need to update q */
-	      w -= l;
-	    }
+      if (d >= 4 && d <= (unsigned) (out - slide))
+	{
+	  /* the common case: a source which neither wraps around the
+	     window nor overlaps the copy by less than a word */
+	  uch *from = out - d;
+
+	  for (; n >= 4; n -= 4, out += 4, from += 4)
+	    *((unsigned int *) out) = *((unsigned int *) from);
+	  while (n--)
+	    *out++ = *from++;
 	}
+      else
+	out = slide + copy_match (out - slide, d, n);
     }
 
-  /* Return true (1) if we were given an incomplete table */
-  return y != 0 && g != 1;
+#undef FASTBITS
+
+  bb = b;
+  bk = k;
+  inptr = in;
+  wp = out - slide;
+  return ret;
 }
 
 
@@ -716,9 +877,9 @@ static int
 inflate_codes_in_window (void)
 {
   register unsigned e;		/* table entry flag/number of extra bits */
-  unsigned n, d;		/* length and index for copy */
+  unsigned n, d;		/* length and distance for copy */
   unsigned w;			/* current window position */
-  struct huft *t;		/* pointer to table entry */
+  struct code t;		/* table entry */
   unsigned ml, md;		/* masks for bl and bd bits */
   register ulg b;		/* bit buffer */
   register unsigned k;		/* number of bits in bit buffer */
@@ -735,100 +896,98 @@ inflate_codes_in_window (void)
   md = mask_bits[bd];
   for (;;)			/* do until end of block */
     {
+      if (!code_state && WSIZE - w >= MAX_MATCH
+	  && inend - inptr >= MAX_CODE_BYTES)
+	{
+	  bb = b;
+	  bk = k;
+	  wp = w;
+	  e = inflate_fast ();
+	  b = bb;
+	  k = bk;
+	  w = wp;
+	  if (errnum)
+	    return 0;
+	  if (e)
+	    {
+	      block_len = 0;
+	      break;
+	    }
+	}
+
+      /* one code at a time near the ends of the window and of inbuf */
       if (!code_state)
 	{
-	  NEEDBITS ((unsigned) bl);
-	  if ((e = (t = tl + ((unsigned) b & ml))->e) > 16)
-	    do
-	      {
-		if (e == 99)
-		  {
-		    errnum = ERR_BAD_GZIP_DATA;
-		    return 0;
-		  }
-		DUMPBITS (t->b);
-		e -= 16;
-		NEEDBITS (e);
-	      }
-	    while ((e = (t = t->v.t + ((unsigned) b & mask_bits[e]))->e) > 16);
-	  DUMPBITS (t->b);
-
-	  if (e == 16)		/* then it's a literal */
+	  NEEDBITS (BMAX);
+	  t = lencode[(unsigned) b & ml];
+	  if (t.op && t.op < OP_BASE)
+	    {
+	      DUMPBITS (t.bits);
+	      t = lencode[t.val + ((unsigned) b & mask_bits[t.op])];
+	    }
+	  DUMPBITS (t.bits);
+
+	  if (t.op == OP_LITERAL)	/* then it's a literal */
 	    {
-	      slide[w++] = (uch) t->v.n;
+	      slide[w++] = (uch) t.val;
 	      if (w == WSIZE)
 		break;
+	      continue;
 	    }
-	  else
-	    /* it's an EOB or a length */
+
+	  /* it's an EOB or a length */
+	  if (t.op & OP_EOB)
 	    {
 	      /* exit if end of block */
-	      if (e == 15)
-		{
-		  block_len = 0;
-		  break;
-		}
-
-	      /* get length of block to copy */
-	      NEEDBITS (e);
-	      n = t->v.n + ((unsigned) b & mask_bits[e]);
-	      DUMPBITS (e);
-
-	      /* decode distance of block to copy */
-	      NEEDBITS ((unsigned) bd);
-	      if ((e = (t = td + ((unsigned) b & md))->e) > 16)
-		do
-		  {
-		    if (e == 99)
-		      {
-			errnum = ERR_BAD_GZIP_DATA;
-			return 0;
-		      }
-		    DUMPBITS (t->b);
-		    e -= 16;
-		    NEEDBITS (e);
-		  }
-		while ((e = (t = t->v.t + ((unsigned) b & mask_bits[e]))->e)
-		       > 16);
-	      DUMPBITS (t->b);
-	      NEEDBITS (e);
-	      d = w - t->v.n - ((unsigned) b & mask_bits[e]);
-	      DUMPBITS (e);
-	      code_state++;
+	      block_len = 0;
+	      break;
 	    }
-	}
-
-      if (code_state)
-	{
-	  /* do the copy */
-	  do
+	  if (! (t.op & OP_BASE))
 	    {
-	      n -= (e = (e = WSIZE - ((d &= WSIZE - 1) > w ? d : w)) > n ? n
-		    : e);
-	      if (w - d >= e)
-		{
-		  memmove (slide + w, slide + d, e);
-		  w += e;
-		  d += e;
-		}
-	      else
-		/* purposefully use the overlap for extra copies here!! */
-		{
-		  while (e--)
-		    slide[w++] = slide[d++];
-		}
-	      if (w == WSIZE)
-		break;
+	      errnum = ERR_BAD_GZIP_DATA;
+	      return 0;
 	    }
-	  while (n);
 
-	  if (!n)
-	    code_state--;
+	  /* get length of block to copy */
+	  e = t.op & 15;
+	  NEEDBITS (e);
+	  n = t.val + ((unsigned) b & mask_bits[e]);
+	  DUMPBITS (e);
 
-	  /* did we break from the loop too soon? */
-	  if (w == WSIZE)
-	    break;
+	  /* decode distance of block to copy */
+	  NEEDBITS (BMAX);
+	  t = distcode[(unsigned) b & md];
+	  if (t.op && t.op < OP_BASE)
+	    {
+	      DUMPBITS (t.bits);
+	      t = distcode[t.val + ((unsigned) b & mask_bits[t.op])];
+	    }
+	  DUMPBITS (t.bits);
+	  if (! (t.op & OP_BASE))
+	    {
+	      errnum = ERR_BAD_GZIP_DATA;
+	      return 0;
+	    }
+	  e = t.op & 15;
+	  NEEDBITS (e);
+	  d = t.val + ((unsigned) b & mask_bits[e]);
+	  DUMPBITS (e);
+	  code_state++;
 	}
+
+      /* do the copy, up to the end of the window */
+      e = WSIZE - w;
+      if (e > n)
+	e = n;
+      n -= e;
+      w = copy_match (w, d, e);
+
+      if (!n)
+	code_state--;
+
+      /* did we break from the loop too soon? */
+      if (w == WSIZE)
+	break;
     }
 
   /* restore the globals from the locals */
@@ -872,15 +1031,15 @@ init_stored_block (void)
 }
 
 
-/* get header for an inflated type 1 (fixed Huffman codes) block.  We should
-   either replace this with a custom decoder, or at least precompute the
-   Huffman tables. */
+/* get header for an inflated type 1 (fixed Huffman codes) block.  The
+   tables are rebuilt for each, which costs less than a kilobyte of
+   output.  */
 
 static void
 init_fixed_block ()
 {
   int i;			/* temporary variable */
-  unsigned l[288];		/* length list for huft_build */
+  unsigned l[288];		/* length list for build_table */
 
   /* set up literal table */
   for (i = 0; i < 144; i++)
@@ -891,18 +1050,18 @@ init_fixed_block ()
     l[i] = 7;
   for (; i < 288; i++)		/* make a complete, but wrong code set */
     l[i] = 8;
-  bl = 7;
-  if ((i = huft_build (l, 288, 257, cplens, cplext, &tl, &bl)) != 0)
+  bl = LBITS;
+  if (build_table (l, 288, 257, cplens, cplext, lencode, ENOUGH_LENS, &bl))
     {
       errnum = ERR_BAD_GZIP_DATA;
       return;
     }
 
   /* set up distance table */
-  for (i = 0; i < 30; i++)	/* make an incomplete code set */
+  for (i = 0; i < 32; i++)	/* make a complete, but wrong code set */
     l[i] = 5;
-  bd = 5;
-  if ((i = huft_build (l, 30, 0, cpdist, cpdext, &td, &bd)) > 1)
+  bd = DBITS;
+  if (build_table (l, 32, 0, cpdist, cpdext, distcode, ENOUGH_DISTS, &bd))
     {
       errnum = ERR_BAD_GZIP_DATA;
       return;
@@ -928,6 +1087,7 @@ init_dynamic_block (void)
   unsigned nl;			/* number of literal/length codes */
   unsigned nd;			/* number of distance codes */
   unsigned ll[286 + 30];	/* literal/length and distance code lengths */
+  struct code t;		/* table entry */
   register ulg b;		/* bit buffer */
   register unsigned k;		/* number of bits in bit buffer */
 
@@ -963,7 +1123,7 @@ init_dynamic_block (void)
 
   /* build decoding table for trees--single level, 7 bit lookup */
   bl = 7;
-  if ((i = huft_build (ll, 19, 19, NULL, NULL, &tl, &bl)) != 0)
+  if (build_table (ll, 19, 19, NULL, NULL, lencode, ENOUGH_LENS, &bl))
     {
       errnum = ERR_BAD_GZIP_DATA;
       return;
@@ -976,9 +1136,14 @@ init_dynamic_block (void)
   while ((unsigned) i < n)
     {
       NEEDBITS ((unsigned) bl);
-      j = (td = tl + ((unsigned) b & m))->b;
-      DUMPBITS (j);
-      j = td->v.n;
+      t = lencode[(unsigned) b & m];
+      if (t.op != OP_LITERAL)
+	{
+	  errnum = ERR_BAD_GZIP_DATA;
+	  return;
+	}
+      DUMPBITS (t.bits);
+      j = t.val;
       if (j < 16)		/* length of code in bits (0..15) */
 	ll[i++] = l = j;	/* save last length in l */
       else if (j == 16)		/* repeat last length 3 to 6 times */
@@ -1025,16 +1190,14 @@ init_dynamic_block (void)
 	}
     }
 
-  /* free decoding table for trees */
-  reset_linalloc ();
-
   /* restore the global bit buffer */
   bb = b;
   bk = k;
 
   /* build the decoding tables for literal/length and distance codes */
-  bl = lbits;
-  if ((i = huft_build (ll, nl, 257, cplens, cplext, &tl, &bl)) != 0)
+  bl = LBITS;
+  if ((i = build_table (ll, nl, 257, cplens, cplext, lencode, ENOUGH_LENS,
+			&bl)) != 0)
     {
 #if 0
       if (i == 1)
@@ -1044,8 +1207,9 @@ init_dynamic_block (void)
       errnum = ERR_BAD_GZIP_DATA;
       return;
     }
-  bd = dbits;
-  if ((i = huft_build (ll + nl, nd, 0, cpdist, cpdext, &td, &bd)) != 0)
+  bd = DBITS;
+  if ((i = build_table (ll + nl, nd, 0, cpdist, cpdext, distcode,
+			ENOUGH_DISTS, &bd)) != 0)
     {
 #if 0
       if (i == 1)
@@ -1068,8 +1232,6 @@ get_new_block (void)
   register ulg b;		/* bit buffer */
   register unsigned k;		/* number of bits in bit buffer */
 
-  hufts = 0;
-
   /* make local bit buffer */
   b = bb;
   k = bk;
@@ -1128,19 +1290,41 @@ inflate_window (void)
        */
       if (block_type == INFLATE_STORED)
 	{
-	  int w = wp;
+	  int size;
 
 	  /*
-	   *  This is basically a glorified pass-through
+	   *  This is basically a glorified pass-through: the whole bytes
+	   *  left in the bit buffer first, then straight from inbuf.
 	   */
 
-	  while (block_len && w < WSIZE && !errnum)
+	  while (block_len && wp < WSIZE && bk)
 	    {
-	      slide[w++] = get_byte ();
+	      slide[wp++] = (uch) bb;
+	      bb >>= 8;
+	      bk -= 8;
 	      block_len--;
 	    }
 
-	  wp = w;
+	  /* The bits loaded ahead are copied below.  */
+	  if (! bk)
+	    bb = 0;
+
+	  while (block_len && wp < WSIZE && !errnum)
+	    {
+	      if (inptr >= inend)
+		fill_inbuf ();
+
+	      size = inend - inptr;
+	      if (size > block_len)
+		size = block_len;
+	      if (size > WSIZE - wp)
+		size = WSIZE - wp;
+
+	      memmove (slide + wp, inptr, size);
+	      inptr += size;
+	      wp += size;
+	      block_len -= size;
+	    }
 
 	  continue;
 	}
@@ -1149,8 +1333,7 @@ inflate_window (void)
        *  Expand other kind of block.
        */
 
-      if (inflate_codes_in_window ())
-	reset_linalloc ();
+      inflate_codes_in_window ();
     }
 
   saved_filepos += WSIZE;
@@ -1169,18 +1352,177 @@ initialize_tables (void)
   bk = 0;
   bb = 0;
 
+  /* start with an empty input buffer at the top of upper memory */
+  inbuf = (uch *) (RAW_ADDR ((mbi.mem_upper << 10) + 0x100000)
+		   - INBUFSIZ - sizeof (unsigned int));
+  inptr = inend = inbuf;
+
   /* reset partial decompression code */
   last_block = 0;
   block_len = 0;
+}
+
+
+
+/*
+ *  Checkpoints.
+ *
+ *  A seek back before the window used to start the decompression again
+ *  from the beginning of the file, which loaders that seek around in a
+ *  kernel and the measurement of it may do several times.  So the state
+ *  of the decompression after some of the windows is saved below inbuf,
+ *  with the window itself and the code tables, and a seek goes on from
+ *  the last checkpoint before its position instead.  The first window
+ *  always has one.  When all CHECKPOINTS are taken, every other one is
+ *  dropped and they are saved half as often, so that they are spread
+ *  over the whole file read so far.
+ */
+
+#define CHECKPOINTS	16
+
+struct checkpoint
+{
+  int outpos;			/* saved_filepos after the window */
+  int inpos;			/* compressed offset of the next byte */
+  ulg bb;			/* bit buffer */
+  unsigned bk;			/* bits in bit buffer */
+  int block_type;
+  int block_len;
+  int last_block;
+  int code_state;
+  unsigned inflate_n;
+  unsigned inflate_d;
+  int bl;
+  int bd;
+  uch *data;			/* window, lencode and distcode */
+};
+
+#define CHECKPOINT_SIZE	(WSIZE + sizeof (lencode) + sizeof (distcode))
+
+static struct checkpoint checkpoints[CHECKPOINTS];
+static int num_checkpoints;
+static int checkpoint_interval;	/* in windows */
+static uch *checkpoint_bottom;	/* zero if there is no room for them */
+
 
-  /* reset memory allocation stuff */
-  reset_linalloc ();
+/* Drop all checkpoints, and place them below inbuf.  */
+
+static void
+reset_checkpoints (void)
+{
+  unsigned long top;
+  int i;
+
+  num_checkpoints = 0;
+  checkpoint_interval = 1;
+
+  top = RAW_ADDR ((mbi.mem_upper << 10) + 0x100000) - INBUFSIZ
+    - sizeof (unsigned int);
+  checkpoint_bottom = 0;
+  if (top < RAW_ADDR (0x100000) + CHECKPOINTS * CHECKPOINT_SIZE)
+    return;
+
+  checkpoint_bottom = (uch *) (top - CHECKPOINTS * CHECKPOINT_SIZE);
+  for (i = 0; i < CHECKPOINTS; i++)
+    checkpoints[i].data = checkpoint_bottom + i * CHECKPOINT_SIZE;
+}
+
+
+/* Save the state after the window just inflated, if it is due.  */
+
+static void
+save_checkpoint (void)
+{
+  int window = saved_filepos / WSIZE - 1;
+  struct checkpoint *c, tmp;
+  int i;
+
+  if (errnum || ! checkpoint_bottom || window % checkpoint_interval
+      || (num_checkpoints
+	  && checkpoints[num_checkpoints - 1].outpos >= saved_filepos))
+    return;
+
+  if (num_checkpoints == CHECKPOINTS)
+    {
+      /* keep every other one, swapping so that no data is lost */
+      for (i = 1; i < CHECKPOINTS / 2; i++)
+	{
+	  tmp = checkpoints[i];
+	  checkpoints[i] = checkpoints[2 * i];
+	  checkpoints[2 * i] = tmp;
+	}
+      num_checkpoints = CHECKPOINTS / 2;
+      checkpoint_interval *= 2;
+
+      if (window % checkpoint_interval)
+	return;
+    }
+
+  c = &checkpoints[num_checkpoints++];
+  c->outpos = saved_filepos;
+  c->inpos = filepos - (inend - inptr);
+  c->bb = bb;
+  c->bk = bk;
+  c->block_type = block_type;
+  c->block_len = block_len;
+  c->last_block = last_block;
+  c->code_state = code_state;
+  c->inflate_n = inflate_n;
+  c->inflate_d = inflate_d;
+  c->bl = bl;
+  c->bd = bd;
+
+  memmove (c->data, slide, WSIZE);
+  memmove (c->data + WSIZE, lencode, sizeof (lencode));
+  memmove (c->data + WSIZE + sizeof (lencode), distcode, sizeof (distcode));
+}
+
+
+/* Return the last checkpoint whose window is at or before gzip_filepos,
+   or zero if there is none.  */
+
+static struct checkpoint *
+find_checkpoint (void)
+{
+  int i;
+
+  for (i = num_checkpoints; i > 0; i--)
+    if (checkpoints[i - 1].outpos - WSIZE <= gzip_filepos)
+      return &checkpoints[i - 1];
+
+  return 0;
+}
+
+
+static void
+restore_checkpoint (struct checkpoint *c)
+{
+  saved_filepos = c->outpos;
+  bb = c->bb;
+  bk = c->bk;
+  block_type = c->block_type;
+  block_len = c->block_len;
+  last_block = c->last_block;
+  code_state = c->code_state;
+  inflate_n = c->inflate_n;
+  inflate_d = c->inflate_d;
+  bl = c->bl;
+  bd = c->bd;
+
+  memmove (slide, c->data, WSIZE);
+  memmove (lencode, c->data + WSIZE, sizeof (lencode));
+  memmove (distcode, c->data + WSIZE + sizeof (lencode), sizeof (distcode));
+
+  /* read on from the next byte the bit buffer has not taken */
+  filepos = c->inpos;
+  inptr = inend = inbuf;
 }
 
 
 int
 gunzip_read (char *buf, int len)
 {
+  struct checkpoint *checkpoint;
   int ret = 0;
 
   compressed_file = 0;
@@ -1189,9 +1531,24 @@ gunzip_read (char *buf, int len)
    *  Now "gzip_*" values refer to the uncompressed data.
    */
 
-  /* do we reset decompression to the beginning of the file? */
+  /* Reading over the checkpoints overwrites them.  */
+  if (checkpoint_bottom
+      && (uch *) buf < checkpoint_bottom + CHECKPOINTS * CHECKPOINT_SIZE
+      && (uch *) buf + len > checkpoint_bottom)
+    reset_checkpoints ();
+
+  /* do we reset decompression to the beginning of the file, or go back
+     or ahead to a checkpoint? */
+  checkpoint = find_checkpoint ();
   if (saved_filepos > gzip_filepos + WSIZE)
-    initialize_tables ();
+    {
+      if (checkpoint)
+	restore_checkpoint (checkpoint);
+      else
+	initialize_tables ();
+    }
+  else if (checkpoint && checkpoint->outpos > saved_filepos)
+    restore_checkpoint (checkpoint);
 
   /*
    *  This loop operates upon uncompressed data only.  The only
@@ -1205,7 +1562,10 @@ gunzip_read (char *buf, int len)
       register char *srcaddr;
 
       while (gzip_filepos >= saved_filepos)
-	inflate_window ();
+	{
+	  inflate_window ();
+	  save_checkpoint ();
+	}
 
       srcaddr = (char *) ((gzip_filepos & (WSIZE - 1)) + slide);
       size = saved_filepos - gzip_filepos;
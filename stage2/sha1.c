@@ -1,8 +1,6 @@
 /*      This file contains functions and utilities for the Trusted GRUB project
-        at http://www.prosec.rub.de. The SHA1-implementation has been written by
-        Marko Wolf <mwolf@crypto.rub.de> and tested according to FIPS-180.
-	The SHA1-macros are from "Christophe Devine" <devine@cr0.net>.
-        For reuasage of the SHA1-implementation, please contact the original authors.
+        at http://www.prosec.rub.de. The SHA1-implementation is in the file
+	sha1_engine.c, which is shared with the utilities in util/.
 
 	Furthermore, this file contains the GRUB implementation of "calculate_sha1".
 	For details, read the README-file or contact the author Marcel Selhorst
@@ -10,355 +8,299 @@
 
 	Parameters:
 
-        int sha1_init(sha1_context *ctx )
-	int sha1_update(sha1_context *ctx, t_U8 *chunk_data, t_U32 chunk_length)
-	int sha1_finish(sha1_context *ctx, t_U32 *sha1_hash)
 	int calculate_sha1(char* filename, t_U32 *sha1_result, int print_results)
 */
 
 #include "shared.h"
-// concatenates 4  8-bit words (= 1 byte) to one 32-bit word
-#define CONCAT_4_BYTES( w32, w8, w8_i)            \
-{                                                 \
-    (w32) = ( (t_U32) (w8)[(w8_i)    ] << 24 ) |  \
-            ( (t_U32) (w8)[(w8_i) + 1] << 16 ) |  \
-            ( (t_U32) (w8)[(w8_i) + 2] <<  8 ) |  \
-            ( (t_U32) (w8)[(w8_i) + 3]       );   \
+
+// Stage2 runs without an OS to switch SSE on
+#ifndef GRUB_UTIL
+#define SHA1_ENABLE_SSE 1
+#endif
+#include "sha1_engine.c"
+
+#ifndef GRUB_UTIL
+# include "apic.h"
+# include "smp-imps.h"
+#endif
+
+/* Prepare the calling CPU for the SHA1 engine: choose the engine on the
+   BSP, and allow SSE on the hashing worker if the engine needs it. */
+void sha1_setup_cpu (void)
+{
+    if (sha1_engine < 0)
+	sha1_select_engine (-1);
+#if defined(SHA1_X86_ENGINES) && defined(SHA1_ENABLE_SSE)
+    else if (sha1_engine != SHA1_ENGINE_SCALAR)
+	sha1_enable_sse ();
+#endif
 }
 
-// splits a 32-bit word into 4  8-bit words (= 1 byte)
-#define SPLIT_INTO_4_BYTES( w32, w8, w8_i)        \
-{                                                 \
-    (w8)[(w8_i)    ] = (t_U8) ( (w32) >> 24 );    \
-    (w8)[(w8_i) + 1] = (t_U8) ( (w32) >> 16 );    \
-    (w8)[(w8_i) + 2] = (t_U8) ( (w32) >>  8 );    \
-    (w8)[(w8_i) + 3] = (t_U8) ( (w32)       );    \
+/* Hash LEN bytes at DATA into CTX, on the hashing worker if one has been
+   started with "smphash". DATA must not change and CTX must not be used
+   until sha1_wait has returned. */
+void sha1_update_queued (sha1_context *ctx, t_U8 *data, t_U32 len)
+{
+#ifndef GRUB_UTIL
+    if (imps_hash_queue (ctx, data, len))
+	return;
+#endif
+    sha1_update (ctx, data, len);
 }
 
-// FIPS-180-1 padding sequence
-static t_U8 sha1_padding[64] =
+void sha1_wait (void)
 {
- (t_U8) 0x80, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0,
- (t_U8)    0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0,
- (t_U8)    0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0,
- (t_U8)    0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0
-};
+#ifndef GRUB_UTIL
+    imps_hash_wait ();
+#endif
+}
+
+/* The measurement cache. Its entries live in a fixed table, the retained
+   file contents in an arena in upper memory, just below the sector
+   cache. */
 
-int sha1_init(sha1_context *ctx )
+#define MEASURE_CACHE_ENTRIES	128
+#define MEASURE_CACHE_MAXLEN	0x4000000
+
+static struct measure_cache_entry measure_cache[MEASURE_CACHE_ENTRIES];
+static int measure_cache_count;
+static unsigned long arena_start;
+static unsigned long arena_next;
+static unsigned long arena_end;
+
+// The key of the file most recently passed to measure_cache_lookup
+static struct measure_cache_entry measure_cache_key;
+
+static void measure_cache_read_func (int sector, int offset, int length)
 {
+    if (measure_cache_key.sector == (unsigned long) -1)
+	measure_cache_key.sector = sector;
+}
 
-  // parameter check
-  if ( ctx == NULL )
-  {
-    return -1;
-  }
+/* Find the first disk sector of the file just opened by reading its
+   first byte with a disk read hook installed. */
+static unsigned long measure_cache_identify (void)
+{
+    char c;
+    int saved_filepos = filepos;
+    int saved_perform_sha1 = perform_sha1;
+    void (*saved_hook) (int, int, int) = disk_read_hook;
+
+    measure_cache_key.sector = (unsigned long) -1;
+    perform_sha1 = 0;
+    disk_read_hook = measure_cache_read_func;
+    filepos = 0;
+    grub_read (&c, 1);
+    disk_read_hook = saved_hook;
+    perform_sha1 = saved_perform_sha1;
+    filepos = saved_filepos;
+
+    return measure_cache_key.sector;
+}
+
+struct measure_cache_entry *measure_cache_lookup (void)
+{
+    int i;
+
+    measure_cache_key.drive = current_drive;
+    measure_cache_key.partition = current_partition;
+    measure_cache_key.size = filemax;
+    measure_cache_key.sector = (unsigned long) -1;
+
+    // Removable media may be exchanged, and empty files have no sector
+    if (!(current_drive & 0x80) || current_drive == cdrom_drive
+	|| filemax <= 0)
+	return 0;
 
-  // byte length = 0
-  ctx->total_bytes_Lo = 0;
-  ctx->total_bytes_Hi = 0;
+    if (measure_cache_identify () == (unsigned long) -1)
+    {
+	errnum = ERR_NONE;
+	return 0;
+    }
 
-  // FIPS 180-1 init values
-  ctx->vector[0] = 0x67452301;
-  ctx->vector[1] = 0xEFCDAB89;
-  ctx->vector[2] = 0x98BADCFE;
-  ctx->vector[3] = 0x10325476;
-  ctx->vector[4] = 0xC3D2E1F0;
+    for (i = 0; i < measure_cache_count; i++)
+	if (measure_cache[i].sector == measure_cache_key.sector
+	    && measure_cache[i].drive == measure_cache_key.drive
+	    && measure_cache[i].partition == measure_cache_key.partition
+	    && measure_cache[i].size == measure_cache_key.size)
+	    return &measure_cache[i];
 
-  // successful
-  return 0;
+    return 0;
 }
 
+char *measure_cache_alloc (int size)
+{
+    unsigned long top;
+    char *data;
+
+    if (!arena_start)
+    {
+	top = sector_cache_start ();
+	arena_end = top;
+	arena_start = top - (mbi.mem_upper << 10) / 4;
+	if (top - arena_start > MEASURE_CACHE_MAXLEN)
+	    arena_start = top - MEASURE_CACHE_MAXLEN;
+	if (arena_start < RAW_ADDR (0x100000) || arena_start >= arena_end)
+	    arena_start = arena_end = RAW_ADDR (0x100000);
+	arena_next = arena_start;
+    }
 
-static void sha1_process(sha1_context *ctx, t_U8 *byte_64_block )
+    if (measure_cache_key.sector == (unsigned long) -1
+	|| size <= 0 || size > arena_end - arena_next)
+	return 0;
+
+    data = (char *) arena_next;
+    arena_next = (arena_next + size + 15) & ~15;
+    return data;
+}
+
+void measure_cache_insert (unsigned long *hash_result, char *data)
 {
-  // declarations
-  t_U32 temp, W[16];
-  t_U32 A, B, C, D, E;
-
-  // concatenate 64 bytes to 16  32-bit words
-  CONCAT_4_BYTES( W[0],  byte_64_block,  0 );
-  CONCAT_4_BYTES( W[1],  byte_64_block,  4 );
-  CONCAT_4_BYTES( W[2],  byte_64_block,  8 );
-  CONCAT_4_BYTES( W[3],  byte_64_block, 12 );
-  CONCAT_4_BYTES( W[4],  byte_64_block, 16 );
-  CONCAT_4_BYTES( W[5],  byte_64_block, 20 );
-  CONCAT_4_BYTES( W[6],  byte_64_block, 24 );
-  CONCAT_4_BYTES( W[7],  byte_64_block, 28 );
-  CONCAT_4_BYTES( W[8],  byte_64_block, 32 );
-  CONCAT_4_BYTES( W[9],  byte_64_block, 36 );
-  CONCAT_4_BYTES( W[10], byte_64_block, 40 );
-  CONCAT_4_BYTES( W[11], byte_64_block, 44 );
-  CONCAT_4_BYTES( W[12], byte_64_block, 48 );
-  CONCAT_4_BYTES( W[13], byte_64_block, 52 );
-  CONCAT_4_BYTES( W[14], byte_64_block, 56 );
-  CONCAT_4_BYTES( W[15], byte_64_block, 60 );
-
-// rotate left by n bits
-#define ROTATE_N_LEFT(x,n) ((x << n) | ((x & 0xFFFFFFFF) >> (32 - n)))
-
-// extends 16  32-bit words to 80  32-bit words
-#define EXTENDED_W(t)                                 \
-(                                                     \
-  temp = W[(t -  3) & 0x0F] ^ W[(t - 8) & 0x0F] ^     \
-         W[(t - 14) & 0x0F] ^ W[ t      & 0x0F],      \
-  ( W[t & 0x0F] = ROTATE_N_LEFT(temp,1) )             \
-)
-
-// main formula
-#define P(a,b,c,d,e,Wi)                               \
-{                                                     \
-  e += ROTATE_N_LEFT(a,5) + F(b,c,d) + K + Wi;        \
-  b  = ROTATE_N_LEFT(b,30);                           \
+    struct measure_cache_entry *entry;
+    int i;
+
+    if (measure_cache_key.sector == (unsigned long) -1)
+	return;
+
+    // Without a free slot, the file is simply not cached
+    if (measure_cache_count == MEASURE_CACHE_ENTRIES)
+	return;
+
+    entry = &measure_cache[measure_cache_count++];
+    *entry = measure_cache_key;
+    for (i = 0; i < 5; i++)
+	entry->digest[i] = hash_result[i];
+    entry->data = data;
 }
 
-  // init A..E
-  A = ctx->vector[0];
-  B = ctx->vector[1];
-  C = ctx->vector[2];
-  D = ctx->vector[3];
-  E = ctx->vector[4];
-
-// round I (0..19)
-#define F(x,y,z) (z ^ (x & (y ^ z)))
-#define K 0x5A827999
-
-  P( A, B, C, D, E, W[0]  );
-  P( E, A, B, C, D, W[1]  );
-  P( D, E, A, B, C, W[2]  );
-  P( C, D, E, A, B, W[3]  );
-  P( B, C, D, E, A, W[4]  );
-  P( A, B, C, D, E, W[5]  );
-  P( E, A, B, C, D, W[6]  );
-  P( D, E, A, B, C, W[7]  );
-  P( C, D, E, A, B, W[8]  );
-  P( B, C, D, E, A, W[9]  );
-  P( A, B, C, D, E, W[10] );
-  P( E, A, B, C, D, W[11] );
-  P( D, E, A, B, C, W[12] );
-  P( C, D, E, A, B, W[13] );
-  P( B, C, D, E, A, W[14] );
-  P( A, B, C, D, E, W[15] );
-  P( E, A, B, C, D, EXTENDED_W(16) );
-  P( D, E, A, B, C, EXTENDED_W(17) );
-  P( C, D, E, A, B, EXTENDED_W(18) );
-  P( B, C, D, E, A, EXTENDED_W(19) );
-
-#undef K
-#undef F
-
-// round II (20..39)
-#define F(x,y,z) (x ^ y ^ z)
-#define K 0x6ED9EBA1
-
-  P( A, B, C, D, E, EXTENDED_W(20) );
-  P( E, A, B, C, D, EXTENDED_W(21) );
-  P( D, E, A, B, C, EXTENDED_W(22) );
-  P( C, D, E, A, B, EXTENDED_W(23) );
-  P( B, C, D, E, A, EXTENDED_W(24) );
-  P( A, B, C, D, E, EXTENDED_W(25) );
-  P( E, A, B, C, D, EXTENDED_W(26) );
-  P( D, E, A, B, C, EXTENDED_W(27) );
-  P( C, D, E, A, B, EXTENDED_W(28) );
-  P( B, C, D, E, A, EXTENDED_W(29) );
-  P( A, B, C, D, E, EXTENDED_W(30) );
-  P( E, A, B, C, D, EXTENDED_W(31) );
-  P( D, E, A, B, C, EXTENDED_W(32) );
-  P( C, D, E, A, B, EXTENDED_W(33) );
-  P( B, C, D, E, A, EXTENDED_W(34) );
-  P( A, B, C, D, E, EXTENDED_W(35) );
-  P( E, A, B, C, D, EXTENDED_W(36) );
-  P( D, E, A, B, C, EXTENDED_W(37) );
-  P( C, D, E, A, B, EXTENDED_W(38) );
-  P( B, C, D, E, A, EXTENDED_W(39) );
-
-#undef K
-#undef F
-
-// round III (40..59)
-#define F(x,y,z) ((x & y) | (z & (x | y)))
-#define K 0x8F1BBCDC
-
-  P( A, B, C, D, E, EXTENDED_W(40) );
-  P( E, A, B, C, D, EXTENDED_W(41) );
-  P( D, E, A, B, C, EXTENDED_W(42) );
-  P( C, D, E, A, B, EXTENDED_W(43) );
-  P( B, C, D, E, A, EXTENDED_W(44) );
-  P( A, B, C, D, E, EXTENDED_W(45) );
-  P( E, A, B, C, D, EXTENDED_W(46) );
-  P( D, E, A, B, C, EXTENDED_W(47) );
-  P( C, D, E, A, B, EXTENDED_W(48) );
-  P( B, C, D, E, A, EXTENDED_W(49) );
-  P( A, B, C, D, E, EXTENDED_W(50) );
-  P( E, A, B, C, D, EXTENDED_W(51) );
-  P( D, E, A, B, C, EXTENDED_W(52) );
-  P( C, D, E, A, B, EXTENDED_W(53) );
-  P( B, C, D, E, A, EXTENDED_W(54) );
-  P( A, B, C, D, E, EXTENDED_W(55) );
-  P( E, A, B, C, D, EXTENDED_W(56) );
-  P( D, E, A, B, C, EXTENDED_W(57) );
-  P( C, D, E, A, B, EXTENDED_W(58) );
-  P( B, C, D, E, A, EXTENDED_W(59) );
-
-#undef K
-#undef F
-
-// round IV (60..79)
-#define F(x,y,z) (x ^ y ^ z)
-#define K 0xCA62C1D6
-
-  P( A, B, C, D, E, EXTENDED_W(60) );
-  P( E, A, B, C, D, EXTENDED_W(61) );
-  P( D, E, A, B, C, EXTENDED_W(62) );
-  P( C, D, E, A, B, EXTENDED_W(63) );
-  P( B, C, D, E, A, EXTENDED_W(64) );
-  P( A, B, C, D, E, EXTENDED_W(65) );
-  P( E, A, B, C, D, EXTENDED_W(66) );
-  P( D, E, A, B, C, EXTENDED_W(67) );
-  P( C, D, E, A, B, EXTENDED_W(68) );
-  P( B, C, D, E, A, EXTENDED_W(69) );
-  P( A, B, C, D, E, EXTENDED_W(70) );
-  P( E, A, B, C, D, EXTENDED_W(71) );
-  P( D, E, A, B, C, EXTENDED_W(72) );
-  P( C, D, E, A, B, EXTENDED_W(73) );
-  P( B, C, D, E, A, EXTENDED_W(74) );
-  P( A, B, C, D, E, EXTENDED_W(75) );
-  P( E, A, B, C, D, EXTENDED_W(76) );
-  P( D, E, A, B, C, EXTENDED_W(77) );
-  P( C, D, E, A, B, EXTENDED_W(78) );
-  P( B, C, D, E, A, EXTENDED_W(79) );
-
-#undef K
-#undef F
-
-  // assign vectors
-  ctx->vector[0] += A;
-  ctx->vector[1] += B;
-  ctx->vector[2] += C;
-  ctx->vector[3] += D;
-  ctx->vector[4] += E;
+/* Drop the retained contents that overlap the memory range ADDR...ADDR+LEN,
+   because a loader is about to write there. */
+void measure_cache_forget (unsigned long addr, int len)
+{
+    int i;
+
+    if (len <= 0 || addr >= arena_end || addr + len <= arena_start)
+	return;
+
+    // Nothing may be stored in the range from now on either
+    if (addr + len > arena_next)
+	arena_end = arena_next;
+
+    for (i = 0; i < measure_cache_count; i++)
+    {
+	unsigned long data = (unsigned long) measure_cache[i].data;
+
+	if (data && addr < data + measure_cache[i].size && data < addr + len)
+	    measure_cache[i].data = 0;
+    }
 }
 
-int sha1_update(sha1_context *ctx, t_U8 *chunk_data, t_U32 chunk_length)
+/* Forget everything, e.g. because a disk has been written to. */
+void measure_cache_reset (void)
 {
+    measure_cache_count = 0;
+    arena_start = arena_next = arena_end = 0;
+}
 
-  // declarations
-  t_U32 left, fill;
-  t_U32 i;
+/* The checkfile index. Entries are kept in a pool within GRUB itself,
+   since any part of upper memory may be overwritten by a loader, and
+   they are chained into hash buckets by the path on the partition. */
 
-  // parameter check
-  if ( (ctx == NULL) || (chunk_data == NULL) || (chunk_length < 1) )
-  {
-    return -1;
-  }
-
-  // chunk_length =? 0
-  if ( chunk_length == 0 ) return -1;
-
-  // chunk_length = n * 64 byte + left
-  left = ctx->total_bytes_Lo & 0x3F;
-
-  // fill bytes remain to 64 byte block
-  fill = 64 - left;
-
-  // total = total + chunk_length
-  ctx->total_bytes_Lo += chunk_length;
-  
-  // mask 32 bit
-  ctx->total_bytes_Lo &= 0xFFFFFFFF;
-
-  if ( ctx->total_bytes_Lo < chunk_length )
-  {
-    ctx->total_bytes_Hi++;
-  }
-
-  // if we have something in the buffer (left > 0) and 
-  // the chunk has enougth data to fill a 64 byte block (chunk_length >= fill)
-  if ( (left > 0) && (chunk_length >= fill) )
-  {
-     // fill buffer with data from new chunk
-     for ( i = 0; i < fill; i++ )
-     {
-        ctx->buffer[left + i] = chunk_data[i];
-     }
-
-     // process 64 byte buffer block
-     sha1_process( ctx, ctx->buffer );
-
-     // dec chunk_length by fill
-     chunk_length -= fill;
-
-     // move data pointer by fill
-     chunk_data  += fill;
-
-     // buffer is fully processed
-     left = 0;
-  }
-
-  // process all remaining 64 byte chunks
-  while( chunk_length >= 64 )
-  {
-     sha1_process( ctx, chunk_data );
-     chunk_length -= 64;
-     chunk_data  += 64;
-  }
-
-  // if final chunk_length between 1..63 byte
-  if ( chunk_length > 0 )
-  {
-     // append remainder to 64 byte into buffer resp. fill the empty buffer
-     for ( i = 0; i < chunk_length; i++ )
-     {
-       ctx->buffer[left + i] = chunk_data[i];
-     }
-  }
-
-  // successfull
-  return 0;
+#define CHECKFILE_INDEX_SIZE	0x8000
+#define CHECKFILE_INDEX_BUCKETS	64
+
+struct checkfile_entry
+{
+    struct checkfile_entry *next;	// The next entry in the same bucket
+    unsigned long drive;
+    unsigned long partition;
+    unsigned long digest[5];		// The reference value
+    char path[0];			// The path without the device
+};
+
+static struct checkfile_entry *checkfile_index[CHECKFILE_INDEX_BUCKETS];
+static char checkfile_pool[CHECKFILE_INDEX_SIZE];
+static int checkfile_pool_used;
+
+// Skip the device part of FILENAME, as done by grub_open
+static char *checkfile_path (char *filename)
+{
+    char *p = filename;
+
+    if (*p == '(')
+    {
+	while (*p && *p != ')')
+	    p++;
+	if (*p)
+	    return p + 1;
+    }
+    return filename;
 }
 
-int sha1_finish(sha1_context *ctx, t_U32 *sha1_hash)
+static int checkfile_path_len (char *path)
 {
+    int len = 0;
 
-  // declarations
-  t_U32 last, padn;
-  t_U32 high, low;
-  t_U8  msglen[8];
-  int   ret;
+    while (path[len] && !isspace (path[len]))
+	len++;
+    return len;
+}
 
-  // parameter check
-  if ( (ctx == NULL) || (sha1_hash == NULL) )
-  {
-    *sha1_hash = 0;
-    return -1;
-  }
+static int checkfile_bucket (char *path, int len)
+{
+    unsigned long h = 0;
 
-  // build msglen array[8  8-bit] from total[2  32-bit] = n  64 byte
-  high = ( ctx->total_bytes_Lo >> 29 ) | ( ctx->total_bytes_Hi <<  3 );
-  low  = ( ctx->total_bytes_Lo <<  3 );
-  SPLIT_INTO_4_BYTES( high, msglen, 0 );
-  SPLIT_INTO_4_BYTES( low,  msglen, 4 ); 
+    while (len--)
+	h = h * 31 + (unsigned char) *path++;
+    return h % CHECKFILE_INDEX_BUCKETS;
+}
 
-  // total = n  64 bytes + last
-  last = ctx->total_bytes_Lo & 0x3F;
+/* Remember DIGEST as the reference value of FILENAME, which lives on the
+   device the last grub_open has used. Return zero if the index is full. */
+int checkfile_index_add (char *filename, unsigned long *digest)
+{
+    struct checkfile_entry *entry;
+    char *path = checkfile_path (filename);
+    int len = checkfile_path_len (path);
+    int size = (sizeof (struct checkfile_entry) + len + 1 + 3) & ~3;
+    int bucket = checkfile_bucket (path, len);
+    int i;
+
+    if (checkfile_pool_used + size > CHECKFILE_INDEX_SIZE)
+	return 0;
+
+    entry = (struct checkfile_entry *) (checkfile_pool + checkfile_pool_used);
+    checkfile_pool_used += size;
 
-  // number of padding zeros 
-  padn = ( last < 56 ) ? ( 56 - last ) : ( 120 - last );
+    entry->drive = current_drive;
+    entry->partition = current_partition;
+    for (i = 0; i < 5; i++)
+	entry->digest[i] = digest[i];
+    memmove (entry->path, path, len);
+    entry->path[len] = 0;
 
-  // update SHA-1 context with remaining buffer and padding to 64 bytes with bit sequence (1,0,...,0)
-  ret = sha1_update( ctx, sha1_padding, padn );
+    // Newer entries come first, so a later checkfile overrides
+    entry->next = checkfile_index[bucket];
+    checkfile_index[bucket] = entry;
+    return 1;
+}
 
-  // update SHA-1 context with total length
-  ret = sha1_update( ctx, msglen, 8 );
+/* Return the reference value of FILENAME on the current device, or 0 if
+   no checkfile has listed it. */
+unsigned long *checkfile_index_lookup (char *filename)
+{
+    struct checkfile_entry *entry;
+    char *path = checkfile_path (filename);
+    int len = checkfile_path_len (path);
 
-  // assign final hash words
-  sha1_hash[0] = ctx->vector[0];
-  sha1_hash[1] = ctx->vector[1];
-  sha1_hash[2] = ctx->vector[2];
-  sha1_hash[3] = ctx->vector[3];
-  sha1_hash[4] = ctx->vector[4];
+    for (entry = checkfile_index[checkfile_bucket (path, len)];
+	 entry; entry = entry->next)
+	if (entry->drive == current_drive
+	    && entry->partition == current_partition
+	    && !memcmp (entry->path, path, len) && !entry->path[len])
+	    return entry->digest;
 
-  // successful
-  return 0;
+    return 0;
 }
 
 int calculate_sha1(char* filename, t_U32 *sha1_result, int print_results)
@@ -370,42 +312,54 @@ int calculate_sha1(char* filename, t_U32 *sha1_result, int print_results)
     unsigned long filesize = 0;
     int round = 1;
     char tcgbuffer[TCG_BUFFER_SIZE];
+    char *data;
+    char *chunk;
+    struct measure_cache_entry *entry;
     int old_decompression_value;
 
 #ifdef DEBUG
     printf("Calculating SHA1 for file: %s\n",filename);
 #endif
-    /* Open the input file */
-    fd1 = grub_open(filename);
+    /* Open the input file as it is stored on disk: a gzip'd file is
+       measured in its compressed form, as grub_read measures it for the
+       loaders, so it is neither probed nor opened twice */
     old_decompression_value=no_decompression;
+    no_decompression=1;
+    fd1 = grub_open(filename);
+    filesize = filemax;
 
-    if (compressed_file)
-    {
-#ifdef DEBUG
-        printf("File is compressed, reloading\n");
-#endif
-	grub_close();
-	no_decompression=1;
-	fd1 = grub_open(filename);
-	compressed_file = 0;
 #ifdef DEBUG
-	printf("The compressed file size is %d\n",filemax);
+    printf("Opened %s with size: %d\n",filename,filesize);
 #endif
+
+    if (!fd1 || !filesize)
+    {
+	no_decompression = old_decompression_value;
+	return -1;
     }
-    filesize = filemax;
 
+    /* A file hashed before needs no second pass */
+    entry = measure_cache_lookup ();
+    if (entry)
+    {
 #ifdef DEBUG
-    printf("Opened %s with size: %d\n",filename,filesize);
+	printf("Using the cached SHA1 of %s\n",filename);
 #endif
+	for (i=0; i<5; i++)
+	    sha1_result[i] = entry->digest[i];
+	grub_close();
+	no_decompression = old_decompression_value;
+	goto print;
+    }
 
-    if (!filesize)
-	return -1;
+    /* Keep a copy of the file for a later load, if there is room */
+    data = measure_cache_alloc (filesize);
     
     /* Initialise SHA1-Context */
     sha1_context my_sha1_context;
     result = sha1_init(&my_sha1_context);
     if (result)
-        return -1;
+	goto fail;
 
     /* calculate rounds */
     bytes_to_copy = filesize; 
@@ -414,24 +368,29 @@ int calculate_sha1(char* filename, t_U32 *sha1_result, int print_results)
 #endif
 
         memset(tcgbuffer,0,TCG_BUFFER_SIZE);
-    if (compressed_file)
-    {
-        printf("File is still compressed, giving up...\n");
-	grub_close();
-	no_decompression = old_decompression_value;
-	return -1;
-    }
 
+	    chunk = data ? data : tcgbuffer;
 	    while (bytes_to_copy > TCG_BUFFER_SIZE)
 	    {
 #ifdef DEBUG
 		printf("Round %d (%d Bytes to go)\n",round,bytes_to_copy);
 #endif
-		grub_read(tcgbuffer,TCG_BUFFER_SIZE);
-    		result = sha1_update(&my_sha1_context, tcgbuffer, TCG_BUFFER_SIZE);
-		if (result)
-		    return -1;
+		// A short read would hash, and cache, a wrong digest
+		if (grub_read(chunk,TCG_BUFFER_SIZE) != TCG_BUFFER_SIZE)
+		    goto short_read;
+		// Chunks kept in the arena can be hashed while the next is read
+		if (data)
+		    sha1_update_queued(&my_sha1_context, (t_U8 *) chunk, TCG_BUFFER_SIZE);
+		else
+		{
+		    sha1_wait();
+		    result = sha1_update(&my_sha1_context, (t_U8 *) chunk, TCG_BUFFER_SIZE);
+		    if (result)
+			goto fail;
+		}
     		bytes_to_copy = bytes_to_copy - TCG_BUFFER_SIZE;
+		if (data)
+		    chunk += TCG_BUFFER_SIZE;
 		round++;
 	    }
 
@@ -439,17 +398,25 @@ int calculate_sha1(char* filename, t_U32 *sha1_result, int print_results)
 #ifdef DEBUG
 	    printf("Round %d (Last %d Bytes)\n",round,bytes_to_copy);
 #endif
-	    memset(tcgbuffer,0,TCG_BUFFER_SIZE);
-	    grub_read(tcgbuffer,bytes_to_copy);
-    	    result = sha1_update(&my_sha1_context, tcgbuffer, bytes_to_copy);
+	    if (!data)
+	    {
+		chunk = tcgbuffer;
+		memset(tcgbuffer,0,TCG_BUFFER_SIZE);
+	    }
+	    if (grub_read(chunk,bytes_to_copy) != bytes_to_copy)
+		goto short_read;
+	    sha1_wait();
+    	    result = sha1_update(&my_sha1_context, (t_U8 *) chunk, bytes_to_copy);
     	    if (result)
-		return -1;
+		goto fail;
 
     grub_close();
     result = sha1_finish(&my_sha1_context, sha1_result);
     no_decompression = old_decompression_value;
     if (result)
 	return -1;
+    measure_cache_insert (sha1_result, data);
+ print:
     if (print_results)
     {
 	printf("SHA1-result for: %s ",filename);
@@ -460,4 +427,15 @@ int calculate_sha1(char* filename, t_U32 *sha1_result, int print_results)
 	printf("\n");
     }
     return 0;
+
+ short_read:
+    if (!errnum)
+	errnum = ERR_READ;
+ fail:
+    /* Every failure after the open: let the queued chunks finish, close
+       the file and let later opens decompress again */
+    sha1_wait();
+    grub_close();
+    no_decompression = old_decompression_value;
+    return -1;
 }
@@ -0,0 +1,573 @@
+/*      This file contains the SHA1-implementation of the Trusted GRUB project,
+	shared by stage2 (stage2/sha1.c) and the utilities (util/sha1.c), which
+	include it after defining t_U8, t_U32 and sha1_context. t_U32 has to
+	be 32 bits wide. The SHA1-implementation has been written by
+        Marko Wolf <mwolf@crypto.rub.de> and tested according to FIPS-180.
+	The SHA1-macros are from "Christophe Devine" <devine@cr0.net>.
+        For reuasage of the SHA1-implementation, please contact the original authors.
+
+	The compression function comes in three engines: a portable one, one
+	computing the message schedule with SSSE3 and one using the Intel SHA
+	extensions. The best engine supported by the CPU is selected by CPUID
+	on the first sha1_init. Stage2 defines SHA1_ENABLE_SSE, so that SSE
+	is switched on in CR0/CR4 before it is used; an OS has done so for
+	the utilities.
+
+	Parameters:
+
+        int sha1_init(sha1_context *ctx )
+	int sha1_update(sha1_context *ctx, t_U8 *chunk_data, t_U32 chunk_length)
+	int sha1_finish(sha1_context *ctx, t_U32 *sha1_hash)
+	int sha1_engine_supported(int engine)
+	int sha1_select_engine(int engine)
+*/
+
+// concatenates 4 × 8-bit words (= 1 byte) to one 32-bit word
+#define CONCAT_4_BYTES( w32, w8, w8_i)            \
+{                                                 \
+    (w32) = ( (t_U32) (w8)[(w8_i)    ] << 24 ) |  \
+            ( (t_U32) (w8)[(w8_i) + 1] << 16 ) |  \
+            ( (t_U32) (w8)[(w8_i) + 2] <<  8 ) |  \
+            ( (t_U32) (w8)[(w8_i) + 3]       );   \
+}
+
+// splits a 32-bit word into 4 × 8-bit words (= 1 byte)
+#define SPLIT_INTO_4_BYTES( w32, w8, w8_i)        \
+{                                                 \
+    (w8)[(w8_i)    ] = (t_U8) ( (w32) >> 24 );    \
+    (w8)[(w8_i) + 1] = (t_U8) ( (w32) >> 16 );    \
+    (w8)[(w8_i) + 2] = (t_U8) ( (w32) >>  8 );    \
+    (w8)[(w8_i) + 3] = (t_U8) ( (w32)       );    \
+}
+
+// FIPS-180-1 padding sequence
+static t_U8 sha1_padding[64] =
+{
+ (t_U8) 0x80, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0,
+ (t_U8)    0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0,
+ (t_U8)    0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0,
+ (t_U8)    0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0, (t_U8) 0
+};
+
+// The round constants
+#define K1 0x5A827999
+#define K2 0x6ED9EBA1
+#define K3 0x8F1BBCDC
+#define K4 0xCA62C1D6
+
+// The round functions
+#define F1(x,y,z) (z ^ (x & (y ^ z)))
+#define F2(x,y,z) (x ^ y ^ z)
+#define F3(x,y,z) ((x & y) | (z & (x | y)))
+#define F4(x,y,z) (x ^ y ^ z)
+
+// rotate left by n bits
+#define ROTATE_N_LEFT(x,n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+// one round with Wi already containing the word of the message schedule
+#define P(a,b,c,d,e,F,Wi)                             \
+{                                                     \
+    e += ROTATE_N_LEFT(a,5) + F(b,c,d) + (Wi);        \
+    b = ROTATE_N_LEFT(b,30);                          \
+}
+
+// five rounds, after which the variables are back in place
+#define P5(F,W,t)                                     \
+{                                                     \
+    P( A, B, C, D, E, F, W(t)     );                  \
+    P( E, A, B, C, D, F, W(t + 1) );                  \
+    P( D, E, A, B, C, F, W(t + 2) );                  \
+    P( C, D, E, A, B, F, W(t + 3) );                  \
+    P( B, C, D, E, A, F, W(t + 4) );                  \
+}
+
+// the word t of the message schedule plus its round constant, kept in a
+// ring of 16 words
+#define RING_W(t)                                     \
+    ((t) < 16 ? W[(t)] : (W[(t) & 15] = ROTATE_N_LEFT(W[((t) - 3) & 15] ^ \
+        W[((t) - 8) & 15] ^ W[((t) - 14) & 15] ^ W[(t) & 15], 1)))
+#define RING_W1(t) (RING_W(t) + K1)
+#define RING_W2(t) (RING_W(t) + K2)
+#define RING_W3(t) (RING_W(t) + K3)
+#define RING_W4(t) (RING_W(t) + K4)
+
+// The portable engine
+static void sha1_blocks_scalar(t_U32 *vector, t_U8 *data, t_U32 blocks)
+{
+  // declarations
+  t_U32 W[16];
+  t_U32 A, B, C, D, E;
+  int i;
+
+  for ( ; blocks > 0; blocks--, data += 64)
+  {
+    // concatenate 64 bytes to 16 × 32-bit words
+    for (i = 0; i < 16; i++)
+      CONCAT_4_BYTES( W[i], data, 4 * i );
+
+    A = vector[0];
+    B = vector[1];
+    C = vector[2];
+    D = vector[3];
+    E = vector[4];
+
+    P5( F1, RING_W1,  0 ); P5( F1, RING_W1,  5 );
+    P5( F1, RING_W1, 10 ); P5( F1, RING_W1, 15 );
+    P5( F2, RING_W2, 20 ); P5( F2, RING_W2, 25 );
+    P5( F2, RING_W2, 30 ); P5( F2, RING_W2, 35 );
+    P5( F3, RING_W3, 40 ); P5( F3, RING_W3, 45 );
+    P5( F3, RING_W3, 50 ); P5( F3, RING_W3, 55 );
+    P5( F4, RING_W4, 60 ); P5( F4, RING_W4, 65 );
+    P5( F4, RING_W4, 70 ); P5( F4, RING_W4, 75 );
+
+    // assign vectors
+    vector[0] += A;
+    vector[1] += B;
+    vector[2] += C;
+    vector[3] += D;
+    vector[4] += E;
+  }
+}
+
+// The CPU specific engines need the vector extensions and builtins of
+// GCC 4.9 or later, which work without any system header
+#if (defined(__i386__) || defined(__x86_64__)) && \
+    (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+# define SHA1_X86_ENGINES 1
+#endif
+
+#ifdef SHA1_X86_ENGINES
+
+typedef int sha1_v4si __attribute__ ((vector_size (16)));
+typedef unsigned int sha1_v4su __attribute__ ((vector_size (16)));
+typedef char sha1_v16qi __attribute__ ((vector_size (16)));
+
+// The stack of stage2 is not necessarily aligned to 16 bytes
+#ifdef __i386__
+# define SHA1_SSE_FUNCTION(isa) __attribute__ ((target (isa), force_align_arg_pointer))
+#else
+# define SHA1_SSE_FUNCTION(isa) __attribute__ ((target (isa)))
+#endif
+
+// load 16 bytes of the message and swap the bytes of each word
+#define SSSE3_LOAD(v, data)                                         \
+{                                                                   \
+    sha1_v16qi bytes;                                               \
+    __builtin_memcpy(&bytes, (data), 16);                           \
+    bytes = __builtin_shuffle(bytes, (sha1_v16qi) {3, 2, 1, 0,      \
+        7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12});                 \
+    (v) = (sha1_v4su) bytes;                                        \
+}
+
+#define SSSE3_W(t) (wk[(t) / 4][(t) & 3])
+
+// The engine computing the message schedule four words at a time
+SHA1_SSE_FUNCTION("ssse3")
+static void sha1_blocks_ssse3(t_U32 *vector, t_U8 *data, t_U32 blocks)
+{
+  // declarations
+  sha1_v4su w[20], wk[20], tmp, fix;
+  sha1_v4su zero = {0, 0, 0, 0};
+  t_U32 A, B, C, D, E;
+  int j;
+
+  for ( ; blocks > 0; blocks--, data += 64)
+  {
+    for (j = 0; j < 4; j++)
+      SSSE3_LOAD( w[j], data + 16 * j );
+
+    // W[t] = rol(W[t-3] ^ W[t-8] ^ W[t-14] ^ W[t-16], 1) for t..t+3,
+    // where W[t+3] depends on W[t] computed in the same step
+    for (j = 4; j < 20; j++)
+    {
+      tmp = w[j - 4]
+	  ^ __builtin_shuffle(w[j - 4], w[j - 3], (sha1_v4su) {2, 3, 4, 5})
+	  ^ w[j - 2]
+	  ^ __builtin_shuffle(w[j - 1], zero, (sha1_v4su) {1, 2, 3, 4});
+      fix = __builtin_shuffle(zero, tmp, (sha1_v4su) {0, 1, 2, 4});
+      w[j] = ((tmp << 1) | (tmp >> 31)) ^ ((fix << 2) | (fix >> 30));
+    }
+
+    for (j = 0; j < 20; j++)
+      wk[j] = w[j] + (j < 5 ? K1 : j < 10 ? K2 : j < 15 ? K3 : K4);
+
+    A = vector[0];
+    B = vector[1];
+    C = vector[2];
+    D = vector[3];
+    E = vector[4];
+
+    P5( F1, SSSE3_W,  0 ); P5( F1, SSSE3_W,  5 );
+    P5( F1, SSSE3_W, 10 ); P5( F1, SSSE3_W, 15 );
+    P5( F2, SSSE3_W, 20 ); P5( F2, SSSE3_W, 25 );
+    P5( F2, SSSE3_W, 30 ); P5( F2, SSSE3_W, 35 );
+    P5( F3, SSSE3_W, 40 ); P5( F3, SSSE3_W, 45 );
+    P5( F3, SSSE3_W, 50 ); P5( F3, SSSE3_W, 55 );
+    P5( F4, SSSE3_W, 60 ); P5( F4, SSSE3_W, 65 );
+    P5( F4, SSSE3_W, 70 ); P5( F4, SSSE3_W, 75 );
+
+    // assign vectors
+    vector[0] += A;
+    vector[1] += B;
+    vector[2] += C;
+    vector[3] += D;
+    vector[4] += E;
+  }
+}
+
+// load 16 bytes of the message in the order used by the SHA extensions
+#define SHANI_LOAD(v, data)                                         \
+{                                                                   \
+    sha1_v16qi bytes;                                               \
+    __builtin_memcpy(&bytes, (data), 16);                           \
+    bytes = __builtin_shuffle(bytes, (sha1_v16qi) {15, 14, 13, 12,  \
+        11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0});                     \
+    (v) = (sha1_v4si) bytes;                                        \
+}
+
+// rounds 4*g to 4*g+3; CUR holds their message words, NEXT, MID and PREV
+// those of the following groups, which are completed on the way
+#define SHANI_ROUNDS(g, f, ecur, eoth, cur, next, mid, prev)        \
+{                                                                   \
+    ecur = __builtin_ia32_sha1nexte(ecur, cur);                     \
+    eoth = abcd;                                                    \
+    if ((g) >= 3 && (g) <= 18)                                      \
+	next = __builtin_ia32_sha1msg2(next, cur);                  \
+    abcd = __builtin_ia32_sha1rnds4(abcd, ecur, f);                 \
+    if ((g) >= 1 && (g) <= 16)                                      \
+	prev = __builtin_ia32_sha1msg1(prev, cur);                  \
+    if ((g) >= 2 && (g) <= 17)                                      \
+	mid ^= cur;                                                 \
+}
+
+// The engine using the SHA extensions
+SHA1_SSE_FUNCTION("ssse3,sha")
+static void sha1_blocks_shani(t_U32 *vector, t_U8 *data, t_U32 blocks)
+{
+  // declarations
+  sha1_v4si abcd, abcd_save, e0, e0_save, e1;
+  sha1_v4si msg0, msg1, msg2, msg3;
+
+  abcd = (sha1_v4si) {vector[3], vector[2], vector[1], vector[0]};
+  e0 = (sha1_v4si) {0, 0, 0, vector[4]};
+
+  for ( ; blocks > 0; blocks--, data += 64)
+  {
+    abcd_save = abcd;
+    e0_save = e0;
+
+    // rounds 0 to 3
+    SHANI_LOAD( msg0, data );
+    e0 += msg0;
+    e1 = abcd;
+    abcd = __builtin_ia32_sha1rnds4(abcd, e0, 0);
+
+    SHANI_LOAD( msg1, data + 16 );
+    SHANI_ROUNDS(  1, 0, e1, e0, msg1, msg2, msg3, msg0 );
+    SHANI_LOAD( msg2, data + 32 );
+    SHANI_ROUNDS(  2, 0, e0, e1, msg2, msg3, msg0, msg1 );
+    SHANI_LOAD( msg3, data + 48 );
+    SHANI_ROUNDS(  3, 0, e1, e0, msg3, msg0, msg1, msg2 );
+    SHANI_ROUNDS(  4, 0, e0, e1, msg0, msg1, msg2, msg3 );
+    SHANI_ROUNDS(  5, 1, e1, e0, msg1, msg2, msg3, msg0 );
+    SHANI_ROUNDS(  6, 1, e0, e1, msg2, msg3, msg0, msg1 );
+    SHANI_ROUNDS(  7, 1, e1, e0, msg3, msg0, msg1, msg2 );
+    SHANI_ROUNDS(  8, 1, e0, e1, msg0, msg1, msg2, msg3 );
+    SHANI_ROUNDS(  9, 1, e1, e0, msg1, msg2, msg3, msg0 );
+    SHANI_ROUNDS( 10, 2, e0, e1, msg2, msg3, msg0, msg1 );
+    SHANI_ROUNDS( 11, 2, e1, e0, msg3, msg0, msg1, msg2 );
+    SHANI_ROUNDS( 12, 2, e0, e1, msg0, msg1, msg2, msg3 );
+    SHANI_ROUNDS( 13, 2, e1, e0, msg1, msg2, msg3, msg0 );
+    SHANI_ROUNDS( 14, 2, e0, e1, msg2, msg3, msg0, msg1 );
+    SHANI_ROUNDS( 15, 3, e1, e0, msg3, msg0, msg1, msg2 );
+    SHANI_ROUNDS( 16, 3, e0, e1, msg0, msg1, msg2, msg3 );
+    SHANI_ROUNDS( 17, 3, e1, e0, msg1, msg2, msg3, msg0 );
+    SHANI_ROUNDS( 18, 3, e0, e1, msg2, msg3, msg0, msg1 );
+    SHANI_ROUNDS( 19, 3, e1, e0, msg3, msg0, msg1, msg2 );
+
+    // add the state before this block
+    e0 = __builtin_ia32_sha1nexte(e0, e0_save);
+    abcd += abcd_save;
+  }
+
+  vector[0] = abcd[3];
+  vector[1] = abcd[2];
+  vector[2] = abcd[1];
+  vector[3] = abcd[0];
+  vector[4] = e0[3];
+}
+
+// CPUID leaf LEAF into REGS (eax, ebx, ecx, edx)
+static void sha1_cpuid(t_U32 leaf, t_U32 *regs)
+{
+  unsigned int a, b, c, d;
+
+  __asm__ __volatile__ ("cpuid"
+			: "=a" (a), "=b" (b), "=c" (c), "=d" (d)
+			: "a" (leaf), "c" (0));
+  regs[0] = a;
+  regs[1] = b;
+  regs[2] = c;
+  regs[3] = d;
+}
+
+// Return non-zero if the CPU has the CPUID instruction
+static int sha1_have_cpuid(void)
+{
+#ifdef __i386__
+  unsigned int before, after;
+
+  // CPUID is there if the ID flag in EFLAGS can be changed
+  __asm__ __volatile__ ("pushfl\n\t"
+			"popl %0\n\t"
+			"movl %0, %1\n\t"
+			"xorl $0x200000, %1\n\t"
+			"pushl %1\n\t"
+			"popfl\n\t"
+			"pushfl\n\t"
+			"popl %1\n\t"
+			"pushl %0\n\t"
+			"popfl"
+			: "=&r" (before), "=&r" (after));
+  return (before ^ after) & 0x200000;
+#else
+  return 1;
+#endif
+}
+
+#ifdef SHA1_ENABLE_SSE
+// Allow SSE instructions: clear CR0.EM, set CR0.MP, CR4.OSFXSR and
+// CR4.OSXMMEXCPT
+static void sha1_enable_sse(void)
+{
+  unsigned long reg;
+
+  __asm__ __volatile__ ("movl %%cr0, %0\n\t"
+			"andl $~0x4, %0\n\t"
+			"orl $0x2, %0\n\t"
+			"movl %0, %%cr0\n\t"
+			"movl %%cr4, %0\n\t"
+			"orl $0x600, %0\n\t"
+			"movl %0, %%cr4"
+			: "=&r" (reg));
+}
+#endif
+
+#endif /* SHA1_X86_ENGINES */
+
+// The engines, in order of preference
+#define SHA1_ENGINE_SCALAR	0
+#define SHA1_ENGINE_SSSE3	1
+#define SHA1_ENGINE_SHANI	2
+#define SHA1_ENGINES		3
+
+char *sha1_engine_names[SHA1_ENGINES] = { "scalar", "ssse3", "sha-ni" };
+
+static void (*sha1_engines[SHA1_ENGINES])(t_U32 *vector, t_U8 *data, t_U32 blocks) =
+{
+  sha1_blocks_scalar,
+#ifdef SHA1_X86_ENGINES
+  sha1_blocks_ssse3,
+  sha1_blocks_shani,
+#endif
+};
+
+// The selected engine, -1 before the first sha1_init
+int sha1_engine = -1;
+static void (*sha1_blocks)(t_U32 *vector, t_U8 *data, t_U32 blocks);
+
+// Return non-zero if the CPU supports the engine ENGINE
+int sha1_engine_supported(int engine)
+{
+#ifdef SHA1_X86_ENGINES
+  t_U32 regs[4];
+  int ssse3;
+
+  if (engine == SHA1_ENGINE_SCALAR)
+    return 1;
+  if (engine < 0 || engine >= SHA1_ENGINES || !sha1_have_cpuid())
+    return 0;
+
+  sha1_cpuid(0, regs);
+  if (regs[0] < 1)
+    return 0;
+  sha1_cpuid(1, regs);
+  // SSE, SSE2 and SSSE3
+  ssse3 = (regs[3] & (1 << 25)) && (regs[3] & (1 << 26)) && (regs[2] & (1 << 9));
+  if (engine == SHA1_ENGINE_SSSE3 || !ssse3)
+    return ssse3;
+
+  sha1_cpuid(0, regs);
+  if (regs[0] < 7)
+    return 0;
+  sha1_cpuid(7, regs);
+  return (regs[1] & (1 << 29)) != 0;
+#else
+  return engine == SHA1_ENGINE_SCALAR;
+#endif
+}
+
+// Use the engine ENGINE, or the best one if ENGINE is -1. Return the
+// engine selected, or -1 if ENGINE is not supported.
+int sha1_select_engine(int engine)
+{
+  if (engine < 0)
+  {
+    for (engine = SHA1_ENGINES - 1; engine > 0; engine--)
+      if (sha1_engine_supported(engine))
+	break;
+  }
+  else if (!sha1_engine_supported(engine))
+    return -1;
+
+#if defined(SHA1_X86_ENGINES) && defined(SHA1_ENABLE_SSE)
+  if (engine != SHA1_ENGINE_SCALAR)
+    sha1_enable_sse();
+#endif
+
+  sha1_engine = engine;
+  sha1_blocks = sha1_engines[engine];
+  return engine;
+}
+
+int sha1_init(sha1_context *ctx )
+{
+
+  // parameter check
+  if ( ctx == NULL )
+  {
+    return -1;
+  }
+
+  if ( sha1_engine < 0 )
+    sha1_select_engine( -1 );
+
+  // byte length = 0
+  ctx->total_bytes_Lo = 0;
+  ctx->total_bytes_Hi = 0;
+
+  // FIPS 180-1 init values
+  ctx->vector[0] = 0x67452301;
+  ctx->vector[1] = 0xEFCDAB89;
+  ctx->vector[2] = 0x98BADCFE;
+  ctx->vector[3] = 0x10325476;
+  ctx->vector[4] = 0xC3D2E1F0;
+
+  // successful
+  return 0;
+}
+
+int sha1_update(sha1_context *ctx, t_U8 *chunk_data, t_U32 chunk_length)
+{
+
+  // declarations
+  t_U32 left, fill;
+  t_U32 i;
+
+  // parameter check
+  if ( (ctx == NULL) || (chunk_data == NULL) || (chunk_length < 1) )
+  {
+    return -1;
+  }
+
+  // chunk_length = n * 64 byte + left
+  left = ctx->total_bytes_Lo & 0x3F;
+
+  // fill bytes remain to 64 byte block
+  fill = 64 - left;
+
+  // total = total + chunk_length
+  ctx->total_bytes_Lo += chunk_length;
+
+  if ( ctx->total_bytes_Lo < chunk_length )
+  {
+    ctx->total_bytes_Hi++;
+  }
+
+  // if we have something in the buffer (left > 0) and
+  // the chunk has enougth data to fill a 64 byte block (chunk_length >= fill)
+  if ( (left > 0) && (chunk_length >= fill) )
+  {
+     // fill buffer with data from new chunk
+     for ( i = 0; i < fill; i++ )
+     {
+        ctx->buffer[left + i] = chunk_data[i];
+     }
+
+     // process 64 byte buffer block
+     sha1_blocks( ctx->vector, ctx->buffer, 1 );
+
+     // dec chunk_length by fill
+     chunk_length -= fill;
+
+     // move data pointer by fill
+     chunk_data  += fill;
+
+     // buffer is fully processed
+     left = 0;
+  }
+
+  // process all remaining 64 byte chunks at once
+  if ( chunk_length >= 64 )
+  {
+     sha1_blocks( ctx->vector, chunk_data, chunk_length / 64 );
+     chunk_data += chunk_length & ~0x3F;
+     chunk_length &= 0x3F;
+  }
+
+  // if final chunk_length between 1..63 byte
+  if ( chunk_length > 0 )
+  {
+     // append remainder to 64 byte into buffer resp. fill the empty buffer
+     for ( i = 0; i < chunk_length; i++ )
+     {
+       ctx->buffer[left + i] = chunk_data[i];
+     }
+  }
+
+  // successfull
+  return 0;
+}
+
+int sha1_finish(sha1_context *ctx, t_U32 *sha1_hash)
+{
+
+  // declarations
+  t_U32 last, padn;
+  t_U32 high, low;
+  t_U8  msglen[8];
+
+  // parameter check
+  if ( (ctx == NULL) || (sha1_hash == NULL) )
+  {
+    return -1;
+  }
+
+  // build msglen array[8 × 8-bit] from total[2 × 32-bit] = n × 64 byte
+  high = ( ctx->total_bytes_Lo >> 29 ) | ( ctx->total_bytes_Hi <<  3 );
+  low  = ( ctx->total_bytes_Lo <<  3 );
+  SPLIT_INTO_4_BYTES( high, msglen, 0 );
+  SPLIT_INTO_4_BYTES( low,  msglen, 4 );
+
+  // total = n × 64 bytes + last
+  last = ctx->total_bytes_Lo & 0x3F;
+
+  // number of padding zeros
+  padn = ( last < 56 ) ? ( 56 - last ) : ( 120 - last );
+
+  // update SHA-1 context with remaining buffer and padding to 64 bytes with bit sequence (1,0,...,0)
+  sha1_update( ctx, sha1_padding, padn );
+
+  // update SHA-1 context with total length
+  sha1_update( ctx, msglen, 8 );
+
+  // assign final hash words
+  sha1_hash[0] = ctx->vector[0];
+  sha1_hash[1] = ctx->vector[1];
+  sha1_hash[2] = ctx->vector[2];
+  sha1_hash[3] = ctx->vector[3];
+  sha1_hash[4] = ctx->vector[4];
+
+  // successful
+  return 0;
+}
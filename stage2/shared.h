@@ -83,6 +83,15 @@ extern char *grub_scratch_mem;
 #define BUFFERADDR  RAW_ADDR (0x70000)
 #define BUFFERSEG   RAW_SEG (0x7000)
 
+/*
+ *  The buffer for extended reads of many sectors at once. It shares the
+ *  segment of the TCG buffer, below the TPM request block at 0xF012.
+ */
+
+#define LARGE_BUFFERLEN   0xF000
+#define LARGE_BUFFERADDR  RAW_ADDR (0x80000)
+#define LARGE_BUFFERSEG   RAW_SEG (0x8000)
+
 #define BOOT_PART_TABLE	RAW_ADDR (0x07be)
 
 /*
@@ -93,6 +102,9 @@ extern char *grub_scratch_mem;
 #define BIOSDISK_ERROR_GEOMETRY		0x100
 #define BIOSDISK_FLAG_LBA_EXTENSION	0x1
 #define BIOSDISK_FLAG_CDROM		0x2
+#define BIOSDISK_FLAG_FLAT_ADDRESS	0x4
+/* The most sectors that many BIOSes transfer in one extended read.  */
+#define BIOSDISK_MAX_SECTORS		127
 
 /*
  *  This is the filesystem (not raw device) buffer.
@@ -169,6 +181,9 @@ extern char *grub_scratch_mem;
 
 #define LINUX_FLAG_BIG_KERNEL		0x1
 
+/* tGRUB: The type of the setup data holding the TCG event log ("tGRB").  */
+#define LINUX_SETUP_TCG_EVENT_LOG	0x74475242
+
 /* Linux's video mode selection support. Actually I hate it!  */
 #define LINUX_VID_MODE_NORMAL		0xFFFF
 #define LINUX_VID_MODE_EXTENDED		0xFFFE
@@ -217,6 +232,10 @@ extern char *grub_scratch_mem;
 #define STAGE2_FORCE_LBA	0x11
 #define STAGE2_VER_STR_OFFS	0x12
 
+/* The offset in the start sector of stage2 of the length of the data
+   behind it that start.S hashes into PCR 9.  */
+#define STAGE2_HASH_LEN_OFFS	0x4
+
 /* Stage 2 identifiers */
 #define STAGE2_ID_STAGE2		0
 #define STAGE2_ID_FFS_STAGE1_5		1
@@ -435,6 +454,25 @@ struct linux_kernel_header
   unsigned short pad1;			/* Unused */
   char *cmd_line_ptr;			/* Points to the kernel command line */
   unsigned long initrd_addr_max;	/* The highest address of initrd */
+  unsigned long kernel_alignment;	/* Alignment of a relocatable kernel */
+  unsigned char relocatable_kernel;	/* If the kernel is relocatable */
+  unsigned char min_alignment;		/* Minimal alignment (as a power of 2) */
+  unsigned short xloadflags;		/* More boot protocol option flags */
+  unsigned long cmdline_size;		/* The maximal size of the command line */
+  unsigned long hardware_subarch;	/* The hardware subarchitecture */
+  unsigned long long hardware_subarch_data; /* Subarchitecture data */
+  unsigned long payload_offset;		/* The offset of the kernel payload */
+  unsigned long payload_length;		/* The length of the kernel payload */
+  unsigned long long setup_data;	/* List of struct linux_setup_data */
+} __attribute__ ((packed));
+
+/* An entry of the list of setup data, boot protocol 2.09 and later.  */
+struct linux_setup_data
+{
+  unsigned long long next;		/* The next entry, or 0 */
+  unsigned long type;			/* The type of the data */
+  unsigned long len;			/* The length of the data */
+  char data[0];
 } __attribute__ ((packed));
 
 /* Memory map address range descriptor used by GET_MMAP_ENTRY. */
@@ -566,6 +604,10 @@ typedef enum
   ERR_NO_DISK_SPACE,
   ERR_NUMBER_OVERFLOW,
   ERR_BADMODADDR,
+  ERR_VAR_OVERFLOW,
+  ERR_EVENT_LOG,
+  ERR_TPM_EXTEND,
+  ERR_EVENT_LOG_ROOM,
 
   MAX_ERR_NUM
 } grub_error_t;
@@ -598,6 +640,8 @@ extern int verbose;
 extern int read_only;
 /* The number of floppies to be probed.  */
 extern int floppy_disks;
+/* The flag for emulating EDD 3.0 reads to flat addresses.  */
+extern int flat_reads;
 /* The map between BIOS drives and UNIX device file names.  */
 extern char **device_map;
 /* The filename which stores the information about a device map.  */
@@ -606,6 +650,28 @@ extern char *device_map_file;
 extern struct geometry *disks;
 /* Assign DRIVE to a device name DEVICE.  */
 extern void assign_device_name (int drive, const char *device);
+/* The menu entry to boot at once without a menu, or -1.  */
+extern int forced_entryno;
+/* Set to non-zero when control is passed to the booted OS.  */
+extern int boot_reached;
+/* The size of the simulated extended memory.  */
+extern unsigned long extended_memsize;
+/* If non-zero, TPM commands are carried out on EMULATED_PCR.  */
+extern int emulate_tpm;
+extern unsigned char emulated_pcr[24][20];
+extern void emulated_tpm_extend (int pcr, unsigned char *digest);
+/* Forward the TPM commands to swtpm at the Unix socket PATH.  */
+extern int emulated_tpm_connect (const char *path);
+/* The time each TPM command takes, and in addition each one through the
+   emulated TCG BIOS, in microseconds.  */
+extern unsigned long emulated_tpm_latency;
+extern unsigned long emulated_bios_latency;
+/* The number of TPM commands so far and the time they have taken.  */
+extern unsigned long emulated_tpm_commands;
+extern unsigned long emulated_tpm_usecs;
+/* If non-zero, the emulated TPM is reached through a TIS register model,
+   otherwise through the emulated TCG BIOS.  */
+extern int emulate_tis;
 #endif
 
 #ifndef STAGE1_5
@@ -684,6 +750,30 @@ extern int buf_drive;
 extern int buf_track;
 extern struct geometry buf_geom;
 
+/* The sector cache, kept in upper memory below the top INFLATE_MEM_GAP
+   bytes, which are left to the input buffer of gunzip, and below the
+   TCG_EVENT_LOG_SIZE bytes of the event log.  */
+#define INFLATE_MEM_GAP	0x100000
+#define TCG_EVENT_LOG_SIZE	0x40000
+
+extern int sector_cache_kb;
+extern unsigned long sector_cache_hits;
+extern unsigned long sector_cache_misses;
+unsigned long sector_cache_start (void);
+void sector_cache_invalidate (int drive);
+void sector_cache_forget (unsigned long addr, int len);
+void memory_forget (unsigned long addr, int len);
+void sector_cache_resize (int kb);
+int sector_cache_size (void);
+
+/* The dentry cache of resolved path prefixes, for the dir functions of
+   the filesystems.  */
+#define DENTRY_CACHE_DATA	16
+
+char *dentry_cache_lookup (char *path, void *data, int size);
+void dentry_cache_insert (char *path, char *end, void *data, int size);
+void dentry_cache_invalidate (void);
+
 /* these are the current file position and maximum file position */
 extern int filepos;
 extern int filemax;
@@ -842,15 +932,17 @@ int checkkey (void);
 int get_diskinfo (int drive, struct geometry *geometry);
 int biosdisk (int subfunc, int drive, struct geometry *geometry,
 	      int sector, int nsec, int segment);
+int biosdisk_flat (int subfunc, int drive, struct geometry *geometry,
+		   int sector, int nsec, unsigned long address);
 void stop_floppy (void);
 
 
 
 /* Variable definitions and functions. */
-#define VARIABLES_MAX		30
+#define VARIABLES_MAX		256
 
 char *var_get(char *);
-int var_sprint(char *, char *);
+int var_sprint(char *, int, char *);
 char *var_sprint_buf(char *, int *);
 int var_set(char *, char *, int);
 int toggle_print_status(int, int);
@@ -981,15 +1073,75 @@ typedef struct
 extern int sha1_init(sha1_context *ctx );
 extern int sha1_update(sha1_context *ctx, t_U8 *chunk_data, t_U32 chunk_length);
 extern int sha1_finish(sha1_context *ctx, t_U32 *sha1_hash);
+extern void sha1_setup_cpu (void);
+/* The engines of the compression function, in stage2/sha1_engine.c.  */
+extern int sha1_engine_supported (int engine);
+extern int sha1_select_engine (int engine);
+extern void sha1_update_queued (sha1_context *ctx, t_U8 *data, t_U32 len);
+extern void sha1_wait (void);
 extern int calculate_sha1 (char *filename, unsigned long *hash_result, int print_results);
 
 // global SHA1-context
 sha1_context my_sha1;
 
+/* Measurement cache. Files hashed by calculate_sha1 are remembered by
+   their drive, partition, first data sector and size, so that loading
+   them later with measurement on needs neither another disk pass nor
+   another SHA1 run. The functions are defined in the file stage2/sha1.c.*/
+struct measure_cache_entry
+{
+  unsigned long drive;
+  unsigned long partition;
+  unsigned long sector;		/* The disk sector the data starts at */
+  int size;			/* The size of the file on disk */
+  unsigned long digest[5];	/* SHA1 of the file */
+  char *data;			/* A copy of the file, or 0 if not retained */
+};
+
+extern struct measure_cache_entry *measure_cache_lookup (void);
+extern char *measure_cache_alloc (int size);
+extern void measure_cache_insert (unsigned long *hash_result, char *data);
+extern void measure_cache_forget (unsigned long addr, int len);
+extern void measure_cache_reset (void);
+
+/* Index of the files listed in checkfiles, so that loading one of them
+   later can be checked against its reference value without reading the
+   checkfile again. The functions are defined in the file stage2/sha1.c.*/
+extern int checkfile_index_add (char *filename, unsigned long *digest);
+extern unsigned long *checkfile_index_lookup (char *filename);
+
+/* Event log in the format of the TCG PC Client specification. The
+   functions are defined in the file stage2/eventlog.c.*/
+#define TCG_EV_NO_ACTION	0x03	/* Logged, but not extended */
+#define TCG_EV_IPL		0x0d	/* Extended into the PCR */
+
+struct tcg_pcr_event
+{
+  unsigned long pcr_index;
+  unsigned long event_type;
+  unsigned char digest[20];	/* The SHA1 value as sent to the TPM */
+  unsigned long event_size;
+  char event[0];		/* EVENT_SIZE bytes of event data */
+} __attribute__ ((packed));
+
+// Non-zero if PCR 12 is extended once for all commands before booting
+extern int cmdline_batch;
+extern int tcg_log_event (int pcr, int type, unsigned long *digest, char *data, int len);
+extern int tcg_log_extend (int pcr, unsigned long *digest);
+extern int tcg_cmdline_event (unsigned long *digest, char *cmdline);
+extern int tcg_cmdline_flush (void);
+extern char *tcg_event_log (int *len);
+extern unsigned long tcg_event_log_addr (void);
+extern void tcg_event_log_place (void);
+extern void tcg_event_log_forget (unsigned long addr, int len);
+
+/* Hand the event log over to the kernel to be booted. The function is
+   defined in the file stage2/boot.c.*/
+extern void tcg_event_log_handoff (void);
+
 // Extern variables needed for SHA1
 extern int perform_sha1;
 extern int sha1_byte_count;
-extern int measure_kernel;
 extern int old_perform_sha1_value;
 extern int update_pcr(unsigned char pcr, unsigned long *hash_result);
 extern int xy;
@@ -1009,6 +1161,11 @@ long give_tpm_answer (void);
 // calls TCG_Extend_PCR. The parameters are given in the function "update_pcr" in stage2/boot.c
 void tcg_hash_extend_pcr (void);
 
+/* Defined in stage2/tpm_tis.c, which talks to a TIS TPM directly and
+   uses the two functions above only without one. */
+long tcg_find_tpm (void);
+int tcg_pass_through (void);
+
 /* End TCG extension */
 
 void init_page (void);
@@ -1027,6 +1184,9 @@ void grub_putstr (const char *str);
 /* Compression support. */
 int gunzip_test_header (void);
 int gunzip_read (char *buf, int len);
+/* Exchange the compressed and the uncompressed view of filepos, filemax
+   and fsmax.  */
+void gunzip_swap_values (void);
 #endif /* NO_DECOMPRESSION */
 
 int rawread (int drive, int sector, int byte_offset, int byte_len, char *buf);
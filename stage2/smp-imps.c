@@ -63,7 +63,7 @@
  */
 
 #define IMPS_DEBUG
-#define KERNEL_PRINT(x)         printf x
+#define KERNEL_PRINT(x)         do { if (imps_verbose) printf x; } while (0)
 #define CMOS_WRITE_BYTE(x, y)	cmos_write_byte(x, y)
 #define CMOS_READ_BYTE(x)	cmos_read_byte(x)
 #define PHYS_TO_VIRTUAL(x)	(x)
@@ -119,6 +119,11 @@ cmos_read_byte (int loc)
 #define CMOS_RESET_CODE			0xF
 #define		CMOS_RESET_JUMP		0xa
 #define CMOS_BASE_MEMORY		0x15
+#define IMPS_TRAMPOLINE_ADDR		0x1000
+#define IMPS_TRAMPOLINE_MAX		0x40
+#define IMPS_AP_STACK_SIZE		0x2000
+#define IMPS_AP_TIMEOUT			10	/* in BIOS ticks */
+#define IMPS_HASH_RING			64
 
 
 /*
@@ -255,6 +260,18 @@ defconfig =
  *  CPUs can be supported (true if zero).
  */
 static int imps_any_new_apics = 0;
+/*
+ *  "imps_verbose" is zero while the workers are started, so that the
+ *  probe does not print the configuration table.
+ */
+static int imps_verbose = 1;
+/*
+ *  "imps_want_worker" is non-zero if "boot_cpu" is to start the next
+ *  application processor as the hashing worker, whose APIC id is then
+ *  in "imps_hash_apic".
+ */
+static int imps_want_worker = 0;
+static int imps_hash_apic = -1;
 #if 0
 volatile int imps_release_cpus = 0;
 #endif
@@ -298,23 +315,138 @@ get_checksum (unsigned start, int length)
 }
 
 
+/*
+ *  The hashing worker.  The BSP queues the buffers it has read into a
+ *  ring, and the application processor started by "imps_hash_start"
+ *  runs sha1_update on them in order while the BSP goes on with the
+ *  next BIOS disk read.  Only the BSP moves "imps_hash_head" and only
+ *  the AP moves "imps_hash_tail", so the ring needs no lock.
+ */
+
+static struct
+  {
+    sha1_context *ctx;
+    t_U8 *data;
+    t_U32 len;
+  }
+imps_hash_ring[IMPS_HASH_RING];
+static volatile unsigned imps_hash_head, imps_hash_tail;
+
+/* The stack of the AP, which "ap_trampoline" loads from "imps_ap_stack" */
+static char imps_ap_stack_area[IMPS_AP_STACK_SIZE]
+  __attribute__ ((aligned (16)));
+unsigned imps_ap_stack;
+static volatile int imps_ap_alive;
+
+#define imps_barrier()	__asm __volatile ("" ::: "memory")
+
+void
+imps_ap_main (void)
+{
+  /* Allow the instructions the BSP hashes with */
+  sha1_setup_cpu ();
+  imps_ap_alive = 1;
+
+  for (;;)
+    {
+      unsigned tail = imps_hash_tail;
+
+      while (tail == imps_hash_head)
+	__asm __volatile ("pause");
+      imps_barrier ();
+
+      sha1_update (imps_hash_ring[tail % IMPS_HASH_RING].ctx,
+		   imps_hash_ring[tail % IMPS_HASH_RING].data,
+		   imps_hash_ring[tail % IMPS_HASH_RING].len);
+
+      imps_barrier ();
+      imps_hash_tail = tail + 1;
+    }
+}
+
+
+/*
+ *  Send the IPI "cmd" to the local APIC "apicid", and wait until it
+ *  has been accepted.  Returns 1 if it has.
+ */
+
+static int
+send_ipi (int apicid, unsigned cmd)
+{
+  int timeout;
+
+  IMPS_LAPIC_WRITE (LAPIC_ICR_HIGH,
+		    (IMPS_LAPIC_READ (LAPIC_ICR_HIGH) & LAPIC_DEST_MASK)
+		    | (apicid << 24));
+  IMPS_LAPIC_WRITE (LAPIC_ICR, cmd);
+
+  for (timeout = 1000000; timeout > 0; timeout--)
+    if (!(IMPS_LAPIC_READ (LAPIC_ICR) & LAPIC_ICR_STATUS_PEND))
+      return 1;
+
+  return 0;
+}
+
+
+/*
+ *  Put the CPU "apicid" back into the wait-for-SIPI state, as at power
+ *  up.  The 82489DX also needs the INIT deasserted.
+ */
+
+static void
+stop_cpu (int apicid)
+{
+  send_ipi (apicid, LAPIC_ICR_TRIG_LEVEL | LAPIC_ICR_LEVEL_ASSERT
+	    | LAPIC_ICR_DM_INIT);
+  send_ipi (apicid, LAPIC_ICR_TRIG_LEVEL | LAPIC_ICR_DM_INIT);
+}
+
+
+/* Wait until "ticks" BIOS timer ticks have passed, or the AP is alive. */
+
+static void
+wait_ticks (int ticks)
+{
+  int start = currticks ();
+
+  while (!imps_ap_alive && currticks () - start < ticks)
+    ;
+}
+
+
 /*
  *  Primary function for booting individual CPUs.
  *
- *  This must be modified to perform whatever OS-specific initialization
- *  that is required.
+ *  Only the hashing worker is started, if one is wanted; other CPUs
+ *  are just counted.
  */
 
 static int
 boot_cpu (imps_processor * proc)
 {
-  unsigned bootaddr, accept_status;
+  unsigned bootaddr = IMPS_TRAMPOLINE_ADDR;
+  /* an absolute address, not an object the compiler could bound */
+  volatile char *page = (volatile char *) bootaddr;
   unsigned bios_reset_vector = PHYS_TO_VIRTUAL (BIOS_RESET_VECTOR);
+  extern char ap_trampoline[], ap_trampoline_end[];
+  char saved[IMPS_TRAMPOLINE_MAX];
+  int size = ap_trampoline_end - ap_trampoline;
+  int i;
 
-  /* %%%%% ESB */
-  extern char patch_code[];
-  bootaddr = 256 * 1024;
-  memmove ((char *) bootaddr, patch_code, 32);
+  if (!imps_want_worker || imps_hash_apic >= 0 || size > IMPS_TRAMPOLINE_MAX)
+    {
+      KERNEL_PRINT (("\n"));
+      return 1;
+    }
+
+  /* The page below the real mode stack is only borrowed */
+  for (i = 0; i < size; i++)
+    {
+      saved[i] = page[i];
+      page[i] = ap_trampoline[i];
+    }
+  imps_ap_stack = (unsigned) imps_ap_stack_area + IMPS_AP_STACK_SIZE;
+  imps_ap_alive = 0;
 
   /*
    *  Generic CPU startup sequence starts here.
@@ -328,19 +460,28 @@ boot_cpu (imps_processor * proc)
   if (proc->apic_ver & 0x10)
     {
       IMPS_LAPIC_WRITE (LAPIC_ESR, 0);
-      accept_status = IMPS_LAPIC_READ (LAPIC_ESR);
+      IMPS_LAPIC_READ (LAPIC_ESR);
     }
 
-#if 0
-  /* assert INIT IPI */
-  cfg = IMPS_LAPIC_READ (LAPIC_ICR + 1);
-  cfg &= LAPIC_DEST_MASK;
-  IMPS_LAPIC_WRITE (LAPIC_ICR + 1, cfg);
-  cfg = IMPS_LAPIC_READ (LAPIC_ACR);
-  cfg &=;
-
-  /* %%%%% ESB finish adding startup sequence */
-#endif
+  /* INIT, after which the 82489DX starts at the BIOS reset vector */
+  stop_cpu (proc->apic_id);
+  wait_ticks (1);
+
+  /* the integrated APICs need STARTUP IPIs, the second one only if the
+     first has been lost */
+  if (proc->apic_ver & 0x10)
+    for (i = 0; i < 2 && !imps_ap_alive; i++)
+      {
+	send_ipi (proc->apic_id, LAPIC_ICR_LEVEL_ASSERT | LAPIC_ICR_DM_STARTUP
+		  | (bootaddr >> 12));
+	wait_ticks (1);
+      }
+
+  wait_ticks (IMPS_AP_TIMEOUT);
+
+  /* don't let a late CPU run into the page given back below */
+  if (!imps_ap_alive)
+    stop_cpu (proc->apic_id);
 
   /* clean up BIOS reset vector */
   CMOS_WRITE_BYTE (CMOS_RESET_CODE, 0);
@@ -350,11 +491,18 @@ boot_cpu (imps_processor * proc)
    *  Generic CPU startup sequence ends here.
    */
 
-  KERNEL_PRINT (("\n"));
+  for (i = 0; i < size; i++)
+    page[i] = saved[i];
 
-  return 1;
+  if (imps_ap_alive)
+    {
+      imps_hash_apic = proc->apic_id;
+      KERNEL_PRINT (("hashing worker\n"));
+    }
+  else
+    KERNEL_PRINT (("not responding\n"));
 
-  /* XXXXX add OS-specific initialization here! */
+  return 1;
 }
 
 
@@ -754,3 +902,91 @@ imps_probe (void)
 
   return 0;
 }
+
+
+/*
+ *  Start an application processor as the hashing worker, unless one is
+ *  running already.  Returns 1 if a worker is running.
+ */
+
+int
+imps_hash_start (void)
+{
+  if (imps_hash_apic >= 0)
+    return 1;
+
+  /* choose the SHA1 engine first, so the AP can follow the BSP */
+  sha1_setup_cpu ();
+  imps_hash_head = imps_hash_tail = 0;
+
+  imps_verbose = 0;
+  imps_want_worker = 1;
+  imps_probe ();
+  imps_want_worker = 0;
+  imps_verbose = 1;
+
+  return imps_hash_apic >= 0;
+}
+
+
+/*
+ *  Wait for the worker to finish the ring, then put it back into the
+ *  wait-for-SIPI state.  This must be done before the OS is entered.
+ */
+
+void
+imps_hash_stop (void)
+{
+  if (imps_hash_apic < 0)
+    return;
+
+  imps_hash_wait ();
+  stop_cpu (imps_hash_apic);
+  imps_hash_apic = -1;
+}
+
+
+int
+imps_hash_active (void)
+{
+  return imps_hash_apic >= 0;
+}
+
+
+/*
+ *  Queue "len" bytes at "data" to be hashed into "ctx" by the worker.
+ *  Returns 0 if there is no worker, so the caller must hash them.
+ */
+
+int
+imps_hash_queue (sha1_context *ctx, t_U8 *data, t_U32 len)
+{
+  unsigned head = imps_hash_head;
+
+  if (imps_hash_apic < 0)
+    return 0;
+
+  while (head - imps_hash_tail >= IMPS_HASH_RING)
+    __asm __volatile ("pause");
+
+  imps_hash_ring[head % IMPS_HASH_RING].ctx = ctx;
+  imps_hash_ring[head % IMPS_HASH_RING].data = data;
+  imps_hash_ring[head % IMPS_HASH_RING].len = len;
+
+  imps_barrier ();
+  imps_hash_head = head + 1;
+  return 1;
+}
+
+
+/*
+ *  Wait until the worker has hashed everything queued.
+ */
+
+void
+imps_hash_wait (void)
+{
+  while (imps_hash_tail != imps_hash_head)
+    __asm __volatile ("pause");
+  imps_barrier ();
+}
@@ -196,6 +196,28 @@ struct imps_interrupt
 
 int imps_probe (void);
 
+/*
+ *  The hashing worker, an application processor which runs sha1_update
+ *  on the buffers queued by the BSP.  "imps_hash_start" starts it and
+ *  returns 1 if it runs, "imps_hash_stop" puts it back into the
+ *  wait-for-SIPI state.  "imps_hash_queue" returns 0 if there is no
+ *  worker, and the data queued must not change until "imps_hash_wait"
+ *  has returned.
+ */
+
+int imps_hash_start (void);
+void imps_hash_stop (void);
+int imps_hash_active (void);
+int imps_hash_queue (sha1_context *ctx, t_U8 *data, t_U32 len);
+void imps_hash_wait (void);
+
+/*
+ *  The C entry of an application processor, called from the
+ *  trampoline in asm.S once it is in protected mode.
+ */
+
+void imps_ap_main (void);
+
 
 /*
  *  Defines that use variables
@@ -1143,25 +1143,40 @@ menu_restart:
 }
 
 
+/* The config file is read in chunks of CONFIG_BUFLEN bytes, since
+   every call of grub_read goes through the filesystem and, with
+   measurement on, through sha1_update.  */
+#define CONFIG_BUFLEN	0x1000
+
+static char config_buffer[CONFIG_BUFLEN];
+static int config_buffer_pos, config_buffer_len;
+
 static int
 get_line_from_config (char *cmdline, int maxlen, int read_from_file)
 {
   int pos = 0, literal = 0, comment = 0;
-  char c;  /* since we're loading it a byte at a time! */
+  char c;
   
   while (1)
     {
-      if (read_from_file)
-	{
-	  if (! grub_read (&c, 1))
-	    break;
-	}
-      else
+      if (config_buffer_pos == config_buffer_len)
 	{
-	  if (! read_from_preset_menu (&c, 1))
-	    break;
+	  config_buffer_pos = 0;
+	  if (read_from_file)
+	    config_buffer_len = grub_read (config_buffer, CONFIG_BUFLEN);
+	  else
+	    config_buffer_len = read_from_preset_menu (config_buffer,
+						       CONFIG_BUFLEN);
+
+	  if (config_buffer_len <= 0)
+	    {
+	      config_buffer_len = 0;
+	      break;
+	    }
 	}
 
+      c = config_buffer[config_buffer_pos++];
+
       /* Skip all carriage returns.  */
       if (c == '\r')
 	continue;
@@ -1252,7 +1267,7 @@ cmain (void)
     if (check_for_tpm())
     {
 	printf("Searching for TPM: ");
-	tcg_check_tpm();
+	tcg_find_tpm();
 	// Note that tpm_present() returns a 0 if we have a TPM, otherwise 0xbb00
 	if (tpm_present()) {
 	    printf("False!\nDisabling Trusted GRUB functions (result = %x)\n",tpm_present());
@@ -1351,6 +1366,9 @@ cmain (void)
 
 	      /* This is necessary, because the menu must be overrided.  */
 	      reset ();
+
+	      /* Nothing of a previous file may be left in the buffer.  */
+	      config_buffer_pos = config_buffer_len = 0;
 	      
 	      cmdline = (char *) CMDLINE_BUF;
 	      while (get_line_from_config (cmdline, NEW_HEAPSIZE,
@@ -1500,6 +1518,25 @@ cmain (void)
 	}
       else
 	{
+#ifdef GRUB_UTIL
+	  /* Boot the forced entry without any menu or key press, as the
+	     PCR prediction tool needs.  */
+	  if (forced_entryno >= 0)
+	    {
+	      if (forced_entryno < num_entries)
+		{
+		  perform_sha1 = 1;
+		  current_entryno = forced_entryno;
+		  run_script (get_entry (config_entries, forced_entryno, 1),
+			      menu_entries + menu_len);
+		}
+
+	      /* The entry has not been booted.  */
+	      errnum = ERR_BOOT_COMMAND;
+	      stop ();
+	    }
+#endif /* GRUB_UTIL */
+
 	  /* Run menu interface.  */
 	  run_menu (menu_entries, config_entries, num_entries,
 		    menu_entries + menu_len, default_entry);
@@ -0,0 +1,224 @@
+/*      This file contains the native TPM driver of the Trusted GRUB project.
+
+	A TPM 1.2 with the TPM Interface Specification (TIS) interface is
+	driven through the registers of locality 0 at 0xFED40000, from
+	protected mode, so that a TPM command needs neither the switches to
+	real mode nor the copies through TCG_SEG of the TCG BIOS. The
+	status is polled with timeouts, and the FIFO is written and read in
+	bursts of the size the TPM announces. Without a TIS TPM the BIOS
+	functions in stage2/asm.S are used as before. In the grub shell the
+	registers are those of the model in grub/asmstub.c.
+
+	Parameters:
+
+	long tcg_find_tpm(void)
+	int tcg_pass_through(void)
+*/
+
+#include "shared.h"
+#include "tpm_tis.h"
+
+/* The timeouts in BIOS timer ticks of 55 ms: A, B, C and D of the TIS
+   specification, and one for the execution of a command. */
+#define TIS_TIMEOUT_A		14
+#define TIS_TIMEOUT_B		37
+#define TIS_TIMEOUT_C		14
+#define TIS_TIMEOUT_D		14
+#define TIS_TIMEOUT_EXEC	1092
+
+#ifdef GRUB_UTIL
+# define tis_read(reg)		tis_model_read (reg)
+# define tis_write(reg, val)	tis_model_write (reg, val)
+#else
+# define tis_read(reg)		(*(volatile unsigned char *) (TIS_BASE + (reg)))
+# define tis_write(reg, val)	(*(volatile unsigned char *) (TIS_BASE + (reg)) = (val))
+
+// Set by tcg_check_tpm, and returned by tpm_present
+extern unsigned long tpm_bios;
+#endif
+
+// -1 before the first probe, then non-zero if there is a TIS TPM
+static int tis_found = -1;
+
+// Wait until the bits MASK of the register REG are VALUE
+static int tis_wait (int reg, int mask, int value, int ticks)
+{
+    int start = currticks ();
+
+    while ((tis_read (reg) & mask) != value)
+	if (currticks () - start > ticks)
+	    return 0;
+    return 1;
+}
+
+// Return the number of bytes the FIFO takes or has now, or 0 on timeout
+static int tis_burst_count (void)
+{
+    int start = currticks ();
+    int count;
+
+    do
+    {
+	count = tis_read (TIS_BURST_COUNT) | (tis_read (TIS_BURST_COUNT + 1) << 8);
+	if (count)
+	    return count;
+    }
+    while (currticks () - start <= TIS_TIMEOUT_D);
+
+    return 0;
+}
+
+static int tis_request_locality (void)
+{
+    int active = TIS_ACCESS_VALID | TIS_ACCESS_ACTIVE_LOCALITY;
+
+    if ((tis_read (TIS_ACCESS) & active) == active)
+	return 1;
+
+    tis_write (TIS_ACCESS, TIS_ACCESS_REQUEST_USE);
+    return tis_wait (TIS_ACCESS, active, active, TIS_TIMEOUT_A);
+}
+
+/* Return non-zero if a TPM answers at the TIS registers. */
+int tis_probe (void)
+{
+    unsigned long did_vid = 0;
+    int i;
+
+    if (tis_found >= 0)
+	return tis_found;
+
+    // Without a TPM nothing decodes the registers, and all bits are set
+    tis_found = 0;
+    if (tis_read (TIS_ACCESS) == 0xff
+	|| !(tis_read (TIS_ACCESS) & TIS_ACCESS_VALID))
+	return 0;
+
+    for (i = 3; i >= 0; i--)
+	did_vid = (did_vid << 8) | tis_read (TIS_DID_VID + i);
+    if (did_vid == 0 || did_vid == 0xffffffff)
+	return 0;
+
+    tis_found = 1;
+    return 1;
+}
+
+/* Send the TPM command of LEN bytes in BUF and read the response back
+   into BUF, which holds SIZE bytes. Return the length of the response,
+   or -1 on an error or a timeout. */
+int tis_transmit (unsigned char *buf, int len, int size)
+{
+    int active = TIS_STS_VALID | TIS_STS_DATA_AVAIL;
+    int expect = TIS_STS_VALID | TIS_STS_EXPECT;
+    int i, count, ret = -1;
+
+    if (len < TPM_HEADER_SIZE || size < TPM_HEADER_SIZE
+	|| !tis_request_locality ())
+	return -1;
+
+    // Abort whatever has been left over, and wait until the TPM is ready
+    tis_write (TIS_STS, TIS_STS_COMMAND_READY);
+    if (!tis_wait (TIS_STS, TIS_STS_COMMAND_READY, TIS_STS_COMMAND_READY,
+		   TIS_TIMEOUT_B))
+	goto out;
+
+    // All bytes but the last one, as many at a time as the TPM takes
+    for (i = 0; i < len - 1; )
+    {
+	count = tis_burst_count ();
+	if (!count)
+	    goto out;
+	while (count-- && i < len - 1)
+	    tis_write (TIS_DATA_FIFO, buf[i++]);
+	if (!tis_wait (TIS_STS, expect, expect, TIS_TIMEOUT_C))
+	    goto out;
+    }
+
+    // After the last one the TPM must not expect any more
+    tis_write (TIS_DATA_FIFO, buf[i]);
+    if (!tis_wait (TIS_STS, expect, TIS_STS_VALID, TIS_TIMEOUT_C))
+	goto out;
+
+    tis_write (TIS_STS, TIS_STS_GO);
+    if (!tis_wait (TIS_STS, active, active, TIS_TIMEOUT_EXEC))
+	goto out;
+
+    // The header tells the length of the whole response
+    len = TPM_HEADER_SIZE;
+    for (i = 0; i < len; )
+    {
+	count = tis_burst_count ();
+	if (!count)
+	    goto out;
+	while (count-- && i < len)
+	{
+	    buf[i++] = tis_read (TIS_DATA_FIFO);
+	    if (i == TPM_HEADER_SIZE)
+	    {
+		len = (buf[2] << 24) | (buf[3] << 16) | (buf[4] << 8) | buf[5];
+		if (len < TPM_HEADER_SIZE || len > size)
+		    goto out;
+	    }
+	}
+    }
+
+    if (tis_wait (TIS_STS, active, TIS_STS_VALID, TIS_TIMEOUT_C))
+	ret = len;
+
+ out:
+    // Back to idle, and leave the locality to the BIOS and the OS
+    tis_write (TIS_STS, TIS_STS_COMMAND_READY);
+    tis_write (TIS_ACCESS, TIS_ACCESS_ACTIVE_LOCALITY);
+    return ret;
+}
+
+/* Look for a TPM, through TIS first and the TCG BIOS otherwise. Return
+   the value tpm_present returns from now on: 0 if there is a TPM. */
+long tcg_find_tpm (void)
+{
+    if (tis_probe ())
+    {
+#ifndef GRUB_UTIL
+	tpm_bios = 0;
+#endif
+	return 0;
+    }
+
+    return tcg_check_tpm ();
+}
+
+/* Send the TPM command in the input parameter block that update_pcr has
+   built at TCG_BUFFER_ADDR + 0xF012, and leave the response in the
+   output parameter block at the same place, as TCG_PassThroughToTPM of
+   the BIOS does. Return 0 if the TPM has answered, or -1 if the command
+   could not be sent or no response has come back. */
+int tcg_pass_through (void)
+{
+    unsigned char *block = (unsigned char *) TCG_BUFFER_ADDR + 0xF012;
+    unsigned char buf[TPM_MAX_COMMAND];
+    int len;
+
+    if (!tis_probe ())
+    {
+	tcg_hash_extend_pcr ();
+	return give_tpm_answer () ? -1 : 0;
+    }
+
+    // The input parameter block: its length, the length of the output
+    // parameter block, each followed by 2 reserved bytes, and the command
+    len = (block[0] | (block[1] << 8)) - 8;
+    if (len < TPM_HEADER_SIZE || len > TPM_MAX_COMMAND)
+	return -1;
+    memmove (buf, block + 8, len);
+
+    len = tis_transmit (buf, len, sizeof (buf));
+    if (len < 0)
+	return -1;
+
+    // The output parameter block: its length, 2 reserved bytes, the response
+    block[0] = (len + 4) & 0xff;
+    block[1] = (len + 4) >> 8;
+    block[2] = block[3] = 0;
+    memmove (block + 4, buf, len);
+    return 0;
+}
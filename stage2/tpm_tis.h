@@ -0,0 +1,44 @@
+/*      This file contains the definitions of the TPM Interface Specification
+        (TIS) 1.2 for the Trusted GRUB project, which are shared by the
+        driver in stage2/tpm_tis.c and the register model of the grub
+        shell in grub/asmstub.c. */
+
+#ifndef TPM_TIS_H
+#define TPM_TIS_H
+
+/* The registers of locality 0 */
+#define TIS_BASE		0xFED40000
+#define TIS_ACCESS		0x00
+#define TIS_STS			0x18
+#define TIS_BURST_COUNT		0x19	/* 16 bits, in TIS_STS */
+#define TIS_DATA_FIFO		0x24
+#define TIS_DID_VID		0xF00	/* 32 bits */
+#define TIS_REGS		0x1000
+
+/* TIS_ACCESS */
+#define TIS_ACCESS_VALID		0x80
+#define TIS_ACCESS_ACTIVE_LOCALITY	0x20
+#define TIS_ACCESS_REQUEST_USE		0x02
+
+/* TIS_STS */
+#define TIS_STS_VALID		0x80
+#define TIS_STS_COMMAND_READY	0x40
+#define TIS_STS_GO		0x20
+#define TIS_STS_DATA_AVAIL	0x10
+#define TIS_STS_EXPECT		0x08
+
+/* A TPM 1.2 command or response starts with the tag, the size of the
+   whole and the ordinal resp. the return code, in big endian */
+#define TPM_HEADER_SIZE		10
+#define TPM_MAX_COMMAND		0x100
+
+#ifdef GRUB_UTIL
+/* The register model standing in for the TPM in the grub shell */
+unsigned char tis_model_read (int reg);
+void tis_model_write (int reg, unsigned char value);
+#endif
+
+int tis_probe (void);
+int tis_transmit (unsigned char *buf, int len, int size);
+
+#endif /* TPM_TIS_H */
@@ -6,32 +6,68 @@
         For reuasage of the SHA1-implementation, please contact the original author. */
 
 #include "sha1.c"
+#include <getopt.h>
+
+static struct option longopts[] =
+{
+  {"jobs", required_argument, 0, 'j'},
+  {"json", no_argument, 0, 'J'},
+  {0},
+};
+
 int main (int argc, char *argv[])
 {
-  char systemcall[1024];
-  int i;
-  t_U32 hash_result[5];
+  int i, j, c;
+  int jobs, json = 0;
+  t_U32 (*hash_results)[5];
 
-    if (argc == 1)
+    jobs = sha1_default_threads();
+    while ((c = getopt_long(argc, argv, "", longopts, NULL)) != -1)
     {
-        printf("Missing arguments! Usage: %s {filename}\n \n",argv[0]);
-        return -1;
+	switch (c)
+	{
+	    case 'j': jobs = atoi(optarg); if (jobs < 1) jobs = 1; break;
+	    case 'J': json = 1; break;
+	    default: optind = argc + 1; break;
+	}
     }
 
-    sprintf(systemcall,"sha1sum %s",argv[1]);
+    if (optind >= argc)
+    {
+        printf("Missing arguments! Usage: %s [--jobs=N] [--json] {filename-1 ... filename-n}\n \n",argv[0]);
+        return -1;
+    }
 
-  /* Display result */
-    if (calculate_sha1(argv[1], hash_result))
+  /* Hash all files in parallel */
+    hash_results = malloc((argc - optind) * sizeof(*hash_results));
+    if (!hash_results)
+	return -1;
+    if (calculate_sha1_files(argv + optind, argc - optind, hash_results, jobs))
     {
 	printf("Error during SHA1-calculation\n");
 	return -1;
     }
 
-//    printf("Results via sha1:\n");
-    for (i=0; i<5; i++)
-	printf("%08lx",hash_result[i]);
-    printf("  %s\n",argv[1]);
-//    printf("Results via sha1sum:\n");
-//    system(systemcall);
+  /* Display results in the order of the files */
+    if (json)
+	printf("[");
+    for (j=optind; j<argc; j++)
+    {
+	if (json)
+	{
+	    printf("%s{\"name\": ", j > optind ? ", " : "");
+	    print_json_string(argv[j]);
+	    printf(", \"sha1\": \"");
+	}
+	for (i=0; i<5; i++)
+	    printf("%08lx",(unsigned long) hash_results[j-optind][i]);
+	if (json)
+	    printf("\"}");
+	else
+	    printf("  %s\n",argv[j]);
+    }
+    if (json)
+	printf("]\n");
+    free(hash_results);
     return 0;
 }
@@ -0,0 +1,235 @@
+/*      This file contains functions and utilities for the Trusted GRUB project
+        at http://www.prosec.rub.de. It runs the inflate code of
+        stage2/gunzip.c over gzip files, outside of GRUB, checks the
+        output against the CRC and the length in the gzip trailer and
+        against reads after seeks, and measures its speed in MB/s of
+        output and for reads at random positions. To compare with
+        another version of the code, build it once more from that
+        gunzip.c, with -DGUNZIP_C='"file"'.
+        It is licensed under the same license as GRUB. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define WITHOUT_LIBC_STUBS 1
+#include <shared.h>
+
+// RAW_ADDR of shared.h truncates the address to an int
+#undef RAW_ADDR
+#define RAW_ADDR(x) ((x) + (unsigned long) grub_scratch_mem)
+
+#ifndef GUNZIP_C
+# define GUNZIP_C "../stage2/gunzip.c"
+#endif
+#include GUNZIP_C
+
+// What gunzip.c needs of the rest of GRUB
+int filepos;
+int filemax;
+int fsmax;
+grub_error_t errnum;
+struct multiboot_info mbi;
+char *grub_scratch_mem;
+
+// The compressed file, read from memory
+static unsigned char *file_data;
+
+#define BENCH_MEM_UPPER	0x1000		/* in KB */
+#define BENCH_READ	0x10000
+#define BENCH_SECONDS	2.0
+#define BENCH_SEEKS	64
+
+// Bound the read as grub_read of stage2/disk_io.c does
+int grub_read (char *buf, int len)
+{
+    if (filepos < 0 || filepos > filemax)
+	filepos = filemax;
+    if (len < 0 || len > filemax - filepos)
+	len = filemax - filepos;
+
+    if (compressed_file)
+	return gunzip_read(buf, len);
+    memcpy(buf, file_data + filepos, len);
+    filepos += len;
+    return len;
+}
+
+static unsigned long crc_table[256];
+
+static unsigned long crc32(unsigned long crc, unsigned char *buf, int len)
+{
+    crc = ~crc & 0xffffffff;
+    while (len--)
+	crc = crc_table[(crc ^ *buf++) & 0xff] ^ (crc >> 8);
+    return ~crc & 0xffffffff;
+}
+
+static double read_seconds(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// Open the file as grub_open does, and return its uncompressed size
+static int open_file(int size)
+{
+    filepos = 0;
+    filemax = fsmax = size;
+    compressed_file = 0;
+    errnum = 0;
+
+    if (!gunzip_test_header() || !compressed_file)
+	return -1;
+    return filemax;
+}
+
+// Read the whole file in pieces of LEN bytes into OUT
+static int read_file(int size, unsigned char *out, int len)
+{
+    int total = 0, ret;
+
+    if (open_file(size) < 0)
+	return -1;
+    while ((ret = grub_read((char *) out + total, len)) > 0)
+	total += ret;
+    return errnum ? -1 : total;
+}
+
+static int test_file(char *name, int size)
+{
+    static int seeks[] = { 0x12345, 0x8001, 0, 1, 0x7fff, 0x8000, 0x100, -1 };
+    unsigned char *out, *piece;
+    unsigned long crc, isize;
+    double seconds;
+    int i, len, pos, rounds;
+
+    if (size < 18 || file_data[0] != 0x1f || file_data[1] != 0x8b)
+    {
+	printf("%s: not a gzip file\n", name);
+	return 1;
+    }
+    crc = file_data[size - 8] | (file_data[size - 7] << 8)
+	| (file_data[size - 6] << 16) | ((unsigned long) file_data[size - 5] << 24);
+    isize = file_data[size - 4] | (file_data[size - 3] << 8)
+	| (file_data[size - 2] << 16) | ((unsigned long) file_data[size - 1] << 24);
+
+    out = malloc(isize + 1);
+    piece = malloc(0x10000);
+    if (!out || !piece)
+	return 1;
+
+    // Pieces of an odd size cover reads across the windows
+    len = read_file(size, out, 4093);
+    if (len != isize || crc32(0, out, len) != crc)
+    {
+	printf("%s: FAILED (error %d, %d of %lu bytes)\n", name, errnum, len, isize);
+	return 1;
+    }
+
+    // Seeks backwards restart the decompression, forwards they skip
+    for (i = 0; seeks[i] >= 0; i++)
+    {
+	pos = seeks[i] < isize ? seeks[i] : isize / 2;
+	filepos = pos;
+	len = grub_read((char *) piece, 0x10000);
+	if (len != (isize - pos < 0x10000 ? isize - pos : 0x10000)
+	    || memcmp(piece, out + pos, len))
+	{
+	    printf("%s: FAILED after a seek to %d\n", name, pos);
+	    return 1;
+	}
+    }
+    printf("%s: %d -> %lu bytes, OK\n", name, size, isize);
+
+    rounds = 0;
+    seconds = read_seconds();
+    do
+    {
+	read_file(size, out, BENCH_READ);
+	rounds++;
+    }
+    while (read_seconds() - seconds < BENCH_SECONDS);
+    seconds = read_seconds() - seconds;
+    printf("  %.1f MB/s\n", (double) isize * rounds / seconds / 0x100000);
+
+    // Reads at random positions, as a loader that seeks around does
+    if (open_file(size) < 0)
+	return 1;
+    srand(1);
+    seconds = read_seconds();
+    for (i = 0; i < BENCH_SEEKS; i++)
+    {
+	pos = isize > 0x1000 ? (unsigned long) rand() % (isize - 0x1000) : 0;
+	filepos = pos;
+	len = grub_read((char *) piece, 0x1000);
+	if (len < 0 || memcmp(piece, out + pos, len))
+	{
+	    printf("%s: FAILED after a seek to %d\n", name, pos);
+	    return 1;
+	}
+    }
+    seconds = read_seconds() - seconds;
+    printf("  %.2f ms per 4 KB read at a random position\n",
+	   seconds * 1000 / BENCH_SEEKS);
+
+    free(piece);
+    free(out);
+    return 0;
+}
+
+int main (int argc, char *argv[])
+{
+    unsigned long crc;
+    FILE *file;
+    long size;
+    int i, j, failed = 0;
+
+    if (argc < 2)
+    {
+	printf("Usage: %s FILE.gz...\n", argv[0]);
+	return -1;
+    }
+
+    for (i = 0; i < 256; i++)
+    {
+	crc = i;
+	for (j = 0; j < 8; j++)
+	    crc = crc & 1 ? (crc >> 1) ^ 0xedb88320 : crc >> 1;
+	crc_table[i] = crc;
+    }
+
+    // gunzip keeps its buffers at the top of upper memory
+    mbi.mem_upper = BENCH_MEM_UPPER;
+    grub_scratch_mem = malloc((BENCH_MEM_UPPER << 10) + 0x100000);
+    if (!grub_scratch_mem)
+	return -1;
+
+    for (i = 1; i < argc; i++)
+    {
+	file = fopen(argv[i], "rb");
+	if (!file || fseek(file, 0, SEEK_END) || (size = ftell(file)) <= 0)
+	{
+	    printf("%s: cannot read\n", argv[i]);
+	    failed++;
+	    continue;
+	}
+	file_data = malloc(size);
+	rewind(file);
+	if (!file_data || fread(file_data, 1, size, file) != size)
+	{
+	    printf("%s: cannot read\n", argv[i]);
+	    failed++;
+	}
+	else
+	    failed += test_file(argv[i], size);
+	fclose(file);
+	free(file_data);
+    }
+
+    free(grub_scratch_mem);
+    return failed ? -1 : 0;
+}
@@ -0,0 +1,137 @@
+/*      This file contains functions and utilities for the Trusted GRUB project
+        at http://www.prosec.rub.de. It checks every SHA1 engine supported
+        by the CPU against the test vectors of FIPS 180 and measures its
+        speed in cycles per byte (on x86) and MB/s.
+        It is licensed under the same license as GRUB. */
+
+#include "sha1.c"
+#include <time.h>
+
+// The test vectors of FIPS 180-2, appendix A
+static struct
+{
+    char *message;
+    int repeat;
+    t_U32 digest[5];
+} sha1_vectors[] =
+{
+    { "abc", 1,
+      { 0xa9993e36, 0x4706816a, 0xba3e2571, 0x7850c26c, 0x9cd0d89d } },
+    { "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", 1,
+      { 0x84983e44, 0x1c3bd26e, 0xbaae4aa1, 0xf95129e5, 0xe54670f1 } },
+    { "a", 1000000,
+      { 0x34aa973c, 0xd4c4daa4, 0xf61eeb2b, 0xdbad2731, 0x6534016f } },
+};
+
+#define BENCH_SIZE 0x1000000
+#define BENCH_ROUNDS 16
+
+static unsigned long long read_cycles(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+    unsigned int lo, hi;
+
+    __asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+    return ((unsigned long long) hi << 32) | lo;
+#else
+    return 0;
+#endif
+}
+
+static double read_seconds(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// Check the engine against the test vectors, feeding the long message
+// in chunks of odd sizes to cover the buffering of sha1_update
+static int test_engine(void)
+{
+    sha1_context ctx;
+    t_U32 digest[5];
+    t_U8 chunk[1000];
+    int i, len, left, failed = 0;
+
+    for (i = 0; i < sizeof(sha1_vectors) / sizeof(*sha1_vectors); i++)
+    {
+	sha1_init(&ctx);
+	len = strlen(sha1_vectors[i].message);
+	if (sha1_vectors[i].repeat == 1)
+	    sha1_update(&ctx, (t_U8*) sha1_vectors[i].message, len);
+	else
+	{
+	    memset(chunk, sha1_vectors[i].message[0], sizeof(chunk));
+	    for (left = sha1_vectors[i].repeat; left > 0; left -= len)
+	    {
+		len = left < 997 ? left : 997;
+		sha1_update(&ctx, chunk, len);
+	    }
+	}
+	sha1_finish(&ctx, digest);
+
+	if (memcmp(digest, sha1_vectors[i].digest, sizeof(digest)))
+	{
+	    printf("  FIPS 180 vector %d: FAILED\n", i + 1);
+	    failed++;
+	}
+	else
+	    printf("  FIPS 180 vector %d: OK\n", i + 1);
+    }
+    return failed;
+}
+
+static void bench_engine(t_U8 *data)
+{
+    sha1_context ctx;
+    t_U32 digest[5];
+    unsigned long long cycles;
+    double seconds;
+    int i;
+
+    cycles = read_cycles();
+    seconds = read_seconds();
+    for (i = 0; i < BENCH_ROUNDS; i++)
+    {
+	sha1_init(&ctx);
+	sha1_update(&ctx, data, BENCH_SIZE);
+	sha1_finish(&ctx, digest);
+    }
+    cycles = read_cycles() - cycles;
+    seconds = read_seconds() - seconds;
+
+    if (cycles)
+	printf("  %.2f cycles/byte, ", (double) cycles / ((double) BENCH_SIZE * BENCH_ROUNDS));
+    else
+	printf("  ");
+    printf("%.1f MB/s\n", (double) BENCH_SIZE * BENCH_ROUNDS / seconds / 0x100000);
+}
+
+int main (int argc, char *argv[])
+{
+    t_U8 *data;
+    int engine, failed = 0;
+
+    data = malloc(BENCH_SIZE);
+    if (!data)
+	return -1;
+    for (engine = 0; engine < BENCH_SIZE; engine++)
+	data[engine] = engine * 7;
+
+    for (engine = 0; engine < SHA1_ENGINES; engine++)
+    {
+	if (sha1_select_engine(engine) < 0)
+	{
+	    printf("%s: not supported by this CPU\n", sha1_engine_names[engine]);
+	    continue;
+	}
+	printf("%s:\n", sha1_engine_names[engine]);
+	failed += test_engine();
+	bench_engine(data);
+    }
+
+    free(data);
+    return failed ? -1 : 0;
+}
@@ -6,21 +6,51 @@
         For reuasage of the SHA1-implementation, please contact the original author. */
 
 #include "sha1.c"
+#include <getopt.h>
 //#define DEBUG
+
+static struct option longopts[] =
+{
+    {"jobs", required_argument, 0, 'j'},
+    {"json", no_argument, 0, 'J'},
+    {0},
+};
+
+static void usage(char *name)
+{
+    printf("Missing arguments! Usage: %s [--jobs=N] [--json] <pcr initial value {NULL | 20 byte hex}> {filenames-1 ... filenames-n}\n \n",name);
+}
+
 int main (int argc, char *argv[])
 {
-    int i,j,ret;
+    int i,j,c;
     int no_of_files;
-    char filename[1024];
+    int jobs, json = 0;
+    struct stat attribute;
     unsigned char pcr[20];
     unsigned char pcr2[40];
     t_U32 hash_result[5];
+    t_U32 (*file_hashes)[5];
     sha1_context my_sha1;
+    char *name = argv[0];
 
+    jobs = sha1_default_threads();
+    while ((c = getopt_long(argc, argv, "", longopts, NULL)) != -1)
+    {
+	switch (c)
+	{
+	    case 'j': jobs = atoi(optarg); if (jobs < 1) jobs = 1; break;
+	    case 'J': json = 1; break;
+	    default: usage(name); return -1;
+	}
+    }
+    // The PCR value and the files follow as before
+    argc -= optind - 1;
+    argv += optind - 1;
 
     if (argc < 3)
     {
-        printf("Missing arguments! Usage: %s  <pcr initial value {NULL | 20 byte hex}> {filenames-1 ... filenames-n}\n \n",argv[0]);
+        usage(name);
         return -1;
     }
 
@@ -85,11 +115,9 @@ int main (int argc, char *argv[])
 #ifdef DEBUG
 	printf("Testing %s: ",argv[i]);
 #endif
-	snprintf(filename, sizeof(filename), "test -e %s",argv[i]);
-	ret = system(filename);
-	if (ret)
+	if (stat(argv[i],&attribute) || S_ISDIR(attribute.st_mode))
 	{
-    	    printf("Error!\nWrong filename %s! Usage: %s <pcr initial value {NULL | 20 byte hex}> {filenames-1 ... filenames-n}\n \n",argv[i],argv[0]);
+    	    printf("Error!\nWrong filename %s! Usage: %s [--jobs=N] [--json] <pcr initial value {NULL | 20 byte hex}> {filenames-1 ... filenames-n}\n \n",argv[i],name);
     	    return -1;
 	}
 	else
@@ -100,23 +128,27 @@ int main (int argc, char *argv[])
 	}
     }
     
-    // Calculating SHA1
+    // Calculating SHA1 of all files in parallel
+
+    file_hashes = malloc((no_of_files-1) * sizeof(*file_hashes));
+    if (!file_hashes || calculate_sha1_files(argv+2, no_of_files-1, file_hashes, jobs))
+    {
+	printf("Error during SHA1-calculation\n");
+	return -1;
+    }
+
+    // Extending the PCR in the order of the files
 
     for (j=2; j<= no_of_files; j++)
     {
-	if (calculate_sha1(argv[j], hash_result))
-	{
-	    printf("Error during SHA1-calculation\n");
-	    return -1;
-	}
 	// Copying current PCR content into new buffer
 	memcpy(pcr2,pcr,20);
 	for (i=0; i<5; i++)
 	{
-	    pcr2[20+(4*i)] = ((hash_result[i] >> 24) & 0xff);
-	    pcr2[21+(4*i)] = ((hash_result[i] >> 16) & 0xff);
-	    pcr2[22+(4*i)] = ((hash_result[i] >>  8) & 0xff);
-	    pcr2[23+(4*i)] = ((hash_result[i]      ) & 0xff);
+	    pcr2[20+(4*i)] = ((file_hashes[j-2][i] >> 24) & 0xff);
+	    pcr2[21+(4*i)] = ((file_hashes[j-2][i] >> 16) & 0xff);
+	    pcr2[22+(4*i)] = ((file_hashes[j-2][i] >>  8) & 0xff);
+	    pcr2[23+(4*i)] = ((file_hashes[j-2][i]      ) & 0xff);
 	}
 
         /* Display result */
@@ -143,6 +175,27 @@ int main (int argc, char *argv[])
 	printf("\n");
 #endif
     }
+    if (json)
+    {
+	printf("{\"pcr\": \"");
+	for (i=0; i<20; i++)
+	    printf("%02x",pcr[i]);
+	printf("\", \"files\": [");
+	for (j=2; j<= no_of_files; j++)
+	{
+	    printf("%s{\"name\": ", j > 2 ? ", " : "");
+	    print_json_string(argv[j]);
+	    printf(", \"sha1\": \"");
+	    for (i=0; i<5; i++)
+		printf("%08lx",(unsigned long) file_hashes[j-2][i]);
+	    printf("\"}");
+	}
+	printf("]}\n");
+	free(file_hashes);
+	return 0;
+    }
+    free(file_hashes);
+
     printf(   "*******************************************************************************\n* Result for PCR: ");
     for (i=0; i<20; i++)
         printf("%02x ",pcr[i]);